@@ -0,0 +1,244 @@
+#include "codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace netvid;
+
+static const std::size_t max_short_length=63;
+static const std::size_t max_length=64+255;
+
+enum token_type : std::uint8_t
+{
+	token_literal=0x00,
+	token_run=0x40,
+	token_copy=0x80,
+	token_type_mask=0xc0,
+};
+
+template<std::size_t unit>
+static std::uint32_t load(const std::uint8_t *p)
+{
+	std::uint32_t value=0;
+
+	std::memcpy(&value, p, unit);
+
+	return value;
+}
+
+namespace
+{
+	struct token_writer
+	{
+		std::uint8_t *pos;
+		std::uint8_t *end;
+
+		bool token(std::uint8_t type, std::size_t length)
+		{
+			std::size_t bytes=length>max_short_length ? 2 : 1;
+
+			if (std::size_t(end-pos)<bytes)
+				return false;
+
+			if (length>max_short_length)
+			{
+				*pos++=type | max_short_length;
+				*pos++=std::uint8_t(length-64);
+			}
+			else
+				*pos++=type | std::uint8_t(length-1);
+
+			return true;
+		}
+
+		bool bytes(const std::uint8_t *data, std::size_t size)
+		{
+			if (std::size_t(end-pos)<size)
+				return false;
+
+			pos=std::copy(data, data+size, pos);
+
+			return true;
+		}
+	};
+}
+
+template<std::size_t unit>
+static std::size_t encode(const std::uint8_t *src, std::size_t src_pitch, std::size_t row_bytes, std::size_t rows, std::uint8_t *dst, std::size_t capacity)
+{
+	// a run token costs a unit plus a byte
+	const std::size_t min_run=unit==1 ? 3 : 2;
+	std::size_t count=row_bytes/unit;
+	token_writer out={ dst, dst+capacity };
+
+	for (std::size_t y=0; y<rows; ++y)
+	{
+		auto row=src+y*src_pitch;
+		auto above=y>0 ? row-src_pitch : row;
+		std::size_t literal_begin=0;
+
+		auto flush_literals=[&] (std::size_t literal_end)
+		{
+			while (literal_begin<literal_end)
+			{
+				auto length=std::min(literal_end-literal_begin, max_length);
+
+				if (!out.token(token_literal, length) || !out.bytes(row+literal_begin*unit, length*unit))
+					return false;
+
+				literal_begin+=length;
+			}
+
+			return true;
+		};
+
+		for (std::size_t i=0; i<count;)
+		{
+			auto limit=std::min(count-i, max_length);
+			auto value=load<unit>(row+i*unit);
+			std::size_t copy=0;
+			std::size_t run=1;
+
+			if (y>0)
+			{
+				while (copy<limit && load<unit>(row+(i+copy)*unit)==load<unit>(above+(i+copy)*unit))
+					++copy;
+			}
+
+			while (run<limit && load<unit>(row+(i+run)*unit)==value)
+				++run;
+
+			if (copy>=2 && copy>=run)
+			{
+				if (!flush_literals(i) || !out.token(token_copy, copy))
+					return 0;
+
+				i+=copy;
+			}
+			else if (run>=min_run)
+			{
+				if (!flush_literals(i) || !out.token(token_run, run) || !out.bytes(row+i*unit, unit))
+					return 0;
+
+				i+=run;
+			}
+			else
+			{
+				++i;
+
+				continue;
+			}
+
+			literal_begin=i;
+		}
+
+		if (!flush_literals(count))
+			return 0;
+	}
+
+	return out.pos-dst;
+}
+
+template<std::size_t unit>
+static bool decode(const std::uint8_t *src, std::size_t size, std::uint8_t *dst, std::size_t dst_pitch, std::size_t row_bytes, std::size_t rows)
+{
+	auto end=src+size;
+	std::size_t count=row_bytes/unit;
+
+	for (std::size_t y=0; y<rows; ++y)
+	{
+		auto row=dst+y*dst_pitch;
+
+		for (std::size_t i=0; i<count;)
+		{
+			if (src==end)
+				return false;
+
+			auto token=*src++;
+			std::size_t length=(token & max_short_length)+1;
+
+			if (length>max_short_length)
+			{
+				if (src==end)
+					return false;
+
+				length=64+*src++;
+			}
+
+			if (length>count-i)
+				return false;
+
+			auto pos=row+i*unit;
+			auto bytes=length*unit;
+
+			switch (token & token_type_mask)
+			{
+			case token_literal:
+				if (std::size_t(end-src)<bytes)
+					return false;
+
+				std::memcpy(pos, src, bytes);
+				src+=bytes;
+				break;
+
+			case token_run:
+				if (std::size_t(end-src)<unit)
+					return false;
+
+				for (std::size_t j=0; j<length; ++j)
+					std::memcpy(pos+j*unit, src, unit);
+
+				src+=unit;
+				break;
+
+			case token_copy:
+				if (y==0)
+					return false;
+
+				std::memcpy(pos, pos-dst_pitch, bytes);
+				break;
+
+			default:
+				return false;
+			}
+
+			i+=length;
+		}
+	}
+
+	return src==end;
+}
+
+std::size_t netvid::rle_encode(const std::uint8_t *src, std::size_t src_pitch, std::size_t row_bytes, std::size_t rows, std::size_t unit, std::uint8_t *dst, std::size_t capacity)
+{
+	switch (unit)
+	{
+	case 1:
+		return encode<1>(src, src_pitch, row_bytes, rows, dst, capacity);
+	case 2:
+		return encode<2>(src, src_pitch, row_bytes, rows, dst, capacity);
+	case 3:
+		return encode<3>(src, src_pitch, row_bytes, rows, dst, capacity);
+	case 4:
+		return encode<4>(src, src_pitch, row_bytes, rows, dst, capacity);
+	}
+
+	return 0;
+}
+
+bool netvid::rle_decode(const std::uint8_t *src, std::size_t size, std::uint8_t *dst, std::size_t dst_pitch, std::size_t row_bytes, std::size_t rows, std::size_t unit)
+{
+	switch (unit)
+	{
+	case 1:
+		return decode<1>(src, size, dst, dst_pitch, row_bytes, rows);
+	case 2:
+		return decode<2>(src, size, dst, dst_pitch, row_bytes, rows);
+	case 3:
+		return decode<3>(src, size, dst, dst_pitch, row_bytes, rows);
+	case 4:
+		return decode<4>(src, size, dst, dst_pitch, row_bytes, rows);
+	}
+
+	return false;
+}
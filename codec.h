@@ -0,0 +1,32 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace netvid
+{
+	// run-length coding of pixel rows, cheap enough to run per chunk on both ends
+	//
+	// each row is a sequence of tokens over units (whole pixels where possible), none crossing rows:
+	// 00nnnnnn literal, the units follow
+	// 01nnnnnn run, one unit follows and repeats
+	// 10nnnnnn copy of the units right above, from the previous row
+	// n+1 units, n=63 is followed by a byte e for 64+e units
+
+	// pixel size for whole-byte pixels, bytes otherwise
+	inline std::size_t codec_unit_size(int bpp, std::size_t row_bytes)
+	{
+		std::size_t unit=bpp%8==0 ? bpp/8 : 1;
+
+		return unit>0 && unit<=4 && row_bytes%unit==0 ? unit : 1;
+	}
+
+	// encodes rows of row_bytes each, src_pitch apart, returns the encoded size or 0 if it exceeds capacity
+	std::size_t rle_encode(const std::uint8_t *src, std::size_t src_pitch, std::size_t row_bytes, std::size_t rows, std::size_t unit, std::uint8_t *dst, std::size_t capacity);
+
+	// decodes into rows dst_pitch apart, false if the data is malformed or doesn't cover the rows exactly
+	bool rle_decode(const std::uint8_t *src, std::size_t size, std::uint8_t *dst, std::size_t dst_pitch, std::size_t row_bytes, std::size_t rows, std::size_t unit);
+}
+
+#endif /* CODEC_H */
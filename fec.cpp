@@ -0,0 +1,186 @@
+#include "fec.h"
+
+#include <limits>
+
+using namespace netvid;
+
+static void xor_bytes(std::vector<std::uint8_t> &dest, std::size_t offset, const std::uint8_t *data, std::size_t size)
+{
+	if (dest.size()<offset+size)
+		dest.resize(offset+size, 0);
+
+	auto out=dest.data()+offset;
+
+	for (std::size_t i=0; i<size; ++i)
+		out[i]^=data[i];
+}
+
+void parity_encoder::reset(std::uint32_t frame_id, std::uint32_t first_chunk_id)
+{
+	header=remote_parity_header();
+	header.frame_id=frame_id;
+	header.first_chunk_id=first_chunk_id;
+	payload.clear();
+}
+
+void parity_encoder::add_bytes(std::size_t offset, const std::uint8_t *data, std::size_t size)
+{
+	xor_bytes(payload, offset, data, size);
+}
+
+void fec_decoder::process(const std::uint8_t *data_begin, const std::uint8_t *data_end)
+{
+	std::size_t size=data_end-data_begin;
+
+	if (group_size==0 || group_size>max_fec_group_size || size<sizeof(remote_header))
+		return;
+
+	auto type=pkt_type(reinterpret_cast<const remote_header *>(data_begin)->pkt_id);
+
+	if (type==remote_chunk_header().pkt_id)
+	{
+		if (size<sizeof(remote_chunk_header))
+			return;
+
+		auto &rch=*reinterpret_cast<const remote_chunk_header *>(data_begin);
+
+		if (!select_frame(rch.frame_id))
+			return;
+
+		auto first_chunk_id=rch.chunk_id-rch.chunk_id%group_size;
+		auto g=get_group(first_chunk_id);
+		auto bit=1u << (rch.chunk_id-first_chunk_id);
+
+		if (!g || g->resolved || (g->received_mask & bit))
+			return;
+
+		g->received_mask|=bit;
+		g->length_xor^=size;
+		add(*g, data_begin, size);
+		try_recover(*g, first_chunk_id);
+	}
+	else if (type==remote_parity_header().pkt_id)
+	{
+		if (size<sizeof(remote_parity_header))
+			return;
+
+		auto &rph=*reinterpret_cast<const remote_parity_header *>(data_begin);
+
+		if (rph.first_chunk_id%group_size!=0 || !select_frame(rph.frame_id))
+			return;
+
+		auto g=get_group(rph.first_chunk_id);
+
+		if (!g || g->parity || g->resolved)
+			return;
+
+		g->parity=true;
+		g->chunk_mask=rph.chunk_mask;
+		g->length_xor^=rph.length_xor;
+		add(*g, data_begin+sizeof(rph), size-sizeof(rph));
+		try_recover(*g, rph.first_chunk_id);
+	}
+}
+
+void fec_decoder::reset()
+{
+	frame_id=boost::none;
+
+	for (auto &g : groups)
+		g=group();
+}
+
+bool fec_decoder::select_frame(std::uint32_t new_frame_id)
+{
+	if (frame_id && *frame_id==new_frame_id)
+		return true;
+
+	// late packets of an older frame are of no use
+	if (frame_id && new_frame_id-*frame_id>=std::numeric_limits<std::uint32_t>::max()/2)
+		return false;
+
+	finish_frame();
+	frame_id=new_frame_id;
+
+	return true;
+}
+
+void fec_decoder::finish_frame()
+{
+	for (auto &g : groups)
+	{
+		auto missing=g.chunk_mask & ~g.received_mask;
+
+		if (g.parity && !g.resolved && (missing & (missing-1)))
+			++stats.unrecoverable;
+
+		// keeps the buffer's capacity for the next frame
+		g.data.clear();
+		g.received_mask=0;
+		g.chunk_mask=0;
+		g.length_xor=0;
+		g.parity=false;
+		g.resolved=false;
+	}
+}
+
+fec_decoder::group *fec_decoder::get_group(std::uint32_t first_chunk_id)
+{
+	if (first_chunk_id>=max_chunks)
+		return nullptr;
+
+	auto index=first_chunk_id/group_size;
+
+	if (index>=groups.size())
+		groups.resize(index+1);
+
+	return &groups[index];
+}
+
+void fec_decoder::add(group &g, const std::uint8_t *data, std::size_t size)
+{
+	xor_bytes(g.data, 0, data, size);
+}
+
+void fec_decoder::try_recover(group &g, std::uint32_t first_chunk_id)
+{
+	if (!g.parity)
+		return;
+
+	auto missing=g.chunk_mask & ~g.received_mask;
+
+	// nothing or too much lost, or wait for more chunks
+	if (missing==0 || (missing & (missing-1)))
+	{
+		g.resolved=missing==0;
+
+		return;
+	}
+
+	g.resolved=true;
+
+	auto length=g.length_xor;
+
+	if (length<sizeof(remote_chunk_header) || length>g.data.size())
+	{
+		++stats.unrecoverable;
+
+		return;
+	}
+
+	recovered.assign(g.data.begin(), g.data.begin()+length);
+
+	auto &rch=*reinterpret_cast<const remote_chunk_header *>(recovered.data());
+
+	if (rch.frame_id!=*frame_id || rch.chunk_id-first_chunk_id>=group_size || !(missing & (1u << (rch.chunk_id-first_chunk_id))))
+	{
+		++stats.unrecoverable;
+
+		return;
+	}
+
+	++stats.recovered;
+
+	if (on_recovered)
+		on_recovered(recovered.data(), recovered.data()+recovered.size());
+}
@@ -0,0 +1,97 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <array>
+#include <functional>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/optional.hpp>
+
+#include "protocol.h"
+
+namespace netvid
+{
+	static const std::uint32_t max_fec_group_size=32;
+
+	// xor parity over a group of chunk datagrams, any single lost datagram of the group can be rebuilt from it
+	struct parity_encoder
+	{
+		remote_parity_header header;
+		std::vector<std::uint8_t> payload;
+
+		void reset(std::uint32_t frame_id, std::uint32_t first_chunk_id);
+
+		bool empty() const
+		{
+			return header.chunk_mask==0;
+		}
+
+		template<class buffer_sequence>
+		void add(std::uint32_t chunk_id, const buffer_sequence &packet)
+		{
+			std::size_t offset=0;
+
+			for (const auto &i : packet)
+			{
+				auto data=boost::asio::buffer_cast<const std::uint8_t *>(i);
+				auto size=boost::asio::buffer_size(i);
+
+				add_bytes(offset, data, size);
+				offset+=size;
+			}
+
+			header.chunk_mask|=1u << (chunk_id-header.first_chunk_id);
+			header.length_xor^=offset;
+		}
+
+		std::array<boost::asio::const_buffer, 2> packet() const
+		{
+			return { { boost::asio::buffer(&header, sizeof(header)), boost::asio::buffer(payload) } };
+		}
+
+	private:
+		void add_bytes(std::size_t offset, const std::uint8_t *data, std::size_t size);
+	};
+
+	// accumulates the chunks and parity of the latest frame, and rebuilds a chunk once its group's parity says it's the only one missing
+	struct fec_decoder
+	{
+		std::uint32_t group_size=0;
+		std::function<void(const std::uint8_t *data_begin, const std::uint8_t *data_end)> on_recovered;
+
+		static const std::uint32_t max_chunks=1024*1024;
+
+		struct statistics
+		{
+			std::uint64_t recovered=0;
+			std::uint64_t unrecoverable=0; // groups with more losses than parity
+		} stats;
+
+		void process(const std::uint8_t *data_begin, const std::uint8_t *data_end);
+		void reset();
+
+	private:
+		struct group
+		{
+			std::vector<std::uint8_t> data;
+			std::uint32_t received_mask=0;
+			std::uint32_t chunk_mask=0;
+			std::uint32_t length_xor=0;
+			bool parity=false;
+			bool resolved=false;
+		};
+
+		boost::optional<std::uint32_t> frame_id;
+		std::vector<group> groups;
+		std::vector<std::uint8_t> recovered;
+
+		bool select_frame(std::uint32_t new_frame_id);
+		void finish_frame();
+		group *get_group(std::uint32_t first_chunk_id);
+		void add(group &g, const std::uint8_t *data, std::size_t size);
+		void try_recover(group &g, std::uint32_t first_chunk_id);
+	};
+}
+
+#endif /* FEC_H */
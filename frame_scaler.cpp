@@ -0,0 +1,120 @@
+#include "frame_scaler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+bool frame_scaler::scale(const frame_data &src, frame_data &screen, const std::array<channel_bits, 3> &screen_channels)
+{
+	const std::array<channel_bits, 3> *channels;
+
+	if (src.bpp==32)
+		channels=&fmt_a8r8g8b8.channels;
+	else if (src.bpp==16)
+		channels=&format16.channels;
+	else
+		return false;
+
+	if (!screen_supported(screen))
+		return false;
+
+	if (src.width!=src_width || src.height!=src_height || src.aspect_ratio!=aspect_ratio || screen.width!=screen_width || screen.height!=screen_height || screen.bpp!=screen_bpp)
+		set_geometry(src, screen);
+
+	std::size_t pixel_size=screen.bpp/8;
+	std::size_t row_bytes=std::size_t(screen.width)*pixel_size;
+
+	// each page gets its borders once
+	if (std::find(cleared_pages.begin(), cleared_pages.end(), screen.data)==cleared_pages.end())
+	{
+		for (int y=0; y<screen.height; ++y)
+			std::fill_n(screen.pixel<std::uint8_t>(0, y), row_bytes, 0);
+
+		cleared_pages.push_back(screen.data);
+	}
+
+	auto line_bytes=reinterpret_cast<const std::uint8_t *>(line.data());
+	int last_y=-1;
+
+	for (int y=0; y<height; ++y)
+	{
+		int src_y=y_map[y];
+
+		// repeated rows are copied from the line, the screen may be slow to read back
+		if (src_y!=last_y)
+		{
+			auto src_row=src.pixel<std::uint8_t>(0, src_y);
+
+			if (width==src.width)
+				convert_pixel_data(*channels, src.bpp/8, src_row, screen_channels, pixel_size, line.data(), width, kernel);
+			else
+			{
+				convert_pixel_data(*channels, src.bpp/8, src_row, screen_channels, pixel_size, row.data(), src.width, kernel);
+
+				if (pixel_size==4)
+					sample_row<std::uint32_t>();
+				else
+					sample_row<std::uint16_t>();
+			}
+
+			last_y=src_y;
+		}
+
+		std::copy(line_bytes, line_bytes+width*pixel_size, screen.pixel<std::uint8_t>(left, top+y));
+	}
+
+	return true;
+}
+
+template<class pixel_type>
+void frame_scaler::sample_row()
+{
+	auto src=reinterpret_cast<const pixel_type *>(row.data());
+	auto dst=reinterpret_cast<pixel_type *>(line.data());
+
+	for (int x=0; x<width; ++x)
+		dst[x]=src[x_map[x]];
+}
+
+void frame_scaler::set_geometry(const frame_data &src, const frame_data &screen)
+{
+	src_width=src.width;
+	src_height=src.height;
+	aspect_ratio=src.aspect_ratio;
+	screen_width=screen.width;
+	screen_height=screen.height;
+	screen_bpp=screen.bpp;
+	cleared_pages.clear();
+
+	double aspect=aspect_ratio>0 ? aspect_ratio : double(src.width)/std::max(src.height, 1);
+
+	if (aspect*screen.height>screen.width)
+	{
+		width=screen.width;
+		height=std::min<int>(screen.height, std::lround(screen.width/aspect));
+	}
+	else
+	{
+		width=std::min<int>(screen.width, std::lround(screen.height*aspect));
+		height=screen.height;
+	}
+
+	left=(screen.width-width)/2;
+	top=(screen.height-height)/2;
+
+	// sample at pixel centres
+	x_map.resize(width);
+	y_map.resize(height);
+
+	for (int x=0; x<width; ++x)
+		x_map[x]=int((2*std::int64_t(x)+1)*src.width/(2*width));
+
+	for (int y=0; y<height; ++y)
+		y_map[y]=int((2*std::int64_t(y)+1)*src.height/(2*height));
+
+	// 32 bits a pixel at most, 16bpp screens use half of them
+	row.resize(src.width);
+	line.resize(width);
+
+	std::cerr << "Showing " << src.width << "x" << src.height << " " << src.bpp << "bpp at " << width << "x" << height << "+" << left << "+" << top << " on a " << screen.bpp << "bpp screen" << std::endl;
+}
@@ -0,0 +1,49 @@
+#ifndef FRAME_SCALER_H
+#define FRAME_SCALER_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "framebuffer.h"
+#include "pixel_convert.h"
+
+// fits frames into the screen as their aspect ratio says, letterboxed and nearest-neighbour scaled
+// the screen keeps its own layout, 16 or 32bpp
+struct frame_scaler
+{
+	pixel_format<std::uint16_t> format16=fmt_r5g6b5; // of 16bpp sources
+
+	static bool screen_supported(const frame_data &screen)
+	{
+		return screen.bpp==16 || screen.bpp==32;
+	}
+
+	// false if the source or the screen has a depth that isn't converted
+	bool scale(const frame_data &src, frame_data &screen, const std::array<channel_bits, 3> &screen_channels);
+
+private:
+	int src_width=0;
+	int src_height=0;
+	double aspect_ratio=0;
+	int screen_width=0;
+	int screen_height=0;
+	int screen_bpp=0;
+	std::vector<const std::uint8_t *> cleared_pages;
+	int left=0;
+	int top=0;
+	int width=0;
+	int height=0;
+	std::vector<int> x_map;
+	std::vector<int> y_map;
+	std::vector<std::uint32_t> row; // a source row in the screen's layout
+	std::vector<std::uint32_t> line; // a screen row
+	pixel_kernel kernel=best_pixel_kernel();
+
+	void set_geometry(const frame_data &src, const frame_data &screen);
+
+	template<class pixel_type>
+	void sample_row();
+};
+
+#endif /* FRAME_SCALER_H */
@@ -2,18 +2,21 @@
 
 #include "linux_framebuffer.h"
 
+#include <stdexcept>
+
 #include <fcntl.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
 
 #include <linux/fb.h>
 
 #include "check.h"
 
-linux_framebuffer::linux_framebuffer(const std::string &fb_path, const std::string &tty_path/*=std::string()*/)
+linux_framebuffer::linux_framebuffer(const std::string &fb_path, const std::string &tty_path/*=std::string()*/, bool double_buffered/*=false*/)
 {
 	int handle=CHECK(open(fb_path.c_str(), O_RDWR));
 
@@ -30,8 +33,21 @@ linux_framebuffer::linux_framebuffer(const std::string &fb_path, const std::stri
 
 	variable_info.bits_per_pixel=32;
 
-	CHECK(ioctl(*framebuffer_handle, FBIOPUT_VSCREENINFO, &variable_info));
+	if (double_buffered)
+	{
+		auto doubled=variable_info;
+
+		doubled.yres_virtual=2*doubled.yres;
+
+		if (ioctl(*framebuffer_handle, FBIOPUT_VSCREENINFO, &doubled)!=0)
+			double_buffered=false;
+	}
 
+	if (!double_buffered)
+		CHECK(ioctl(*framebuffer_handle, FBIOPUT_VSCREENINFO, &variable_info));
+
+	// what the driver made of it
+	CHECK(ioctl(*framebuffer_handle, FBIOGET_VSCREENINFO, &variable_info));
 	CHECK(ioctl(*framebuffer_handle, FBIOGET_FSCREENINFO, &fixed_info));
 
 	variable_info.xoffset=0;
@@ -43,9 +59,20 @@ linux_framebuffer::linux_framebuffer(const std::string &fb_path, const std::stri
 	screen.height=variable_info.yres;
 	screen.pitch=(variable_info.xres_virtual*variable_info.bits_per_pixel+7)/8;
 	screen.bpp=variable_info.bits_per_pixel;
-	screen.data=static_cast<std::uint8_t *>(CHECK(mmap(0, screen.bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, *framebuffer_handle, 0)));
+	channels={ { { int(variable_info.red.offset), int(variable_info.red.length) }, { int(variable_info.green.offset), int(variable_info.green.length) }, { int(variable_info.blue.offset), int(variable_info.blue.length) } } };
 
-	std::cout << screen.width << "x" << screen.height << " " << screen.bpp << "bpp" << " pitch: " << screen.pitch << std::endl;
+	if (double_buffered && (variable_info.yres_virtual<2*variable_info.yres || fixed_info.smem_len<2u*screen.bytes()))
+		double_buffered=false;
+
+	screen.data=static_cast<std::uint8_t *>(CHECK(mmap(0, screen.bytes()*(double_buffered ? 2 : 1), PROT_READ | PROT_WRITE, MAP_SHARED, *framebuffer_handle, 0)));
+
+	if (double_buffered)
+	{
+		back_page=screen;
+		back_page.data=screen.data+screen.bytes();
+	}
+
+	std::cout << screen.width << "x" << screen.height << " " << screen.bpp << "bpp" << " pitch: " << screen.pitch << (double_buffered ? ", double buffered" : "") << std::endl;
 	std::cout << "Pixel clock: " << 1e12/double(variable_info.pixclock) << " Hz" << std::endl;
 	std::cout << "Left margin: " << variable_info.left_margin << " pixels" << std::endl;
 	std::cout << "Right margin: " << variable_info.right_margin << " pixels" << std::endl;
@@ -55,6 +82,37 @@ linux_framebuffer::linux_framebuffer(const std::string &fb_path, const std::stri
 	std::cout << "VSYNC: " << variable_info.vsync_len << " pixels" << std::endl;
 }
 
+linux_framebuffer::linux_framebuffer(const std::string &file_path, int width, int height, bool double_buffered/*=false*/, int bpp/*=32*/)
+	: device(false)
+{
+	if (bpp!=16 && bpp!=32)
+		throw std::invalid_argument("Unsupported screen depth "+std::to_string(bpp));
+
+	int handle=CHECK(open(file_path.c_str(), O_RDWR | O_CREAT, 0644));
+
+	framebuffer_handle.reset(new int(handle), [] (int *handle) { close(*handle); delete handle; });
+
+	screen.width=width;
+	screen.height=height;
+	screen.pitch=width*bpp/8;
+	screen.bpp=bpp;
+
+	if (bpp==16)
+		channels=fmt_r5g6b5.channels;
+
+	int pages=double_buffered ? 2 : 1;
+
+	CHECK(ftruncate(*framebuffer_handle, screen.bytes()*pages));
+
+	screen.data=static_cast<std::uint8_t *>(CHECK(mmap(0, screen.bytes()*pages, PROT_READ | PROT_WRITE, MAP_SHARED, *framebuffer_handle, 0)));
+
+	if (double_buffered)
+	{
+		back_page=screen;
+		back_page.data=screen.data+screen.bytes();
+	}
+}
+
 void linux_framebuffer::disable_blanking()
 {
 	if (!ttyfs)
@@ -79,9 +137,43 @@ void linux_framebuffer::wake_up()
 	*ttyfs << "\033[13]" << std::flush; // Wake up terminal
 }
 
-void linux_framebuffer::wait_for_vsync()
+bool linux_framebuffer::wait_for_vsync()
+{
+	if (!device)
+		return false;
+
+	std::uint32_t screen_index=0;
+
+	return ioctl(*framebuffer_handle, FBIO_WAITFORVSYNC, &screen_index)==0;
+}
+
+void linux_framebuffer::flip(bool vsync)
 {
-	ioctl(*framebuffer_handle, FBIO_WAITFORVSYNC, 0);
+	if (!back_page)
+	{
+		if (vsync)
+			wait_for_vsync();
+
+		return;
+	}
+
+	if (device)
+	{
+		fb_var_screeninfo variable_info;
+
+		CHECK(ioctl(*framebuffer_handle, FBIOGET_VSCREENINFO, &variable_info));
+
+		variable_info.xoffset=0;
+		variable_info.yoffset=back_page.data>screen.data ? screen.height : 0;
+
+		// panning in the blanking interval just waited for takes effect before the next scanout, drivers pan right away either way
+		// those that can't wait are left to defer the pan to vsync themselves
+		variable_info.activate=vsync && !wait_for_vsync() ? FB_ACTIVATE_VBL : FB_ACTIVATE_NOW;
+
+		CHECK(ioctl(*framebuffer_handle, FBIOPAN_DISPLAY, &variable_info));
+	}
+
+	std::swap(screen, back_page);
 }
 
 #endif
\ No newline at end of file
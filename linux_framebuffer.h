@@ -14,14 +14,26 @@ struct linux_framebuffer
 {
 	std::shared_ptr<int> framebuffer_handle;
 	boost::optional<std::ofstream> ttyfs;
-	frame_data screen;
+	frame_data screen; // the page on display
+	frame_data back_page; // with double buffering the page to draw the next frame into, empty without
+	std::array<channel_bits, 3> channels=fmt_a8r8g8b8.channels; // the screen's pixel layout, as the driver reports it
+	bool device=true;
 
-	linux_framebuffer(const std::string &fb_path, const std::string &tty_path=std::string());
+	// double buffering doubles yres_virtual, drivers that refuse leave a single page
+	linux_framebuffer(const std::string &fb_path, const std::string &tty_path=std::string(), bool double_buffered=false);
+
+	// a plain file of pixels instead of a device, to run without a display, there's no vsync to wait for
+	// 32bpp are a8r8g8b8, 16bpp r5g6b5
+	linux_framebuffer(const std::string &file_path, int width, int height, bool double_buffered=false, int bpp=32);
 
 	void disable_blanking();
 	void hide_cursor();
 	void wake_up();
-	void wait_for_vsync();
+	bool wait_for_vsync(); // false if the driver can't wait
+
+	// pans to back_page at the next vsync and returns once the old page is off screen, it becomes the back page
+	// without vsync it pans right away, a single page only waits for vsync
+	void flip(bool vsync=true);
 };
 
 #endif
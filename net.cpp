@@ -1,18 +1,24 @@
 #include "net.h"
 
 #include <chrono>
+#include <cstring>
 #include <iostream>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/optional/optional_io.hpp>
 
+#if __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 using namespace boost;
 using namespace boost::asio;
 using namespace boost::asio::ip;
 using namespace netvid;
 
 socket_wrapper::socket_wrapper(boost::asio::io_service &service)
-	: socket(service), strand(service)
+	: service(service), socket(service), strand(service)
 {
 	socket.open(boost::asio::ip::udp::v4());
 }
@@ -62,6 +68,102 @@ boost::asio::ip::udp::endpoint socket_wrapper::string_to_endpoint(const std::str
 	return endpoint;
 }
 
+void rate_limited_sender::begin_frame(std::size_t frame_bytes)
+{
+	rate=max_rate_bytes;
+
+	if (frame_interval.count()>0)
+		rate=std::min(rate, frame_bytes/std::chrono::duration<double>(frame_interval).count());
+
+	if (kernel_pacing)
+		apply_kernel_pacing();
+}
+
+void rate_limited_sender::apply_kernel_pacing()
+{
+#if defined(__linux__) && defined(SO_MAX_PACING_RATE)
+	unsigned int pacing_rate=current_rate();
+
+	if (setsockopt(sw.socket.native_handle(), SOL_SOCKET, SO_MAX_PACING_RATE, &pacing_rate, sizeof(pacing_rate))==0)
+		return;
+
+	std::cerr << "SO_MAX_PACING_RATE failed: " << boost::system::error_code(errno, boost::asio::error::get_system_category()).message() << std::endl;
+#endif
+
+	std::cerr << "Kernel pacing unavailable, falling back to timers" << std::endl;
+	kernel_pacing=false;
+}
+
+void rate_limited_sender::refill()
+{
+	auto now=clock_type::now();
+	std::chrono::duration<double> elapsed=now-last_refill;
+
+	tokens=std::min<double>(burst_bytes, tokens+elapsed.count()*current_rate());
+	last_refill=now;
+}
+
+void rate_limited_sender::acquire(std::size_t bytes, std::function<void(const boost::system::error_code &error)> continuation)
+{
+	if (kernel_pacing)
+		return continuation(boost::system::error_code());
+
+	refill();
+
+	// anything goes while there are tokens left, the debt is paid off by waiting for the next burst
+	if (tokens>=0)
+	{
+		tokens-=bytes;
+
+		return continuation(boost::system::error_code());
+	}
+
+	// wait until the bucket is half full, timer slack up to the other half still counts
+	std::chrono::duration<double> wait((burst_bytes/2.-tokens)/current_rate());
+
+	timer.expires_from_now(std::chrono::duration_cast<clock_type::duration>(wait));
+	timer.async_wait([this, bytes, continuation] (const boost::system::error_code &error)
+	{
+		// cancelled, also when the timer goes with the sender
+		if (error)
+			return continuation(error);
+
+		refill();
+		tokens-=bytes;
+		continuation(error);
+	});
+}
+
+void rate_limited_sender::send_batch(packet_batch &batch, batch_handler_type sent_handler)
+{
+	if (batch.done())
+		return sent_handler(boost::system::error_code(), batch.bytes);
+
+	std::size_t bytes=0;
+	auto end=batch.sent;
+
+	// at least one packet, then as many as fit in a burst
+	do
+		bytes+=batch.packet_bytes(end++);
+	while (end<batch.packets.size() && bytes+batch.packet_bytes(end)<=std::size_t(burst_bytes));
+
+	acquire(bytes, [this, &batch, sent_handler, end] (const boost::system::error_code &error)
+	{
+		if (error)
+			return sent_handler(error, 0);
+
+		batch.released=end;
+
+		async_send_batch(sw, remote_endpoint, batch, [this, &batch, sent_handler] (const boost::system::error_code &error, std::size_t bytes_transferred)
+		{
+			if (error)
+				return sent_handler(error, bytes_transferred);
+
+			send_batch(batch, sent_handler);
+		});
+	});
+}
+
 template<class sender_impl>
 sender<sender_impl>::sender(socket_wrapper &sw)
 	: sender_impl(sw)
@@ -70,31 +172,66 @@ sender<sender_impl>::sender(socket_wrapper &sw)
 
 template<class sender_impl>
 void sender<sender_impl>::send(const frame_data &f, std::promise<void> &pr)
+{
+	send_frame(f, [&pr] (bool) { pr.set_value(); });
+}
+
+template<class sender_impl>
+void sender<sender_impl>::send_frame(const frame_data &f, std::function<void(bool sent)> completion)
 {
 	if (!sender_impl::sw.socket.is_open())
-		return;
+		return completion(false);
+
+	current_chunk.reset();
+	current_chunk.completion=completion;
+	frame_in_progress=true;
 
-	remote_mode_header rmh;
+	// outlives this call, the send may complete asynchronously
+	remote_mode_header &rmh=current_chunk.rmh;
 
 	rmh.width=f.width;
 	rmh.height=f.height;
 	rmh.bpp=f.bpp;
 	rmh.pitch=f.pitch;
 	rmh.aspect_ratio=f.aspect_ratio;
+	rmh.layout=layout;
+	rmh.fec_group_size=std::min<std::uint32_t>(std::max(fec_group_size, 0), max_fec_group_size);
 	rmh.seq_id=++seq_id;
 
 	++frame_id;
 
-	current_chunk.reset();
+	std::tie(current_chunk.w_div, current_chunk.h_div)=get_frame_divisions(rmh.width, rmh.height, rmh.bpp, 1400, layout);
+
+	if (delta)
+		find_changed_chunks(f);
+
+	auto total_chunks=current_chunk.w_div*current_chunk.h_div;
+
+	if (retransmit_frames>0)
+	{
+		begin_history(total_chunks);
+		listen_for_nacks();
+	}
+	auto chunks=current_chunk.changed.empty() ? total_chunks : current_chunk.changed_count;
+	auto payload_bytes=std::size_t(calc_pitch(f.width, f.bpp))*f.height*chunks/total_chunks;
+	auto frame_bytes=sizeof(rmh)+chunks*sizeof(remote_chunk_header)+payload_bytes;
+
+	// roughly one average chunk more per group
+	if (rmh.fec_group_size>0)
+		frame_bytes+=(frame_bytes/chunks+sizeof(remote_parity_header))*((chunks+rmh.fec_group_size-1)/rmh.fec_group_size);
 
-	std::tie(current_chunk.w_div, current_chunk.h_div)=get_frame_divisions(rmh.width, rmh.height, rmh.bpp);
+	sender_impl::begin_frame(frame_bytes);
 
-	sender_impl::send([this, &f, &pr] (const boost::system::error_code &error, std::size_t bytes_transferred)
+	sender_impl::send([this, &f] (const boost::system::error_code &error, std::size_t bytes_transferred)
 	{
+		// the pacer's wait was cancelled, the sender is going away
+		if (error==boost::asio::error::operation_aborted)
+			return;
+
 		if (error)
 			std::cerr << "send failed: " << error.message() << std::endl;
 
-		send_next_chunk(f, pr);
+		send_next_chunk(f);
 	}, rmh);
 }
 
@@ -105,513 +242,2577 @@ void sender<sender_impl>::send(const frame_data_managed &f, std::promise<void> &
 }
 
 template<class sender_impl>
-void sender<sender_impl>::send_next_chunk(const frame_data &f, std::promise<void> &pr)
+void sender<sender_impl>::send(std::shared_ptr<const frame_data> f, std::promise<void> &pr)
 {
-	int &x=current_chunk.x;
-	int &y=current_chunk.y;
-	int &w_div=current_chunk.w_div;
-	int &h_div=current_chunk.h_div;
-	auto &chunk_id=current_chunk.chunk_id;
-	int top;
-	int left;
-	int bottom;
-	int right;
+	send(*f, pr);
 
-	if (x>=w_div)
-	{
-		x=0;
-		++y;
-	}
+	// send() resets the chunk progress, so this has to come after
+	current_chunk.keep_alive=f;
+}
 
-	if (y>=h_div || current_chunk.abort)
-	{
-		pr.set_value();
+template<class sender_impl>
+std::future<bool> sender<sender_impl>::submit(std::shared_ptr<const frame_data> f)
+{
+	std::unique_lock<std::mutex> l(queue_mutex);
 
-		return;
+	++queue_stats.submitted;
+	pending_frames.push_back({ f, {} });
+
+	auto sent=pending_frames.back().sent.get_future();
+
+	// latest frame wins, stale frames are dropped rather than queued up as latency
+	while (pending_frames.size()>std::size_t(std::max(1, max_pending_frames)))
+	{
+		pending_frames.front().sent.set_value(false);
+		pending_frames.pop_front();
+		++queue_stats.dropped;
 	}
 
-	std::tie(top, left, bottom, right)=get_chunk(f.width, f.height, w_div, h_div, y, x);
+	if (queue_sending)
+		return sent;
 
-	++x;
+	queue_sending=true;
+	l.unlock();
+
+	sender_impl::sw.service.post([this] { send_pending(); });
 
-	send_chunk(f, frame_id, ++chunk_id, w_div*h_div, top, left, bottom, right, [this, &f, &pr] (const boost::system::error_code &error, std::size_t bytes_transferred) { send_next_chunk(f, pr); });
+	return sent;
 }
 
 template<class sender_impl>
-template<class handler_type>
-void sender<sender_impl>::send_chunk(const frame_data &f, int frame_id, int chunk_id, int total_chunks, int top, int left, int bottom, int right, handler_type sent_handler)
+void sender<sender_impl>::send_pending()
 {
-	frame_data_managed &chunk=current_chunk.buffer;
-	remote_chunk_header &rch=current_chunk.rch;
+	std::shared_ptr<const frame_data> f;
+	std::shared_ptr<std::promise<bool>> sent;
 
-	rch.x=left;
-	rch.y=top;
-	rch.width=right-left;
-	rch.bpp=f.bpp;
-	rch.pitch=(rch.width*f.bpp+7)/8;
-	rch.height=bottom-top;
-	rch.chunk_id=chunk_id;
-	rch.frame_chunks=total_chunks;
-	rch.frame_id=frame_id;
-	rch.seq_id=++seq_id;
+	{
+		std::unique_lock<std::mutex> l(queue_mutex);
 
-	chunk.resize(rch.width, rch.height, rch.pitch, rch.bpp);
+		if (pending_frames.empty())
+		{
+			queue_sending=false;
 
-	for (std::uint32_t y=0; y<rch.height; ++y)
-	{
-		std::copy(f.pixel<std::uint8_t>(left, top+y), f.pixel<std::uint8_t>(right, top+y), chunk.pixel<std::uint8_t>(0, y));
+			return;
+		}
+
+		if (!sender_impl::sw.socket.is_open())
+		{
+			for (auto &pending : pending_frames)
+				pending.sent.set_value(false);
+
+			queue_stats.dropped+=pending_frames.size();
+			pending_frames.clear();
+			queue_sending=false;
+
+			return;
+		}
+
+		f=std::move(pending_frames.front().frame);
+		sent=std::make_shared<std::promise<bool>>(std::move(pending_frames.front().sent));
+		pending_frames.pop_front();
 	}
 
-	sender_impl::send(sent_handler, rch, chunk.buffer());
-}
+	send_frame(*f, [this, sent] (bool frame_sent)
+	{
+		{
+			std::unique_lock<std::mutex> l(queue_mutex);
 
-template<class sender_impl>
-void sender<sender_impl>::set_remote_endpoint(const std::string &remote_endpoint_str)
-{
-	set_remote_endpoint(socket_wrapper::string_to_endpoint(remote_endpoint_str));
+			if (frame_sent)
+				++queue_stats.sent;
+			else
+				++queue_stats.dropped;
+		}
+
+		sent->set_value(frame_sent);
+		send_pending();
+	});
+
+	current_chunk.keep_alive=f;
 }
 
 template<class sender_impl>
-void sender<sender_impl>::set_remote_endpoint(const boost::asio::ip::udp::endpoint &endpoint)
+typename sender<sender_impl>::queue_statistics sender<sender_impl>::get_queue_stats()
 {
-	sender_impl::remote_endpoint=endpoint;
+	std::unique_lock<std::mutex> l(queue_mutex);
+
+	return queue_stats;
 }
 
 template<class sender_impl>
-void sender<sender_impl>::restart()
+void sender<sender_impl>::frame_sent()
 {
-	current_chunk.x=0;
-	current_chunk.y=0;
-	current_chunk.chunk_id=0;
+	auto completion=std::move(current_chunk.completion);
+
+	current_chunk.keep_alive.reset();
+	current_chunk.completion=nullptr;
+	frame_in_progress=false;
+
+	// NACKs for the frame's tail come in after it's done
+	if (!retransmit_queue.empty() && !retransmitting)
+		send_retransmits();
+
+	if (completion)
+		completion(true);
 }
 
 template<class sender_impl>
-void sender<sender_impl>::chunk_progress::reset()
+void sender<sender_impl>::find_changed_chunks(const frame_data &f)
 {
-	rch=remote_chunk_header();
-	x=0;
-	y=0;
-	w_div=1;
-	h_div=1;
-	chunk_id=~0;
-	abort=false;
-}
+	auto &changed=current_chunk.changed;
+	auto w_div=current_chunk.w_div;
+	auto h_div=current_chunk.h_div;
+	bool refresh=
+		!previous_frame ||
+		previous_frame.width!=f.width ||
+		previous_frame.height!=f.height ||
+		previous_frame.pitch!=f.pitch ||
+		previous_frame.bpp!=f.bpp ||
+		++frames_since_refresh>=refresh_interval;
+
+	if (refresh)
+	{
+		previous_frame.copy(f);
+		frames_since_refresh=0;
 
-template
-struct netvid::sender<unlimited_sender>;
+		return;
+	}
 
-template
-struct netvid::sender<rate_limited_sender>;
+	changed.assign(w_div*h_div, false);
+	current_chunk.changed_count=0;
 
-receiver::receiver(socket_wrapper &sw)
-	: sw(sw)
-{
-	recv_buffer.resize(max_pkt_size);
-}
+	for (int row=0; row<h_div; ++row)
+	{
+		for (int col=0; col<w_div; ++col)
+		{
+			int top;
+			int left;
+			int bottom;
+			int right;
 
-receiver::~receiver()
-{
-}
+			std::tie(top, left, bottom, right)=get_chunk(f.width, f.height, w_div, h_div, row, col);
 
-void receiver::start()
-{
-	boost::asio::socket_base::receive_buffer_size option(1024*1024);
+			bool chunk_changed=false;
 
-	sw.socket.set_option(option);
-	sw.socket.get_option(option);
+			for (int y=top; y<bottom; ++y)
+			{
+				auto src_begin=f.pixel<std::uint8_t>(left, y);
+				auto src_end=f.pixel<std::uint8_t>(right, y);
+				auto dst=previous_frame.pixel<std::uint8_t>(left, y);
 
-	std::cerr << "Receive buffer size: " << option.value() << std::endl;
-	std::cerr << "Started, listening on " << boost::lexical_cast<std::string>(sw.socket.local_endpoint()) << std::endl;
+				if (std::equal(src_begin, src_end, dst))
+					continue;
 
-	recv_next_packet();
-}
+				chunk_changed=true;
+				std::copy(src_begin, src_end, dst);
+			}
 
-void receiver::recv_next_packet()
-{
-	sw.socket.async_receive_from(boost::asio::buffer(recv_buffer), threaded_endpoint, [this] (const boost::system::error_code &error, std::size_t bytes_received)
-	{ recv_handler(error, bytes_received); });
-}
+			if (!chunk_changed)
+				continue;
 
-void receiver::recv_handler(const boost::system::error_code &error, std::size_t bytes_transferred)
-{
-	if (error && error != boost::asio::error::message_size)
-	{
-		std::cerr << "recv failed: " << error.message() << std::endl;
-		//throw boost::system::system_error(error);
+			changed[row*w_div+col]=true;
+			++current_chunk.changed_count;
+		}
 	}
-	else
-		internal_packet_handler(recv_buffer.data(), recv_buffer.data()+bytes_transferred, threaded_endpoint);
 
-	recv_next_packet();
+	// always send something, so receivers still see the frame
+	if (current_chunk.changed_count==0)
+	{
+		changed[0]=true;
+		current_chunk.changed_count=1;
+	}
 }
 
-void receiver::packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+template<class sender_impl>
+bool sender<sender_impl>::next_chunk(const frame_data &f, int &top, int &left, int &bottom, int &right, std::uint32_t &chunk_id)
 {
-}
+	int &x=current_chunk.x;
+	int &y=current_chunk.y;
+	const auto &changed=current_chunk.changed;
 
-void receiver::internal_packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
-{
-	packet_handler(data_begin, data_end, remote_endpoint);
+	for (;; ++x)
+	{
+		if (x>=current_chunk.w_div)
+		{
+			x=0;
+			++y;
+		}
 
-	if (on_live_packet)
-		on_live_packet(data_begin, data_end, threaded_endpoint);
-}
+		if (y>=current_chunk.h_div || current_chunk.abort)
+			return false;
 
-batched_receiver::batched_receiver(socket_wrapper &sw)
-	: receiver(sw)
-{
+		chunk_id=y*current_chunk.w_div+x;
 
-}
+		if (changed.empty() || changed[chunk_id])
+			break;
+	}
 
-batched_receiver::~batched_receiver()
-{
+	std::tie(top, left, bottom, right)=get_chunk(f.width, f.height, current_chunk.w_div, current_chunk.h_div, y, x);
 
-}
+	++x;
 
+	return true;
+}
 
-void batched_receiver::packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+template<class sender_impl>
+void sender<sender_impl>::send_next_chunk(const frame_data &f)
 {
-	int start_offset=threaded_packets.internal_buffer.size();
-	std::size_t bytes_transferred=data_end-data_begin;
+	if (batch_chunks!=1)
+		return send_next_batch(f);
 
-	threaded_packets.internal_buffer.resize(start_offset+bytes_transferred);
-	std::copy(data_begin, data_end, &threaded_packets.internal_buffer[start_offset]);
-	threaded_packets.packets.push_back({ start_offset, (int)threaded_packets.internal_buffer.size(), remote_endpoint });
-}
+	std::size_t retransmit_size;
 
-std::future<void> batched_receiver::flip_buffer_packets(std::promise<void> &promise)
-{
-	auto future=promise.get_future();
-	auto handler=[this, &promise]()
+	// requested chunks go first, their frame's deadline is closer
+	if (auto retransmit=next_retransmit(retransmit_size))
 	{
-		std::swap(buffered_packets, threaded_packets);
-		threaded_packets.clear();
-		
-		if (on_flip_packet_buffer)
-			on_flip_packet_buffer();
-		
-		promise.set_value();
-	};
+		return sender_impl::send([this, &f] (const boost::system::error_code &error, std::size_t bytes_transferred)
+		{
+			if (error!=boost::asio::error::operation_aborted)
+				send_next_chunk(f);
+		}, std::vector<boost::asio::const_buffer>({ boost::asio::buffer(retransmit, retransmit_size) }));
+	}
 
-	sw.socket.get_io_service().post(handler);
+	int top;
+	int left;
+	int bottom;
+	int right;
 
-	return future;
-}
+	if (!next_chunk(f, top, left, bottom, right, current_chunk.chunk_id))
+		return frame_sent();
 
-void batched_receiver::process_packets()
-{
-	std::promise<void> promise;
+	prepare_chunk(f, frame_id, current_chunk.chunk_id, current_chunk.w_div*current_chunk.h_div, top, left, bottom, right, current_chunk);
+	record_chunk(current_chunk.chunk_id, current_chunk.packet);
 
-	flip_buffer_packets(promise).get();
+	bool group_complete=add_parity(current_chunk.chunk_id, current_chunk.packet);
 
-	for (const auto &pkt : buffered_packets.packets)
+	sender_impl::send([this, &f, group_complete] (const boost::system::error_code &error, std::size_t bytes_transferred)
 	{
-		auto data_begin=buffered_packets.internal_buffer.data()+pkt.begin;
-		auto data_end=buffered_packets.internal_buffer.data()+pkt.end;
+		if (error==boost::asio::error::operation_aborted)
+			return;
 
-		on_packet(data_begin, data_end, pkt.remote_endpoint);
-	}
+		if (!group_complete)
+			return send_next_chunk(f);
 
-	if (on_batch_complete)
-		on_batch_complete();
+		auto &parity=current_chunk.parity;
+
+		parity.header.seq_id=++seq_id;
+		sender_impl::send([this, &f] (const boost::system::error_code &error, std::size_t bytes_transferred)
+		{
+			if (error!=boost::asio::error::operation_aborted)
+				send_next_chunk(f);
+		}, parity.header, boost::asio::buffer(parity.payload));
+	}, current_chunk.packet);
 }
 
-bool chunk_validator::process(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+template<class sender_impl>
+void sender<sender_impl>::send_next_batch(const frame_data &f)
 {
-	auto &rch=*reinterpret_cast<const remote_chunk_header *>(data_begin);
+	auto total_chunks=current_chunk.w_div*current_chunk.h_div;
+	std::size_t window=batch_chunks>0 ? batch_chunks : total_chunks;
+	auto &batch=current_chunk.batch;
+	auto &slots=current_chunk.batch_slots;
+	auto &parity_slots=current_chunk.batch_parity;
+	std::size_t parity_count=0;
 
-	if (rch.pkt_id!=remote_chunk_header().pkt_id)
-		return false;
+	// slots are sized up front, the batch refers to their headers and buffers
+	if (slots.size()<window)
+		slots.resize(window);
 
-	auto now=std::chrono::steady_clock::now();
+	if (current_chunk.rmh.fec_group_size>0 && parity_slots.size()<window)
+		parity_slots.resize(window);
+
+	batch.clear();
+
+	int top;
+	int left;
+	int bottom;
+	int right;
 
-	if (!frame_id ||
-		frame_id_assign_time+std::chrono::seconds(3)<now ||
-		(rch.frame_id-*frame_id>0 && rch.frame_id-*frame_id<60))
+	for (std::size_t i=0; i<window && next_chunk(f, top, left, bottom, right, current_chunk.chunk_id); ++i)
 	{
-		if (frame_id && frame_completed)
-			frame_completed(*frame_id);
+		auto &slot=slots[i];
 
-		if (frame_id && rch.frame_id>*frame_id+1)
-		{
-			std::cerr << "Missed frame(s) " << *frame_id+1;
+		prepare_chunk(f, frame_id, current_chunk.chunk_id, total_chunks, top, left, bottom, right, slot);
+		record_chunk(current_chunk.chunk_id, slot.packet);
+		batch.add(slot.packet);
 
-			if (rch.frame_id>*frame_id+2)
-				std::cerr << "-" << rch.frame_id-1;
+		if (!add_parity(current_chunk.chunk_id, slot.packet))
+			continue;
 
-			std::cerr << std::endl;
-		}
+		// the encoder moves on to the next group, the completed one stays put until the batch is out
+		auto &parity=parity_slots[parity_count++];
 
-		frame_id=rch.frame_id;
-		frame_id_assign_time=now;
-		chunks_received.clear();
+		std::swap(parity, current_chunk.parity);
+		current_chunk.parity.reset(frame_id, 0);
+		parity.header.seq_id=++seq_id;
+		batch.add(parity.packet());
 	}
 
-	if (frame_id!=rch.frame_id)
-		return false;
-
-	if (chunks_received.size()!=rch.frame_chunks)
-		chunks_received.assign(rch.frame_chunks, false);
+	std::size_t retransmit_size;
 
-	chunks_received[rch.chunk_id]=true;
+	// requested chunks ride along, after the chunks are recorded as the history may move while growing
+	for (std::size_t i=0; i<window; ++i)
+	{
+		auto retransmit=next_retransmit(retransmit_size);
 
-	if (on_chunk)
-		on_chunk(rch, data_begin+sizeof(rch), data_end-(data_begin+sizeof(rch)));
+		if (!retransmit)
+			break;
 
-	bool rcvd_full_frame=std::find(chunks_received.begin(), chunks_received.end(), false)==chunks_received.end();
+		batch.add(std::array<boost::asio::const_buffer, 1>({ { boost::asio::buffer(retransmit, retransmit_size) } }));
+	}
 
-	if (!rcvd_full_frame)
-		return true;
+	if (batch.packets.empty())
+		return frame_sent();
 
-	if (frame_completed)
-		frame_completed(*frame_id);
+	sender_impl::send_batch(batch, [this, &f] (const boost::system::error_code &error, std::size_t bytes_transferred)
+	{
+		if (error==boost::asio::error::operation_aborted)
+			return;
 
-	frame_id=boost::none;
-	chunks_received.clear();
+		if (error)
+			std::cerr << "send failed: " << error.message() << std::endl;
+		else if (current_chunk.batch.failed>0)
+			std::cerr << "send failed: " << current_chunk.batch.failure.message() << ", " << current_chunk.batch.failed << " datagrams skipped" << std::endl;
 
-	return true;
+		send_next_batch(f);
+	});
 }
 
-bool chunk_validator::complete() const
+// xors the chunk into its group's parity, true once the group is complete and its parity ready to send
+template<class sender_impl>
+bool sender<sender_impl>::add_parity(std::uint32_t chunk_id, const std::vector<boost::asio::const_buffer> &packet)
 {
-	return std::find(chunks_received.begin(), chunks_received.end(), false)==chunks_received.end();
-}
+	std::uint32_t group_size=current_chunk.rmh.fec_group_size;
 
-void chunk_validator::trace_missing_chunks()
-{
-	if (complete())
-		return;
+	if (group_size==0)
+		return false;
 
-	std::cerr << "Missing chunks in frame " << frame_id << ": ";
+	auto &parity=current_chunk.parity;
+	auto first_chunk_id=chunk_id-chunk_id%group_size;
 
-	bool first=true;
-	int missing=0;
-	auto begin=chunks_received.begin();
+	if (parity.empty() || parity.header.frame_id!=frame_id || parity.header.first_chunk_id!=first_chunk_id)
+		parity.reset(frame_id, first_chunk_id);
 
-	for (auto i=begin; i<chunks_received.end();)
+	parity.add(chunk_id, packet);
+
+	std::uint32_t total_chunks=current_chunk.w_div*current_chunk.h_div;
+	auto group_end=std::min(first_chunk_id+group_size, total_chunks);
+	const auto &changed=current_chunk.changed;
+
+	// delta frames may skip the rest of the group
+	for (auto i=chunk_id+1; i<group_end; ++i)
 	{
-		if (!*i)
-		{
-			auto j=std::find(std::next(i), chunks_received.end(), true);
-			auto dist=std::distance(i, j);
+		if (changed.empty() || changed[i])
+			return false;
+	}
 
-			missing+=dist;
+	return true;
+}
 
-			if (!first)
-				std::cerr << ", ";
-			else
-				first=false;
+template<class sender_impl>
+void sender<sender_impl>::begin_history(std::uint32_t total_chunks)
+{
+	sent_frame entry;
 
-			std::cerr << std::distance(begin, i);
+	// recycles the oldest frame's buffer
+	while (history.size()>=std::size_t(retransmit_frames))
+	{
+		entry=std::move(history.front());
+		history.pop_front();
+	}
 
-			if (dist>1)
-				std::cerr << "-" << std::distance(begin, std::prev(j));
+	entry.frame_id=frame_id;
+	entry.data.clear();
+	entry.chunks.assign(total_chunks, { 0, 0 });
+	entry.queued.assign(total_chunks, false);
+	history.push_back(std::move(entry));
+}
 
-			i=j;
+template<class sender_impl>
+void sender<sender_impl>::record_chunk(std::uint32_t chunk_id, const std::vector<boost::asio::const_buffer> &packet)
+{
+	if (history.empty() || history.back().frame_id!=frame_id)
+		return;
 
-			continue;
-		}
+	auto &entry=history.back();
+	auto offset=entry.data.size();
 
-		++i;
+	for (const auto &i : packet)
+	{
+		auto data=boost::asio::buffer_cast<const std::uint8_t *>(i);
+
+		entry.data.insert(entry.data.end(), data, data+boost::asio::buffer_size(i));
 	}
 
-	std::cerr << " (" << missing << ")";
-	std::cerr << std::endl;
+	entry.chunks[chunk_id]={ offset, entry.data.size()-offset };
 }
 
-frame_receiver::frame_receiver(socket_wrapper &sw)
-	: batched_receiver(sw)
+template<class sender_impl>
+typename sender<sender_impl>::sent_frame *sender<sender_impl>::find_history(std::uint32_t requested_frame_id)
 {
-	on_flip_packet_buffer=[this]
-	{
-		std::unique_lock<std::mutex> l(m);
+	auto entry=std::find_if(history.begin(), history.end(), [requested_frame_id] (const sent_frame &i) { return i.frame_id==requested_frame_id; });
 
-		if (!frame_pending_processing)
-			return;
-		
-		frame_pending_processing=false;
-	};
+	return entry!=history.end() ? &*entry : nullptr;
+}
 
-	processed_chunk_validator.frame_completed=[this] (auto)
+// the next requested chunk still in the history, nullptr if there's none
+template<class sender_impl>
+const std::uint8_t *sender<sender_impl>::next_retransmit(std::size_t &size)
+{
+	while (!retransmit_queue.empty())
 	{
-		processed_chunk_validator.trace_missing_chunks();
-
-		frame_pending=false;
-		this->flip_buffers();
-	};
+		std::uint32_t requested_frame_id;
+		std::uint32_t chunk_id;
 
-	processed_chunk_validator.on_chunk=[this] (const remote_chunk_header &header, const std::uint8_t *data, int length)
-	{
-		frame_pending=true;
-		on_chunk(header, data, length);
-	};
+		std::tie(requested_frame_id, chunk_id)=retransmit_queue.front();
+		retransmit_queue.pop_front();
 
-	on_packet=[this] (const std::uint8_t *data_begin, const std::uint8_t *data_end, const udp::endpoint &remote_endpoint)
-	{
-		auto &rh=*reinterpret_cast<const remote_header *>(data_begin);
+		auto entry=find_history(requested_frame_id);
 
-		/*if (current_seq_id && rh.seq_id-*current_seq_id>1)
+		// recycled since it was queued
+		if (!entry)
 		{
-		std::cout << "missed packets " << *current_seq_id+1 << "-" << rh.seq_id-1 << std::endl;
-		}*/
+			++retransmit_stats.expired;
 
-		current_seq_id=rh.seq_id;
+			continue;
+		}
 
-		//expire(last_seq_id);
-		expire(last_mode_set);
-		//expire(last_frame_id);
+		entry->queued[chunk_id]=false;
 
-		switch (rh.pkt_id)
-		{
-		case 0:
-			if (check_new(last_mode_set, rh.seq_id))
-			{
-				auto &rmh=*reinterpret_cast<const remote_mode_header *>(&rh);
+		auto data=entry->data.data()+entry->chunks[chunk_id].first;
 
-				if (on_mode_set)
-					on_mode_set(rmh);
-			}
-			break;
-		}
+		size=entry->chunks[chunk_id].second;
 
-		processed_chunk_validator.process(data_begin, data_end, remote_endpoint);
-	};
+		// a fresh seq_id, so the copy doesn't look like a stale packet
+		reinterpret_cast<remote_header *>(data)->seq_id=++seq_id;
+		++retransmit_stats.chunks;
 
-	on_batch_complete=[this] ()
+		return data;
+	}
+
+	return nullptr;
+}
+
+template<class sender_impl>
+void sender<sender_impl>::listen_for_nacks()
+{
+	if (listening)
+		return;
+
+	listening=true;
+	nack_buffer.resize(64*1024);
+
+	sender_impl::sw.socket.async_receive_from(boost::asio::buffer(nack_buffer), nack_endpoint, [this] (const boost::system::error_code &error, std::size_t bytes_received)
 	{
-		if (buffers_flipped)
+		if (error==boost::asio::error::operation_aborted || !sender_impl::sw.socket.is_open())
 		{
-			buffers_flipped=false;
+			listening=false;
 
-			if (on_frame)
-				on_frame();
+			return;
 		}
-	};
 
-	on_mode_set=[this] (const remote_mode_header &rmh)
-	{
-		back_buffer.resize(rmh.width, rmh.height, rmh.pitch, rmh.bpp);
-	};
+		if (error)
+			std::cerr << "recv failed: " << error.message() << std::endl;
+		else
+			nack_handler(bytes_received);
 
-	on_chunk=[this] (const remote_chunk_header &header, const std::uint8_t *data, int length)
-	{
-		auto w=std::max<int>(back_buffer.width, header.width+header.x);
+		listening=false;
+		listen_for_nacks();
+	});
+}
 
-		back_buffer.resize(
-			w,
-			std::max<int>(back_buffer.height, header.height+header.y),
-			std::max<int>(back_buffer.pitch, (w*header.bpp+7)/8),
-			header.bpp);
+template<class sender_impl>
+void sender<sender_impl>::nack_handler(std::size_t bytes_received)
+{
+	if (bytes_received<sizeof(remote_nack_header))
+		return;
 
-		for (std::uint32_t y=0; y<header.height; ++y)
-		{
-			std::copy(data+header.pitch*y, data+header.pitch*y+(header.width*header.bpp+7)/8, back_buffer.pixel<std::uint8_t>(header.x, header.y+y));
-		}
-	};
+	auto &nack=*reinterpret_cast<const remote_nack_header *>(nack_buffer.data());
 
-	live_chunk_validator.frame_completed=[this] (auto)
+	if (pkt_type(nack.pkt_id)!=remote_nack_header().pkt_id || nack.chunk_count>(bytes_received-sizeof(nack))/sizeof(std::uint32_t))
+		return;
+
+	auto chunk_ids=reinterpret_cast<const std::uint32_t *>(nack_buffer.data()+sizeof(nack));
+	auto entry=find_history(nack.frame_id);
+
+	++retransmit_stats.nacks;
+
+	for (std::uint32_t i=0; i<nack.chunk_count; ++i)
 	{
+		auto chunk_id=chunk_ids[i];
+
+		if (!entry || chunk_id>=entry->chunks.size() || entry->chunks[chunk_id].second==0)
 		{
-			std::unique_lock<std::mutex> l(m);
+			++retransmit_stats.expired;
 
-			frame_pending_processing=true;
+			continue;
 		}
 
-		cv.notify_one();
-	};
+		// repeated requests for a chunk that's still queued
+		if (entry->queued[chunk_id] || retransmit_queue.size()>=max_retransmit_queue)
+			continue;
+
+		entry->queued[chunk_id]=true;
+		retransmit_queue.emplace_back(nack.frame_id, chunk_id);
+	}
+
+	// otherwise served in between the frame's chunks
+	if (!frame_in_progress && !retransmitting)
+		send_retransmits();
 }
 
-void frame_receiver::packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+// serves requests while no frame is being sent, from a copy as the next frame recycles the history
+template<class sender_impl>
+void sender<sender_impl>::send_retransmits()
 {
-	batched_receiver::packet_handler(data_begin, data_end, remote_endpoint);
+	std::size_t size;
+	const std::uint8_t *data=nullptr;
 
-	live_chunk_validator.process(data_begin, data_end, remote_endpoint);
-/*
-	auto &rh=*reinterpret_cast<const remote_header *>(data_begin);
-	bool should_process_chunk=live_chunk_validator.process(data_begin, data_end, remote_endpoint);
+	if (frame_in_progress || !(data=next_retransmit(size)))
+	{
+		retransmitting=false;
 
-	if (rh.pkt_id==remote_chunk_header().pkt_id && !should_process_chunk)
-		return;*/
-}
+		return;
+	}
 
-void frame_receiver::flip_buffers()
-{
-	std::unique_lock<std::mutex> lock(front_buffer_mutex);
+	retransmitting=true;
+	retransmit_packet.assign(data, data+size);
 
-	std::swap(front_buffer, back_buffer);
-	back_buffer.resize(front_buffer.width, front_buffer.height, front_buffer.pitch, front_buffer.bpp);
-	std::copy(front_buffer.data, front_buffer.end(), back_buffer.data);
-	buffers_flipped=true;
+	sender_impl::send([this] (const boost::system::error_code &error, std::size_t bytes_transferred)
+	{
+		if (error!=boost::asio::error::operation_aborted)
+			send_retransmits();
+	}, std::vector<boost::asio::const_buffer>({ boost::asio::buffer(retransmit_packet) }));
 }
 
-void frame_receiver::expire(boost::optional<std::uint32_t> &seq_id)
+template<class sender_impl>
+void sender<sender_impl>::prepare_chunk(const frame_data &f, int frame_id, int chunk_id, int total_chunks, int top, int left, int bottom, int right, chunk_slot &slot)
 {
-	if (!seq_id)
+	remote_chunk_header &rch=slot.rch;
+	frame_data_managed &chunk=slot.buffer;
+	std::vector<boost::asio::const_buffer> &packet=slot.packet;
+
+	rch.x=left;
+	rch.y=top;
+	rch.width=right-left;
+	rch.bpp=f.bpp;
+	rch.pitch=(rch.width*f.bpp+7)/8;
+	rch.height=bottom-top;
+	rch.pkt_id=remote_chunk_header().pkt_id;
+	rch.chunk_id=chunk_id;
+	rch.frame_chunks=total_chunks;
+	rch.frame_id=frame_id;
+
+	if (!current_chunk.changed.empty())
+	{
+		rch.pkt_id|=pkt_flag_delta;
+		rch.frame_chunks=current_chunk.changed_count;
+	}
+
+	rch.seq_id=++seq_id;
+
+	packet.clear();
+	packet.push_back(boost::asio::buffer(&rch, sizeof(rch)));
+
+	if (compress && compress_chunk(f, top, left, slot))
 		return;
 
-	if (!current_seq_id || (*current_seq_id-*seq_id)>=seq_diff_out_of_range)
-		seq_id=boost::none;
-}
+	// full-width strips of an unpadded frame (or single rows) are one contiguous range
+	bool contiguous=f.bpp%8==0 && (rch.height==1 || (left==0 && int(rch.pitch)==f.pitch));
 
-bool frame_receiver::check_new(boost::optional<std::uint32_t> &stored_seq_id, std::uint32_t new_seq_id)
-{
-	if (!stored_seq_id || ((new_seq_id-*stored_seq_id)<seq_diff_out_of_range && (new_seq_id-*stored_seq_id)>0))
+	// rows only line up with the chunk pitch for whole-byte pixels
+	if (zero_copy && f.bpp%8==0)
 	{
-		stored_seq_id=new_seq_id;
+		if (contiguous)
+		{
+			packet.push_back(boost::asio::buffer(f.pixel<std::uint8_t>(left, top), rch.pitch*rch.height));
 
-		return true;
+			return;
+		}
+
+		for (std::uint32_t y=0; y<rch.height; ++y)
+			packet.push_back(boost::asio::buffer(f.pixel<std::uint8_t>(left, top+y), rch.pitch));
+
+		return;
 	}
 
-	return false;
+	chunk.resize(rch.width, rch.height, rch.pitch, rch.bpp);
+
+	if (contiguous)
+		std::copy(f.pixel<std::uint8_t>(left, top), f.pixel<std::uint8_t>(left, top)+chunk.bytes(), chunk.data);
+	else
+	{
+		for (std::uint32_t y=0; y<rch.height; ++y)
+		{
+			std::copy(f.pixel<std::uint8_t>(left, top+y), f.pixel<std::uint8_t>(right, top+y), chunk.pixel<std::uint8_t>(0, y));
+		}
+	}
+
+	packet.push_back(chunk.buffer());
 }
 
-std::unique_lock<std::mutex> frame_receiver::lock_front_buffer()
+template<class sender_impl>
+bool sender<sender_impl>::compress_chunk(const frame_data &f, int top, int left, chunk_slot &slot)
 {
-	return std::unique_lock<std::mutex>(front_buffer_mutex);
+	remote_chunk_header &rch=slot.rch;
+	std::vector<std::uint8_t> &compressed=slot.compressed;
+
+	if (f.bpp%8!=0)
+		return false;
+
+	std::size_t raw_bytes=rch.pitch*rch.height;
+
+	// has to save a little at least, or decoding isn't worth it
+	compressed.resize(raw_bytes-raw_bytes/16);
+
+	auto size=rle_encode(f.pixel<std::uint8_t>(left, top), f.pitch, rch.pitch, rch.height, codec_unit_size(f.bpp, rch.pitch), compressed.data(), compressed.size());
+
+	if (size==0)
+		return false;
+
+	rch.pkt_id|=pkt_flag_compressed;
+	slot.packet.push_back(boost::asio::buffer(compressed.data(), size));
+
+	return true;
 }
 
-boost::optional<std::uint32_t> frame_receiver::get_front_frame_id() const
+template<class sender_impl>
+void sender<sender_impl>::set_remote_endpoint(const std::string &remote_endpoint_str)
 {
-	return processed_chunk_validator.frame_id;
+	set_remote_endpoint(socket_wrapper::string_to_endpoint(remote_endpoint_str));
 }
 
-void netvid::frame_receiver::wait_for_frame()
+template<class sender_impl>
+void sender<sender_impl>::set_remote_endpoint(const boost::asio::ip::udp::endpoint &endpoint)
 {
-	std::unique_lock<std::mutex> l(m);
-
-	if (frame_pending_processing)
-		return;
-
-	// don't bother checking for spurious wake-ups, is of no consequence
-	cv.wait(l);
+	sender_impl::remote_endpoint=endpoint;
 }
 
-io_service_wrapper::io_service_wrapper()
+template<class sender_impl>
+void sender<sender_impl>::restart()
 {
-	work.emplace(io_service);
+	current_chunk.x=0;
+	current_chunk.y=0;
+	current_chunk.chunk_id=0;
 }
 
-io_service_wrapper::~io_service_wrapper()
+template<class sender_impl>
+void sender<sender_impl>::chunk_progress::reset()
 {
-	stop();
+	this->rch=remote_chunk_header();
+	rmh=remote_mode_header();
+	x=0;
+	y=0;
+	w_div=1;
+	h_div=1;
+	chunk_id=~0;
+	abort=false;
+	keep_alive.reset();
+	completion=nullptr;
+	changed.clear();
+	changed_count=0;
+	parity.reset(0, 0);
 }
 
-void io_service_wrapper::run()
+void packet_batch::clear()
 {
-	thread=std::thread([this] { io_service.run(); });
+	buffers.clear();
+	packets.clear();
+	sent=0;
+	released=std::numeric_limits<std::size_t>::max();
+	bytes=0;
+	failed=0;
+	failed_bytes=0;
+	failure=boost::system::error_code();
 }
 
-void io_service_wrapper::stop()
+std::size_t packet_batch::packet_bytes(std::size_t i) const
 {
-	work.reset();
+	std::size_t bytes=0;
 
-	if (thread.joinable())
-		thread.join();
+	for (auto j=packets[i].first; j<packets[i].first+packets[i].second; ++j)
+		bytes+=boost::asio::buffer_size(buffers[j]);
+
+	return bytes;
 }
 
-void packets::clear()
+void packet_batch::send(socket_wrapper &sw, const boost::asio::ip::udp::endpoint &remote_endpoint, boost::system::error_code &error)
 {
-	internal_buffer.clear();
-	packets.clear();
-}
+	error=boost::system::error_code();
+
+#if __linux__
+	static const std::size_t max_msgs=1024; // UIO_MAXIOV, the kernel caps a single sendmmsg at this
+	std::array<mmsghdr, max_msgs> msgs;
+	std::vector<iovec> iovecs;
+
+	while (sent<end())
+	{
+		auto count=std::min(max_msgs, end()-sent);
+
+		iovecs.resize(buffers.size());
+
+		for (std::size_t i=0; i<count; ++i)
+		{
+			const auto &pkt=packets[sent+i];
+			auto &msg=msgs[i].msg_hdr;
+
+			for (std::size_t j=pkt.first; j<pkt.first+pkt.second; ++j)
+			{
+				iovecs[j].iov_base=const_cast<void *>(boost::asio::buffer_cast<const void *>(buffers[j]));
+				iovecs[j].iov_len=boost::asio::buffer_size(buffers[j]);
+			}
+
+			msg=msghdr();
+			msg.msg_name=const_cast<sockaddr *>(remote_endpoint.data());
+			msg.msg_namelen=remote_endpoint.size();
+			msg.msg_iov=&iovecs[pkt.first];
+			msg.msg_iovlen=pkt.second;
+			msgs[i].msg_len=0;
+		}
+
+		auto result=sendmmsg(sw.socket.native_handle(), msgs.data(), count, MSG_DONTWAIT);
+
+		if (result<0)
+		{
+			if (errno==EINTR)
+				continue;
+
+			if (errno==EAGAIN || errno==EWOULDBLOCK)
+			{
+				error=boost::asio::error::would_block;
+
+				return;
+			}
 
+			// skip the offending datagram, like a failed async_send_to would
+			failure=boost::system::error_code(errno, boost::asio::error::get_system_category());
+			failed_bytes+=packet_bytes(sent);
+			++failed;
+			++sent;
+
+			continue;
+		}
+
+		sent+=result;
+	}
+#else
+	for (; sent<end(); ++sent)
+	{
+		const auto &pkt=packets[sent];
+		std::vector<boost::asio::const_buffer> packet(&buffers[pkt.first], &buffers[pkt.first]+pkt.second);
+
+		sw.socket.send_to(packet, remote_endpoint, 0, error);
+
+		if (error==boost::asio::error::would_block)
+			return;
+
+		if (error)
+		{
+			failure=error;
+			failed_bytes+=packet_bytes(sent);
+			++failed;
+			error=boost::system::error_code();
+		}
+	}
+#endif
+}
+
+void netvid::async_send_batch(socket_wrapper &sw, const boost::asio::ip::udp::endpoint &remote_endpoint, packet_batch &batch, batch_handler_type handler)
+{
+	boost::system::error_code error;
+
+	batch.send(sw, remote_endpoint, error);
+
+	if (error==boost::asio::error::would_block)
+	{
+		sw.socket.async_wait(boost::asio::socket_base::wait_write, [&sw, &remote_endpoint, &batch, handler] (const boost::system::error_code &error)
+		{
+			if (error)
+				return handler(error, 0);
+
+			async_send_batch(sw, remote_endpoint, batch, handler);
+		});
+
+		return;
+	}
+
+	// always complete asynchronously, like async_send_to, skipped datagrams are left to batch.failed
+	sw.service.post([handler, error, bytes=batch.bytes-batch.failed_bytes] { handler(error, bytes); });
+}
+
+template
+struct netvid::sender<unlimited_sender>;
+
+template
+struct netvid::sender<rate_limited_sender>;
+
+receiver::receiver(socket_wrapper &sw)
+	: sw(sw)
+{
+}
+
+receiver::~receiver()
+{
+}
+
+void receiver::start()
+{
+	boost::asio::socket_base::receive_buffer_size option(1024*1024);
+
+	sw.socket.set_option(option);
+	sw.socket.get_option(option);
+
+	std::cerr << "Receive buffer size: " << option.value() << std::endl;
+	std::cerr << "Started, listening on " << boost::lexical_cast<std::string>(sw.socket.local_endpoint()) << std::endl;
+
+#if __linux__
+	int max_batch=max_batch_size;
+	int enable=1;
+
+	batch_size=std::max(1, std::min(batch_size, max_batch));
+
+	if (kernel_timestamps && setsockopt(sw.socket.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable))<0)
+	{
+		std::cerr << "No kernel receive timestamps: " << boost::system::error_code(errno, boost::asio::error::get_system_category()).message() << std::endl;
+		kernel_timestamps=false;
+	}
+#else
+	batch_size=1;
+	kernel_timestamps=false;
+#endif
+
+	recv_buffer.resize(max_pkt_size*batch_size);
+	recv_batch.resize(batch_size);
+
+	// asio doesn't hand control messages on, stamps need recvmmsg even for single datagrams
+	if (batch_size>1 || kernel_timestamps)
+		return recv_next_batch();
+
+	recv_next_packet();
+}
+
+void receiver::recv_next_packet()
+{
+	sw.socket.async_receive_from(boost::asio::buffer(recv_buffer), threaded_endpoint, [this] (const boost::system::error_code &error, std::size_t bytes_received)
+	{ recv_handler(error, bytes_received); });
+}
+
+void receiver::recv_handler(const boost::system::error_code &error, std::size_t bytes_transferred)
+{
+	if (error && error != boost::asio::error::message_size)
+	{
+		std::cerr << "recv failed: " << error.message() << std::endl;
+		//throw boost::system::system_error(error);
+	}
+	else
+	{
+		recv_batch.resize(1);
+		recv_batch[0]={ recv_buffer.data(), recv_buffer.data()+bytes_transferred, threaded_endpoint };
+
+		internal_packets_handler(recv_batch);
+	}
+
+	recv_next_packet();
+}
+
+void receiver::recv_next_batch()
+{
+	sw.socket.async_wait(boost::asio::socket_base::wait_read, [this] (const boost::system::error_code &error)
+	{
+		// a socket that can't be waited on won't be readable either, receiving stops here
+		if (error)
+		{
+			if (error!=boost::asio::error::operation_aborted)
+				std::cerr << "recv failed: " << error.message() << ", receiving stopped" << std::endl;
+
+			return;
+		}
+
+		recv_batches();
+	});
+}
+
+void receiver::recv_batches()
+{
+#if __linux__
+	std::array<mmsghdr, max_batch_size> msgs;
+	std::array<iovec, max_batch_size> iovecs;
+	std::array<boost::asio::mutable_buffer, max_batch_size> slots;
+	std::array<std::array<std::uint8_t, CMSG_SPACE(sizeof(timespec))>, max_batch_size> controls;
+
+	// drain the socket, but yield to other handlers every few batches
+	for (int n=0; n<max_batches_per_wakeup; ++n)
+	{
+		auto count=receive_slots(batch_size, slots);
+
+		recv_batch.resize(count);
+
+		for (int i=0; i<count; ++i)
+		{
+			auto &msg=msgs[i].msg_hdr;
+			auto &endpoint=recv_batch[i].remote_endpoint;
+
+			iovecs[i].iov_base=boost::asio::buffer_cast<void *>(slots[i]);
+			iovecs[i].iov_len=boost::asio::buffer_size(slots[i]);
+
+			msg=msghdr();
+			msg.msg_name=endpoint.data();
+			msg.msg_namelen=endpoint.capacity();
+			msg.msg_iov=&iovecs[i];
+			msg.msg_iovlen=1;
+
+			if (kernel_timestamps)
+			{
+				msg.msg_control=controls[i].data();
+				msg.msg_controllen=controls[i].size();
+			}
+		}
+
+		auto result=recvmmsg(sw.socket.native_handle(), msgs.data(), count, MSG_DONTWAIT, nullptr);
+
+		if (result<0)
+		{
+			if (errno==EINTR)
+				continue;
+
+			if (errno!=EAGAIN && errno!=EWOULDBLOCK)
+				std::cerr << "recv failed: " << boost::system::error_code(errno, boost::asio::error::get_system_category()).message() << std::endl;
+
+			return recv_next_batch();
+		}
+
+		int received=0;
+
+		for (int i=0; i<result; ++i)
+		{
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			{
+				++stats.truncated;
+				continue;
+			}
+
+			auto &pkt=recv_batch[received++];
+
+			pkt.remote_endpoint=recv_batch[i].remote_endpoint;
+			pkt.remote_endpoint.resize(msgs[i].msg_hdr.msg_namelen);
+			pkt.data_begin=boost::asio::buffer_cast<const std::uint8_t *>(slots[i]);
+			pkt.data_end=pkt.data_begin+msgs[i].msg_len;
+			pkt.kernel_time=std::chrono::nanoseconds(0);
+
+			for (auto cmsg=CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg=CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+			{
+				if (cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_TIMESTAMPNS)
+				{
+					timespec ts;
+
+					std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+					pkt.kernel_time=std::chrono::seconds(ts.tv_sec)+std::chrono::nanoseconds(ts.tv_nsec);
+				}
+			}
+		}
+
+		recv_batch.resize(received);
+
+		if (received>0)
+			internal_packets_handler(recv_batch);
+
+		if (result<count)
+			return recv_next_batch();
+	}
+
+	sw.service.post([this] { recv_batches(); });
+#endif
+}
+
+void receiver::packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+{
+}
+
+void receiver::packets_handler(const std::vector<received_packet> &batch)
+{
+	for (const auto &pkt : batch)
+		packet_handler(pkt.data_begin, pkt.data_end, pkt.remote_endpoint);
+}
+
+int receiver::receive_slots(int count, std::array<boost::asio::mutable_buffer, max_batch_size> &slots)
+{
+	for (int i=0; i<count; ++i)
+		slots[i]=boost::asio::buffer(recv_buffer.data()+i*max_pkt_size, max_pkt_size);
+
+	return count;
+}
+
+void receiver::internal_packets_handler(const std::vector<received_packet> &batch)
+{
+	++stats.batches;
+	stats.packets+=batch.size();
+
+	packets_handler(batch);
+
+	for (const auto &pkt : batch)
+	{
+		if (on_live_packet)
+			on_live_packet(pkt.data_begin, pkt.data_end, pkt.remote_endpoint);
+
+		if (on_live_received_packet)
+			on_live_received_packet(pkt);
+	}
+}
+
+batched_receiver::batched_receiver(socket_wrapper &sw)
+	: receiver(sw)
+{
+
+}
+
+batched_receiver::~batched_receiver()
+{
+
+}
+
+void batched_receiver::start()
+{
+	ring_slots=std::max<std::size_t>(ring_slots, 1);
+	slot_size=std::min(std::max<std::size_t>(slot_size, sizeof(remote_chunk_header)), std::size_t(max_pkt_size));
+
+	for (auto &buffer : packet_buffers)
+		buffer.allocate(ring_slots, slot_size);
+
+	receiver::start();
+}
+
+void batched_receiver::packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+{
+	std::size_t size=data_end-data_begin;
+	auto n=filling->packets.size();
+
+	if (size>filling->slot_size())
+	{
+		++stats.truncated;
+		return;
+	}
+
+	// received in place unless it came through the receiver's own buffer, or after a packet that was truncated
+	if (n>=filling->capacity() || data_begin!=filling->slot(n))
+	{
+		if (!make_room())
+		{
+			++ring_stats.dropped;
+			return;
+		}
+
+		n=filling->packets.size();
+		std::copy(data_begin, data_end, filling->slot(n));
+	}
+
+	auto begin=int(filling->slot(n)-filling->slot(0));
+
+	filling->packets.push_back({ begin, begin+int(size), remote_endpoint });
+
+	publish_packets();
+}
+
+void batched_receiver::packets_handler(const std::vector<received_packet> &batch)
+{
+	in_batch=true;
+	receiver::packets_handler(batch);
+	in_batch=false;
+
+	publish_packets();
+}
+
+int batched_receiver::receive_slots(int count, std::array<boost::asio::mutable_buffer, max_batch_size> &slots)
+{
+	auto n=filling->packets.size();
+
+	// a full slab makes room once a datagram actually arrives
+	if (n>=filling->capacity())
+		return receiver::receive_slots(count, slots);
+
+	count=std::min<int>(count, filling->capacity()-n);
+
+	for (int i=0; i<count; ++i)
+		slots[i]=boost::asio::buffer(filling->slot(n+i), filling->slot_size());
+
+	return count;
+}
+
+bool batched_receiver::make_room()
+{
+	if (filling->packets.size()<filling->capacity())
+		return true;
+
+	switch (overflow)
+	{
+	case overflow_policy::grow:
+		filling->allocate(2*std::max<std::size_t>(filling->capacity(), max_batch_size), slot_size);
+		++ring_stats.grown;
+		return true;
+	case overflow_policy::drop_oldest:
+		ring_stats.dropped+=filling->packets.size();
+		filling->clear();
+		return filling->capacity()>0;
+	case overflow_policy::drop_newest:
+		break;
+	}
+
+	return false;
+}
+
+bool batched_receiver::packets_due() const
+{
+	return !filling->packets.empty();
+}
+
+void batched_receiver::publish_packets()
+{
+	if (in_batch || !packets_due())
+		return;
+
+	// set before looking for the buffer, so either this finds it or the consumer returning it sees the flag
+	publish_wanted=true;
+
+	auto next=returned.exchange(nullptr);
+
+	if (!next)
+		return;
+
+	publish_wanted=false;
+	published=filling;
+	filling=next;
+	++publications;
+
+	if (on_packets_published)
+		on_packets_published();
+}
+
+void batched_receiver::process_packets()
+{
+	// read first, a buffer published in between then only causes a needless wake-up
+	publications_taken=publications;
+
+	auto buffer=published.exchange(nullptr);
+
+	if (buffer)
+	{
+		for (const auto &pkt : buffer->packets)
+		{
+			auto data_begin=buffer->data(pkt);
+
+			on_packet(data_begin, data_begin+(pkt.end-pkt.begin), pkt.remote_endpoint);
+		}
+
+		buffer->clear();
+		returned=buffer;
+
+		// packets due while the consumer held both buffers wait for the io thread's next look, no more may arrive
+		if (publish_wanted)
+			sw.service.post([this] { publish_packets(); });
+
+		if (on_batch_complete)
+			on_batch_complete();
+	}
+}
+
+bool chunk_validator::process(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+{
+	if (std::size_t(data_end-data_begin)<sizeof(remote_chunk_header))
+		return false;
+
+	auto &rch=*reinterpret_cast<const remote_chunk_header *>(data_begin);
+
+	if (pkt_type(rch.pkt_id)!=remote_chunk_header().pkt_id || (rch.pkt_id & ~(pkt_type_mask | pkt_flag_delta | pkt_flag_compressed)))
+		return false;
+
+	bool delta=rch.pkt_id & pkt_flag_delta;
+
+	if (!delta && rch.chunk_id>=rch.frame_chunks)
+		return false;
+
+	auto now=std::chrono::steady_clock::now();
+
+	// late copies (retransmitted or rebuilt) of a completed frame mustn't start it over
+	if (!frame_id && completed_frame_id && rch.frame_id-*completed_frame_id-1>=std::numeric_limits<std::uint32_t>::max()/2 && now<frame_id_assign_time+std::chrono::seconds(3))
+		return false;
+
+	auto window=std::min(std::max<std::uint32_t>(reorder.window, 1), std::uint32_t(max_window));
+	bool gave_up=false;
+
+	// a stale frame, or one the new frame is too far ahead of to keep in flight, is given up with whatever arrived
+	while (frame_id && (frame_id_assign_time+std::chrono::seconds(3)<now ||
+		(rch.frame_id-*frame_id>=window && rch.frame_id-*frame_id<max_window)))
+	{
+		finish_frame();
+		gave_up=true;
+	}
+
+	if (!frame_id)
+	{
+		if (gave_up)
+			trace_missed_frames(rch.frame_id);
+
+		frame_id=rch.frame_id;
+		frame_id_assign_time=now;
+		reset_chunks();
+	}
+
+	// older than the oldest in flight, or far ahead
+	if (rch.frame_id-*frame_id>=window)
+		return false;
+
+	if (rch.frame_id!=*frame_id)
+	{
+		auto &f=pending_for(rch.frame_id, now);
+		auto count=f.chunks_count;
+
+		// mark_chunk starts the frame over, the chunks it held go with its count
+		if (f.chunks_expected!=rch.frame_chunks || f.delta_frame!=delta)
+		{
+			f.chunks.clear();
+			f.chunk_sizes.clear();
+			pending_chunks-=count;
+			count=0;
+		}
+
+		if (!mark_chunk(f.chunks_received, f.chunks_expected, f.chunks_count, f.delta_frame, rch, delta))
+			return false;
+
+		if (f.chunks_count!=count && on_chunk)
+		{
+			f.chunks.insert(f.chunks.end(), data_begin, data_end);
+			f.chunk_sizes.push_back(data_end-data_begin);
+		}
+
+		pending_chunks+=f.chunks_count-count;
+		expire(now);
+
+		return true;
+	}
+
+	if (!mark_chunk(chunks_received, chunks_expected, chunks_count, delta_frame, rch, delta))
+		return false;
+
+	if (on_chunk)
+		on_chunk(rch, data_begin+sizeof(rch), data_end-(data_begin+sizeof(rch)));
+
+	if (complete())
+		finish_frame();
+
+	return true;
+}
+
+bool chunk_validator::mark_chunk(std::vector<bool> &received, std::uint32_t &expected, std::uint32_t &count, bool &delta_frame, const remote_chunk_header &rch, bool delta)
+{
+	if (expected!=rch.frame_chunks || delta_frame!=delta)
+	{
+		// delta frames only say how many chunks to expect, not which, so their bitmap grows as chunks arrive
+		received.assign(delta ? 0 : rch.frame_chunks, false);
+		expected=rch.frame_chunks;
+		count=0;
+		delta_frame=delta;
+	}
+
+	if (rch.chunk_id>=received.size())
+	{
+		if (rch.chunk_id>=max_chunks)
+			return false;
+
+		received.resize(rch.chunk_id+1, false);
+	}
+
+	if (!received[rch.chunk_id])
+	{
+		received[rch.chunk_id]=true;
+		++count;
+	}
+
+	return true;
+}
+
+chunk_validator::pending_frame &chunk_validator::pending_for(std::uint32_t id, std::chrono::steady_clock::time_point now)
+{
+	auto i=pending.begin();
+
+	for (; i!=pending.end() && i->frame_id-*frame_id<id-*frame_id; ++i)
+		;
+
+	if (i!=pending.end() && i->frame_id==id)
+		return *i;
+
+	i=pending.emplace(i);
+	i->frame_id=id;
+	i->first_chunk_time=now;
+
+	return *i;
+}
+
+// completes (or gives up) the oldest frame, the next one in flight takes its place and on_chunk catches up on its chunks
+void chunk_validator::finish_frame()
+{
+	if (frame_completed)
+		frame_completed(*frame_id);
+
+	completed_frame_id=frame_id;
+	frame_id=boost::none;
+	reset_chunks();
+
+	if (pending.empty())
+		return;
+
+	auto next=std::move(pending.front());
+
+	pending.pop_front();
+	pending_chunks-=next.chunks_count;
+	trace_missed_frames(next.frame_id);
+
+	frame_id=next.frame_id;
+	frame_id_assign_time=next.first_chunk_time;
+	chunks_received=std::move(next.chunks_received);
+	chunks_expected=next.chunks_expected;
+	chunks_count=next.chunks_count;
+	delta_frame=next.delta_frame;
+
+	if (on_chunk)
+	{
+		auto data=next.chunks.data();
+
+		for (auto size : next.chunk_sizes)
+		{
+			on_chunk(*reinterpret_cast<const remote_chunk_header *>(data), data+sizeof(remote_chunk_header), size-sizeof(remote_chunk_header));
+			data+=size;
+		}
+	}
+
+	if (complete())
+		finish_frame();
+	else
+		expire(std::chrono::steady_clock::now());
+}
+
+// the oldest frame waits for its stragglers only so long
+void chunk_validator::expire(std::chrono::steady_clock::time_point now)
+{
+	while (frame_id && !pending.empty() && (pending_chunks>reorder.tolerance || frame_id_assign_time+reorder.deadline<now))
+		finish_frame();
+}
+
+void chunk_validator::trace_missed_frames(std::uint32_t next_frame_id) const
+{
+	if (!completed_frame_id || next_frame_id<=*completed_frame_id+1)
+		return;
+
+	std::cerr << "Missed frame(s) " << *completed_frame_id+1;
+
+	if (next_frame_id>*completed_frame_id+2)
+		std::cerr << "-" << next_frame_id-1;
+
+	std::cerr << std::endl;
+}
+
+bool chunk_validator::complete() const
+{
+	return chunks_count>=chunks_expected;
+}
+
+void chunk_validator::reset_chunks()
+{
+	chunks_received.clear();
+	chunks_expected=0;
+	chunks_count=0;
+	delta_frame=false;
+}
+
+void chunk_validator::trace_missing_chunks()
+{
+	if (complete())
+		return;
+
+	std::cerr << "Missing chunks in frame " << frame_id << ": ";
+
+	// which chunks a delta frame consisted of is unknown, only how many
+	if (delta_frame)
+	{
+		std::cerr << chunks_expected-chunks_count << " of " << chunks_expected << " (delta)" << std::endl;
+
+		return;
+	}
+
+	bool first=true;
+	int missing=0;
+	auto begin=chunks_received.begin();
+
+	for (auto i=begin; i<chunks_received.end();)
+	{
+		if (!*i)
+		{
+			auto j=std::find(std::next(i), chunks_received.end(), true);
+			auto dist=std::distance(i, j);
+
+			missing+=dist;
+
+			if (!first)
+				std::cerr << ", ";
+			else
+				first=false;
+
+			std::cerr << std::distance(begin, i);
+
+			if (dist>1)
+				std::cerr << "-" << std::distance(begin, std::prev(j));
+
+			i=j;
+
+			continue;
+		}
+
+		++i;
+	}
+
+	std::cerr << " (" << missing << ")";
+	std::cerr << std::endl;
+}
+
+// writes a chunk's pixels into its rectangle of f, false if they don't fit or don't decode, the rectangle is then left as it was
+static bool place_chunk(frame_data &f, const remote_chunk_header &header, const std::uint8_t *data, int length, std::vector<std::uint8_t> &decoded)
+{
+	if (int(header.bpp)!=f.bpp || header.x+header.width>std::uint32_t(f.width) || header.y+header.height>std::uint32_t(f.height))
+		return false;
+
+	// decoded aside, a chunk failing part way through would leave garbage in the frame
+	if (header.pkt_id & pkt_flag_compressed)
+	{
+		std::size_t row_bytes=header.width*header.bpp/8;
+
+		if (header.bpp%8!=0 || header.pitch!=row_bytes)
+			return false;
+
+		decoded.resize(row_bytes*header.height);
+
+		if (!rle_decode(data, length, decoded.data(), row_bytes, row_bytes, header.height, codec_unit_size(header.bpp, row_bytes)))
+			return false;
+
+		data=decoded.data();
+		length=int(decoded.size());
+	}
+
+	if (header.pitch<(header.width*header.bpp+7)/8 || std::size_t(length)<std::size_t(header.pitch)*header.height)
+		return false;
+
+	// full-width strips land in one contiguous range of the frame
+	if (header.x==0 && int(header.pitch)==f.pitch)
+	{
+		std::copy(data, data+header.pitch*header.height, f.pixel<std::uint8_t>(0, header.y));
+
+		return true;
+	}
+
+	for (std::uint32_t y=0; y<header.height; ++y)
+	{
+		std::copy(data+header.pitch*y, data+header.pitch*y+(header.width*header.bpp+7)/8, f.pixel<std::uint8_t>(header.x, header.y+y));
+	}
+
+	return true;
+}
+
+frame_receiver::frame_receiver(socket_wrapper &sw)
+	: batched_receiver(sw), nack_timer(sw.service), reorder_timer(sw.service)
+{
+	on_packets_published=[this]
+	{
+		frames_unpublished=0;
+		wake_consumer();
+	};
+
+	processed_chunk_validator.frame_completed=[this] (std::uint32_t frame_id)
+	{
+		processed_chunk_validator.trace_missing_chunks();
+
+		frame_pending=false;
+		this->flip_buffers(frame_id);
+	};
+
+	processed_chunk_validator.on_chunk=[this] (const remote_chunk_header &header, const std::uint8_t *data, int length)
+	{
+		frame_pending=true;
+		track_chunk(header);
+
+		// an on_chunk of the user's places chunks its own way
+		chunk_placed=true;
+		on_chunk(header, data, length);
+
+		if (chunks_tracked && chunk_placed)
+			generations[back_slot][header.chunk_id]=generation;
+	};
+
+	on_packet=[this] (const std::uint8_t *data_begin, const std::uint8_t *data_end, const udp::endpoint &remote_endpoint)
+	{
+		auto &rh=*reinterpret_cast<const remote_header *>(data_begin);
+
+		/*if (current_seq_id && rh.seq_id-*current_seq_id>1)
+		{
+		std::cout << "missed packets " << *current_seq_id+1 << "-" << rh.seq_id-1 << std::endl;
+		}*/
+
+		current_seq_id=rh.seq_id;
+
+		//expire(last_seq_id);
+		expire(last_mode_set);
+		//expire(last_frame_id);
+
+		switch (rh.pkt_id)
+		{
+		case 0:
+			if (check_new(last_mode_set, rh.seq_id))
+			{
+				auto rmh=read_header<remote_mode_header>(data_begin, data_end);
+
+				// chunk ids are about to change meaning or the back buffer its size, catch up while they still line up with the front's
+				if (rmh.layout!=layout || int(rmh.width)!=back_buffer.width || int(rmh.height)!=back_buffer.height || int(rmh.pitch)!=back_buffer.pitch || int(rmh.bpp)!=back_buffer.bpp)
+				{
+					copy_forward();
+					chunks_tracked=false;
+				}
+
+				layout=rmh.layout;
+
+				if (fec.group_size!=rmh.fec_group_size)
+				{
+					fec.reset();
+					fec.group_size=rmh.fec_group_size;
+				}
+
+				if (on_mode_set)
+					on_mode_set(rmh);
+			}
+			break;
+		}
+
+		processed_chunk_validator.process(data_begin, data_end, remote_endpoint);
+
+		// may complete the frame through on_recovered before the next one flips it with holes
+		fec.process(data_begin, data_end);
+	};
+
+	fec.on_recovered=[this] (const std::uint8_t *data_begin, const std::uint8_t *data_end)
+	{
+		processed_chunk_validator.process(data_begin, data_end, udp::endpoint());
+	};
+
+	on_batch_complete=[this] ()
+	{
+		if (buffers_flipped)
+		{
+			buffers_flipped=false;
+
+			if (on_frame)
+				on_frame();
+		}
+	};
+
+	on_mode_set=[this] (const remote_mode_header &rmh)
+	{
+		back_buffer.resize(rmh.width, rmh.height, rmh.pitch, rmh.bpp);
+		back_buffer.aspect_ratio=rmh.aspect_ratio;
+	};
+
+	on_chunk=[this] (const remote_chunk_header &header, const std::uint8_t *data, int length)
+	{
+		auto w=std::max<int>(back_buffer.width, header.width+header.x);
+
+		back_buffer.resize(
+			w,
+			std::max<int>(back_buffer.height, header.height+header.y),
+			std::max<int>(back_buffer.pitch, (w*header.bpp+7)/8),
+			header.bpp);
+
+		chunk_placed=place_chunk(back_buffer, header, data, length, decoded_chunk);
+
+		if (!chunk_placed && (header.pkt_id & pkt_flag_compressed))
+			std::cerr << "Corrupt compressed chunk " << header.chunk_id << " in frame " << header.frame_id << std::endl;
+	};
+
+	live_chunk_validator.frame_completed=[this] (auto)
+	{
+		// inline the frame is already on its way to the front buffer
+		if (inline_assembly)
+			return;
+
+		++frames_unpublished;
+		publish_packets();
+	};
+}
+
+void frame_receiver::start()
+{
+	auto settings=reorder;
+
+	// a retransmit comes in once the next frame began, with a single frame in flight it'd be dropped as a late copy
+	if (nack_deadline.count()>0)
+		settings.window=std::max<std::uint32_t>(settings.window, 2);
+
+	live_chunk_validator.reorder=settings;
+	processed_chunk_validator.reorder=settings;
+
+	batched_receiver::start();
+}
+
+void frame_receiver::packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+{
+	// inline chunks go from the receive buffer straight into the back buffer
+	if (inline_assembly)
+		on_packet(data_begin, data_end, remote_endpoint);
+	else
+		batched_receiver::packet_handler(data_begin, data_end, remote_endpoint);
+
+	live_chunk_validator.process(data_begin, data_end, remote_endpoint);
+
+	if (!reorder_timer_armed && live_chunk_validator.later_frames_pending())
+		arm_reorder_timer();
+
+	if (nack_deadline.count()>0)
+		track_missing_chunks(data_begin, data_end, remote_endpoint);
+/*
+	auto &rh=*reinterpret_cast<const remote_header *>(data_begin);
+	bool should_process_chunk=live_chunk_validator.process(data_begin, data_end, remote_endpoint);
+
+	if (rh.pkt_id==remote_chunk_header().pkt_id && !should_process_chunk)
+		return;*/
+}
+
+// requests gaps once later chunks have overtaken them, the sender sends chunks in order
+void frame_receiver::track_missing_chunks(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+{
+	const auto &validator=live_chunk_validator;
+
+	if (std::size_t(data_end-data_begin)<sizeof(remote_header))
+		return;
+
+	auto type=pkt_type(reinterpret_cast<const remote_header *>(data_begin)->pkt_id);
+
+	// the processing side's fec decoder isn't ours to read
+	if (type==remote_mode_header().pkt_id)
+		nack_fec_group_size=std::min(read_header<remote_mode_header>(data_begin, data_end).fec_group_size, max_fec_group_size);
+
+	// which chunks a delta frame consists of is unknown, and completed frames need nothing
+	if (!validator.frame_id || validator.delta_frame)
+		return;
+
+	if (type==remote_parity_header().pkt_id && std::size_t(data_end-data_begin)>=sizeof(remote_parity_header) && nack_fec_group_size>0)
+	{
+		auto &rph=*reinterpret_cast<const remote_parity_header *>(data_begin);
+
+		if (rph.frame_id!=*validator.frame_id || rph.first_chunk_id>=validator.chunks_expected)
+			return;
+
+		select_nack_frame(rph.frame_id);
+		parity_received[rph.first_chunk_id/nack_fec_group_size]=true;
+
+		return;
+	}
+
+	if (type!=remote_chunk_header().pkt_id || std::size_t(data_end-data_begin)<sizeof(remote_chunk_header))
+		return;
+
+	auto &rch=*reinterpret_cast<const remote_chunk_header *>(data_begin);
+
+	if (rch.frame_id!=*validator.frame_id)
+		return;
+
+	select_nack_frame(rch.frame_id);
+
+	nack_endpoint=remote_endpoint;
+	last_chunk_time=std::chrono::steady_clock::now();
+	highest_chunk_id=std::max(highest_chunk_id, rch.chunk_id);
+
+	// a gap may yet be filled by its group's parity, which follows the group
+	auto margin=nack_reorder_margin+nack_fec_group_size;
+
+	if (highest_chunk_id>=nack_checked+margin)
+	{
+		auto end=highest_chunk_id-margin;
+
+		request_missing_chunks(nack_checked, end);
+		nack_checked=end;
+	}
+
+	if (!nack_timer_armed)
+		arm_nack_timer(nack_idle);
+}
+
+void frame_receiver::request_missing_chunks(std::uint32_t begin, std::uint32_t end)
+{
+	const auto &validator=live_chunk_validator;
+
+	if (validator.frame_id_assign_time+nack_deadline<std::chrono::steady_clock::now())
+		return;
+
+	end=std::min<std::uint32_t>(end, validator.chunks_received.size());
+	nack_chunks.clear();
+
+	for (auto i=begin; i<end; ++i)
+	{
+		if (!validator.chunks_received[i] && !fec_recoverable(i))
+			nack_chunks.push_back(i);
+	}
+
+	for (std::size_t i=0; i<nack_chunks.size(); i+=max_nack_chunks)
+	{
+		remote_nack_header nack;
+
+		nack.frame_id=*validator.frame_id;
+		nack.chunk_count=std::min<std::size_t>(max_nack_chunks, nack_chunks.size()-i);
+
+		// the handler owns the packet, nacks are rare enough to allocate for
+		auto header=reinterpret_cast<const std::uint8_t *>(&nack);
+		auto ids=reinterpret_cast<const std::uint8_t *>(nack_chunks.data()+i);
+		auto packet=std::make_shared<std::vector<std::uint8_t>>(header, header+sizeof(nack));
+
+		packet->insert(packet->end(), ids, ids+nack.chunk_count*sizeof(std::uint32_t));
+
+		++nack_stats.nacks;
+		nack_stats.chunks+=nack.chunk_count;
+
+		sw.socket.async_send_to(boost::asio::buffer(*packet), nack_endpoint, [packet] (const boost::system::error_code &error, std::size_t bytes_transferred)
+		{
+			if (error)
+				std::cerr << "nack failed: " << error.message() << std::endl;
+		});
+	}
+}
+
+void frame_receiver::select_nack_frame(std::uint32_t frame_id)
+{
+	if (nack_frame_id==frame_id)
+		return;
+
+	nack_frame_id=frame_id;
+	nack_checked=0;
+	highest_chunk_id=0;
+	parity_received.assign(nack_fec_group_size>0 ? (live_chunk_validator.chunks_expected+nack_fec_group_size-1)/nack_fec_group_size : 0, false);
+}
+
+// the only loss of a group whose parity arrived is left to the fec decoder
+bool frame_receiver::fec_recoverable(std::uint32_t chunk_id) const
+{
+	const auto &validator=live_chunk_validator;
+	auto group=nack_fec_group_size>0 ? chunk_id/nack_fec_group_size : 0;
+
+	if (group>=parity_received.size() || !parity_received[group])
+		return false;
+
+	auto begin=group*nack_fec_group_size;
+	auto end=std::min<std::uint32_t>(begin+nack_fec_group_size, validator.chunks_received.size());
+
+	return std::count(validator.chunks_received.begin()+begin, validator.chunks_received.begin()+end, false)==1;
+}
+
+// the frame's chunks have stopped coming, request the rest again until the deadline passes
+void frame_receiver::nack_timeout()
+{
+	const auto &validator=live_chunk_validator;
+
+	if (!validator.frame_id || validator.delta_frame || nack_frame_id!=validator.frame_id)
+		return;
+
+	if (validator.frame_id_assign_time+nack_deadline<std::chrono::steady_clock::now())
+		return;
+
+	auto idle=std::chrono::steady_clock::now()-last_chunk_time;
+
+	// chunks still coming, check again once they could have stopped
+	if (idle<nack_idle)
+		return arm_nack_timer(nack_idle-idle);
+
+	request_missing_chunks(0, validator.chunks_expected);
+	nack_checked=std::max(nack_checked, highest_chunk_id);
+	last_chunk_time=std::chrono::steady_clock::now();
+	arm_nack_timer(nack_idle);
+}
+
+void frame_receiver::arm_nack_timer(std::chrono::steady_clock::duration wait)
+{
+	nack_timer_armed=true;
+	nack_timer.expires_from_now(std::chrono::duration_cast<boost::asio::high_resolution_timer::duration>(wait));
+	nack_timer.async_wait([this] (const boost::system::error_code &error)
+	{
+		nack_timer_armed=false;
+
+		if (!error)
+			nack_timeout();
+	});
+}
+
+void frame_receiver::arm_reorder_timer()
+{
+	reorder_timer_armed=true;
+	reorder_timer.expires_from_now(std::chrono::duration_cast<boost::asio::high_resolution_timer::duration>(std::max(reorder.deadline, std::chrono::milliseconds(1))));
+	reorder_timer.async_wait([this] (const boost::system::error_code &error)
+	{
+		reorder_timer_armed=false;
+
+		if (error)
+			return;
+
+		// the consumer expires its own validator as it takes frames
+		live_chunk_validator.expire();
+
+		if (inline_assembly)
+			processed_chunk_validator.expire();
+
+		if (live_chunk_validator.later_frames_pending())
+			arm_reorder_timer();
+	});
+}
+
+void frame_receiver::flip_buffers(std::uint32_t frame_id)
+{
+	// only the swap concerns the consumer, the copies read the newest frame like it does and write the back buffer it never sees
+	bool copied=copy_forward();
+
+	latest_slot=back_slot;
+
+	if (inline_assembly)
+	{
+		std::unique_lock<std::mutex> lock(ready_mutex);
+
+		std::swap(ready_buffer, back_buffer);
+		std::swap(ready_slot, back_slot);
+		ready_frame_id=frame_id;
+		latest=ready_buffer;
+		++frames_flipped;
+	}
+	else
+	{
+		std::unique_lock<std::mutex> lock(front_buffer_mutex);
+
+		std::swap(front_buffer, back_buffer);
+		std::swap(front_slot, back_slot);
+		front_frame_id=frame_id;
+		latest=front_buffer;
+		++frames_flipped;
+	}
+
+	++generation;
+
+	if (!copied || stale_slots[back_slot])
+	{
+		back_buffer.resize(latest.width, latest.height, latest.pitch, latest.bpp);
+		std::copy(latest.data, latest.end(), back_buffer.data);
+
+		if (!copied)
+		{
+			for (auto &g : generations)
+				g.clear();
+
+			// the third buffer holds an older frame than the two now alike
+			for (int slot=0; slot<int(stale_slots.size()); ++slot)
+				stale_slots[slot]=slot!=back_slot && slot!=latest_slot;
+
+			chunk_rects.clear();
+			chunks_tracked=true;
+		}
+		else
+		{
+			generations[back_slot]=generations[latest_slot];
+			stale_slots[back_slot]=false;
+		}
+	}
+
+	back_buffer.aspect_ratio=latest.aspect_ratio;
+	buffers_flipped=true;
+
+	if (inline_assembly)
+		wake_consumer();
+}
+
+void frame_receiver::track_chunk(const remote_chunk_header &header)
+{
+	if (!chunks_tracked)
+		return;
+
+	auto id=header.chunk_id;
+
+	if (id>=chunk_validator::max_chunks)
+	{
+		copy_forward();
+		chunks_tracked=false;
+
+		return;
+	}
+
+	if (id>=chunk_rects.size())
+		chunk_rects.resize(id+1);
+
+	for (auto &g : generations)
+	{
+		if (id>=g.size())
+			g.resize(id+1, 0);
+	}
+
+	auto &rect=chunk_rects[id];
+
+	if (rect.width==0)
+		rect={ header.x, header.y, header.width, header.height };
+	else if (rect.x!=header.x || rect.y!=header.y || rect.width!=header.width || rect.height!=header.height)
+	{
+		// the layout changed, catch up before the chunk lands, the chunks of this frame so far didn't overlap the others
+		copy_forward();
+		chunks_tracked=false;
+	}
+}
+
+bool frame_receiver::copy_forward()
+{
+	if (!chunks_tracked || !latest.data || back_buffer.width!=latest.width || back_buffer.height!=latest.height || back_buffer.pitch!=latest.pitch || back_buffer.bpp!=latest.bpp)
+		return false;
+
+	const auto &latest_generations=generations[latest_slot];
+	auto &back_generations=generations[back_slot];
+
+	for (std::size_t id=0; id<chunk_rects.size(); ++id)
+	{
+		if (latest_generations[id]<=back_generations[id])
+			continue;
+
+		const auto &rect=chunk_rects[id];
+
+		if (rect.x+rect.width>std::uint32_t(latest.width) || rect.y+rect.height>std::uint32_t(latest.height))
+			continue;
+
+		auto row_bytes=(rect.width*latest.bpp+7)/8;
+
+		for (auto y=rect.y; y<rect.y+rect.height; ++y)
+		{
+			auto src=latest.pixel<std::uint8_t>(rect.x, y);
+
+			std::copy(src, src+row_bytes, back_buffer.pixel<std::uint8_t>(rect.x, y));
+		}
+
+		back_generations[id]=latest_generations[id];
+	}
+
+	return true;
+}
+
+void frame_receiver::expire(boost::optional<std::uint32_t> &seq_id)
+{
+	if (!seq_id)
+		return;
+
+	if (!current_seq_id || (*current_seq_id-*seq_id)>=seq_diff_out_of_range)
+		seq_id=boost::none;
+}
+
+bool frame_receiver::check_new(boost::optional<std::uint32_t> &stored_seq_id, std::uint32_t new_seq_id)
+{
+	if (!stored_seq_id || ((new_seq_id-*stored_seq_id)<seq_diff_out_of_range && (new_seq_id-*stored_seq_id)>0))
+	{
+		stored_seq_id=new_seq_id;
+
+		return true;
+	}
+
+	return false;
+}
+
+std::unique_lock<std::mutex> frame_receiver::lock_front_buffer()
+{
+	return std::unique_lock<std::mutex>(front_buffer_mutex);
+}
+
+boost::optional<std::uint32_t> frame_receiver::get_front_frame_id() const
+{
+	auto id=front_frame_id.load();
+
+	if (id<0)
+		return boost::none;
+
+	return std::uint32_t(id);
+}
+
+void frame_receiver::packets_handler(const std::vector<received_packet> &batch)
+{
+	batched_receiver::packets_handler(batch);
+
+	if (inline_assembly && on_batch_complete)
+		on_batch_complete();
+}
+
+int frame_receiver::receive_slots(int count, std::array<boost::asio::mutable_buffer, max_batch_size> &slots)
+{
+	// inline nothing stays in the slots past the batch
+	if (inline_assembly)
+		return receiver::receive_slots(count, slots);
+
+	return batched_receiver::receive_slots(count, slots);
+}
+
+bool frame_receiver::packets_due() const
+{
+	return frames_unpublished>0;
+}
+
+bool frame_receiver::frame_ready() const
+{
+	if (inline_assembly)
+		return frames_flipped!=frames_acquired;
+
+	return publications!=publications_taken;
+}
+
+void frame_receiver::wake_consumer()
+{
+	if (!consumer_waiting)
+		return;
+
+	{
+		std::unique_lock<std::mutex> l(m);
+	}
+
+	cv.notify_one();
+}
+
+void netvid::frame_receiver::wait_for_frame()
+{
+	while (!wait_for_frame(std::chrono::hours(1)));
+}
+
+bool netvid::frame_receiver::wait_for_frame(std::chrono::steady_clock::duration timeout)
+{
+	if (frame_ready())
+		return true;
+
+	// set before looking again, so either this sees the frame or the io thread sees the flag and wakes it
+	consumer_waiting=true;
+
+	bool ready;
+
+	{
+		std::unique_lock<std::mutex> l(m);
+
+		ready=cv.wait_for(l, timeout, [this] { return frame_ready(); });
+	}
+
+	consumer_waiting=false;
+
+	return ready;
+}
+
+bool netvid::frame_receiver::acquire_frame()
+{
+	if (!inline_assembly)
+	{
+		process_packets();
+		processed_chunk_validator.expire();
+	}
+
+	std::uint32_t flipped=frames_flipped;
+
+	if (flipped==frames_acquired)
+		return false;
+
+	// the io thread flips under ready_mutex too, ready_buffer holds the frame it last counted
+	if (inline_assembly)
+	{
+		std::unique_lock<std::mutex> lock(ready_mutex);
+		std::unique_lock<std::mutex> front_lock(front_buffer_mutex);
+
+		std::swap(front_buffer, ready_buffer);
+		std::swap(front_slot, ready_slot);
+		front_frame_id=ready_frame_id;
+		flipped=frames_flipped;
+	}
+
+	frames_acquired=flipped;
+
+	return true;
+}
+
+bool netvid::frame_receiver::acquire_frame(std::chrono::steady_clock::duration timeout)
+{
+	auto deadline=std::chrono::steady_clock::now()+timeout;
+
+	if (acquire_frame())
+		return true;
+
+	// a wake-up may find only the packets of a frame that was handed over with the last ones
+	while (wait_for_frame(deadline-std::chrono::steady_clock::now()))
+	{
+		if (acquire_frame())
+			return true;
+	}
+
+	return false;
+}
+
+io_service_wrapper::io_service_wrapper()
+{
+	work.emplace(io_service);
+}
+
+io_service_wrapper::~io_service_wrapper()
+{
+	stop();
+}
+
+void io_service_wrapper::run()
+{
+	thread=std::thread([this] { io_service.run(); });
+}
+
+void io_service_wrapper::stop()
+{
+	work.reset();
+
+	if (thread.joinable())
+		thread.join();
+}
+
+void packets::allocate(std::size_t slots, std::size_t slot_size)
+{
+	auto new_stride=(slot_size+alignment-1)/alignment*alignment;
+	std::vector<std::uint8_t> new_storage(slots*new_stride+alignment-1);
+	auto new_slab=new_storage.data()+(alignment-reinterpret_cast<std::uintptr_t>(new_storage.data())%alignment)%alignment;
+
+	for (std::size_t i=0; i<packets.size(); ++i)
+	{
+		auto &pkt=packets[i];
+		auto size=pkt.end-pkt.begin;
+
+		std::copy(slab+pkt.begin, slab+pkt.end, new_slab+i*new_stride);
+		pkt.begin=int(i*new_stride);
+		pkt.end=pkt.begin+size;
+	}
+
+	storage.swap(new_storage);
+	slab=new_slab;
+	this->slots=slots;
+	stride=new_stride;
+	packets.reserve(slots);
+}
+
+std::size_t packets::capacity() const
+{
+	return slots;
+}
+
+std::size_t packets::slot_size() const
+{
+	return stride;
+}
+
+std::uint8_t *packets::slot(std::size_t i)
+{
+	return slab+i*stride;
+}
+
+const std::uint8_t *packets::data(const packet &pkt) const
+{
+	return slab+pkt.begin;
+}
+
+void packets::clear()
+{
+	packets.clear();
+}
+
+struct sharded_receiver::shard
+{
+	struct shard_receiver : receiver
+	{
+		sharded_receiver &owner;
+		shard &s;
+
+		shard_receiver(socket_wrapper &sw, sharded_receiver &owner, shard &s)
+			: receiver(sw), owner(owner), s(s)
+		{
+		}
+
+	protected:
+		void packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint) override
+		{
+			owner.on_packet(s, data_begin, data_end);
+		}
+	};
+
+	io_service_wrapper service;
+	socket_wrapper socket;
+	shard_receiver r;
+	std::atomic<std::uint64_t> writing{ idle }; // frame_id of the chunk being placed
+	std::vector<std::uint8_t> decoded_chunk; // compressed chunks are decoded here before they're placed
+
+	shard(sharded_receiver &owner)
+		: socket(service.io_service), r(socket, owner, *this)
+	{
+	}
+};
+
+sharded_receiver::sharded_receiver(int shards, bool reuse_port)
+	: shard_count(std::max(shards, 1)), reuse_port(reuse_port)
+{
+}
+
+sharded_receiver::~sharded_receiver()
+{
+	stop();
+}
+
+void sharded_receiver::bind(const boost::asio::ip::udp::endpoint &endpoint)
+{
+	shards.clear();
+
+	for (int i=0; i<shard_count; ++i)
+		shards.push_back(std::make_unique<shard>(*this));
+
+	auto &first=shards.front()->socket.socket;
+
+	if (reuse_port)
+	{
+#if defined(__linux__) && defined(SO_REUSEPORT)
+		typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port_option;
+
+		// a port picked by the first bind is shared by the rest
+		for (auto &s : shards)
+		{
+			s->socket.socket.set_option(reuse_port_option(true));
+			s->socket.bind(&s==&shards.front() ? endpoint : first.local_endpoint());
+		}
+#else
+		throw std::runtime_error("SO_REUSEPORT isn't available");
+#endif
+		return;
+	}
+
+	first.bind(endpoint);
+
+#if __linux__
+	for (std::size_t i=1; i<shards.size(); ++i)
+	{
+		auto &socket=shards[i]->socket.socket;
+		auto fd=dup(first.native_handle());
+
+		if (fd<0)
+			throw boost::system::system_error(errno, boost::system::system_category(), "dup");
+
+		socket.close();
+		socket.assign(udp::v4(), fd);
+	}
+#else
+	shards.resize(1);
+#endif
+}
+
+void sharded_receiver::bind(const std::string &endpoint)
+{
+	bind(socket_wrapper::string_to_endpoint(endpoint));
+}
+
+boost::asio::ip::udp::endpoint sharded_receiver::local_endpoint() const
+{
+	return shards.front()->socket.socket.local_endpoint();
+}
+
+void sharded_receiver::start()
+{
+	for (auto &s : shards)
+	{
+		s->r.batch_size=batch_size;
+		s->r.start();
+		s->service.run();
+	}
+}
+
+void sharded_receiver::stop()
+{
+	for (auto &s : shards)
+	{
+		s->service.io_service.stop();
+		s->service.stop();
+	}
+}
+
+bool sharded_receiver::acquire_frame()
+{
+	std::uint32_t flipped=frames_flipped;
+
+	if (flipped==frames_acquired)
+		return false;
+
+	frames_acquired=flipped;
+
+	return true;
+}
+
+bool sharded_receiver::acquire_frame(std::chrono::steady_clock::duration timeout)
+{
+	if (acquire_frame())
+		return true;
+
+	// set before looking again, so either this sees the frame or the flipping thread sees the flag and wakes it
+	consumer_waiting=true;
+
+	{
+		std::unique_lock<std::mutex> l(m);
+
+		cv.wait_for(l, timeout, [this] { return frames_flipped!=frames_acquired; });
+	}
+
+	consumer_waiting=false;
+
+	return acquire_frame();
+}
+
+std::unique_lock<std::mutex> sharded_receiver::lock_front_buffer()
+{
+	return std::unique_lock<std::mutex>(front_buffer_mutex);
+}
+
+sharded_receiver::statistics sharded_receiver::get_stats() const
+{
+	statistics stats;
+
+	stats.frames=frames;
+	stats.chunks=chunks;
+	stats.dropped=dropped;
+
+	return stats;
+}
+
+void sharded_receiver::on_packet(shard &s, const std::uint8_t *data_begin, const std::uint8_t *data_end)
+{
+	if (std::size_t(data_end-data_begin)<sizeof(remote_header))
+		return;
+
+	auto pkt_id=reinterpret_cast<const remote_header *>(data_begin)->pkt_id;
+
+	if (pkt_id==remote_mode_header().pkt_id)
+	{
+		std::unique_lock<std::mutex> l(assembly_mutex);
+
+		set_mode(read_header<remote_mode_header>(data_begin, data_end));
+
+		return;
+	}
+
+	if (pkt_type(pkt_id)!=remote_chunk_header().pkt_id || (pkt_id & ~(pkt_type_mask | pkt_flag_delta | pkt_flag_compressed)) || std::size_t(data_end-data_begin)<sizeof(remote_chunk_header))
+		return;
+
+	auto &rch=*reinterpret_cast<const remote_chunk_header *>(data_begin);
+
+	// announce the frame before checking it's still the one assembled, a flip waits for announced chunks to land
+	for (;;)
+	{
+		s.writing=rch.frame_id;
+
+		if (assembling==rch.frame_id)
+			break;
+
+		s.writing=idle;
+
+		if (!begin_frame(rch))
+		{
+			++dropped;
+			return;
+		}
+	}
+
+	// outside the bitmap duplicates couldn't be told apart, they'd complete the frame without its real chunks
+	if (rch.chunk_id>=chunk_words*64)
+	{
+		s.writing=idle;
+		++dropped;
+		return;
+	}
+
+	auto bit=std::uint64_t(1) << (rch.chunk_id%64);
+
+	// a chunk already placed is a duplicate
+	if (chunks_received[rch.chunk_id/64].fetch_or(bit) & bit)
+	{
+		s.writing=idle;
+		return;
+	}
+
+	auto data=data_begin+sizeof(rch);
+	bool placed=place_chunk(back_buffer, rch, data, data_end-data, s.decoded_chunk);
+
+	// a chunk that didn't land is a hole like a lost one, filled from the front buffer unless a good copy still comes
+	if (!placed)
+		chunks_received[rch.chunk_id/64].fetch_and(~bit);
+
+	if (on_chunk_placed)
+		on_chunk_placed(rch);
+
+	// counted while still announced, a frame beginning meanwhile waits and then starts its count over
+	++chunks;
+
+	bool complete=placed && ++chunks_count==chunks_expected;
+
+	s.writing=idle;
+
+	if (!placed)
+		++dropped;
+
+	if (complete)
+		complete_frame(rch.frame_id);
+}
+
+// with assembly_mutex held
+void sharded_receiver::set_mode(const remote_mode_header &rmh)
+{
+	if (last_mode_set && rmh.seq_id-*last_mode_set-1>=std::numeric_limits<std::uint32_t>::max()/2)
+		return;
+
+	last_mode_set=rmh.seq_id;
+
+	if (rmh.layout==layout && int(rmh.width)==back_buffer.width && int(rmh.height)==back_buffer.height && int(rmh.pitch)==back_buffer.pitch && int(rmh.bpp)==back_buffer.bpp)
+	{
+		back_buffer.aspect_ratio=rmh.aspect_ratio;
+		return;
+	}
+
+	if (std::uint64_t(rmh.pitch)*rmh.height>std::uint64_t(std::numeric_limits<int>::max()))
+		return;
+
+	// the frame being assembled is abandoned, its chunks no longer fit
+	auto frame_id=assembling.exchange(idle);
+
+	if (frame_id!=idle)
+		quiesce(frame_id);
+
+	std::tie(chunk_columns, chunk_rows)=get_frame_divisions(rmh.width, rmh.height, rmh.bpp, 1400, rmh.layout);
+
+	auto total_chunks=std::min<std::size_t>(std::size_t(chunk_columns)*chunk_rows, chunk_validator::max_chunks);
+
+	chunk_words=(total_chunks+63)/64;
+	chunks_received.reset(new std::atomic<std::uint64_t>[chunk_words]);
+	layout=rmh.layout;
+	back_buffer.resize(rmh.width, rmh.height, rmh.pitch, rmh.bpp);
+	back_buffer.aspect_ratio=rmh.aspect_ratio;
+	back_synced=false;
+}
+
+bool sharded_receiver::begin_frame(const remote_chunk_header &rch)
+{
+	std::unique_lock<std::mutex> l(assembly_mutex);
+
+	// another shard began it meanwhile
+	if (assembling==rch.frame_id)
+		return true;
+
+	auto now=std::chrono::steady_clock::now();
+
+	// only newer frames begin, unless the stream restarted
+	if (!chunks_received || (last_frame_id && rch.frame_id-*last_frame_id-1>=60 && now<last_frame_time+std::chrono::seconds(3)))
+		return false;
+
+	// the frame being assembled ends incomplete, as with chunk_validator it's shown anyway
+	auto frame_id=assembling.exchange(idle);
+
+	if (frame_id!=idle)
+	{
+		quiesce(frame_id);
+		copy_missing_chunks();
+		flip_buffers();
+	}
+
+	bool delta=rch.pkt_id & pkt_flag_delta;
+
+	// a delta frame only sends what changed since the front buffer
+	if (delta && !back_synced && front_buffer && front_buffer.bytes()==back_buffer.bytes())
+	{
+		std::copy(front_buffer.data, front_buffer.end(), back_buffer.data);
+		back_synced=true;
+	}
+
+	for (std::size_t i=0; i<chunk_words; ++i)
+		chunks_received[i]=0;
+
+	chunks_count=0;
+	chunks_expected=rch.frame_chunks;
+	last_frame_id=rch.frame_id;
+	last_frame_time=now;
+	assembling=rch.frame_id;
+
+	return true;
+}
+
+void sharded_receiver::complete_frame(std::uint32_t frame_id)
+{
+	std::unique_lock<std::mutex> l(assembly_mutex);
+
+	auto expected=std::uint64_t(frame_id);
+
+	if (!assembling.compare_exchange_strong(expected, idle))
+		return;
+
+	quiesce(frame_id);
+	flip_buffers();
+}
+
+// with assembly_mutex held and assembling no longer frame_id, waits for its chunks still being placed
+void sharded_receiver::quiesce(std::uint64_t frame_id)
+{
+	for (auto &s : shards)
+	{
+		while (s->writing==frame_id)
+			std::this_thread::yield();
+	}
+}
+
+// with assembly_mutex held and no chunks being placed, an incomplete frame's holes show the front frame as with frame_receiver
+void sharded_receiver::copy_missing_chunks()
+{
+	// delta frames began as a copy of the front buffer
+	if (back_synced || !front_buffer || front_buffer.width!=back_buffer.width || front_buffer.height!=back_buffer.height || front_buffer.pitch!=back_buffer.pitch || front_buffer.bpp!=back_buffer.bpp)
+		return;
+
+	auto total_chunks=std::min<std::size_t>(std::size_t(chunk_columns)*chunk_rows, chunk_words*64);
+
+	for (std::size_t id=0; id<total_chunks; ++id)
+	{
+		if (chunks_received[id/64] & (std::uint64_t(1) << (id%64)))
+			continue;
+
+		int top;
+		int left;
+		int bottom;
+		int right;
+
+		std::tie(top, left, bottom, right)=get_chunk(back_buffer.width, back_buffer.height, chunk_columns, chunk_rows, int(id/chunk_columns), int(id%chunk_columns));
+
+		auto row_bytes=((right-left)*back_buffer.bpp+7)/8;
+
+		for (int y=top; y<bottom; ++y)
+		{
+			auto src=front_buffer.pixel<std::uint8_t>(left, y);
+
+			std::copy(src, src+row_bytes, back_buffer.pixel<std::uint8_t>(left, y));
+		}
+	}
+}
+
+// with assembly_mutex held
+void sharded_receiver::flip_buffers()
+{
+	{
+		std::unique_lock<std::mutex> lock(front_buffer_mutex);
+
+		std::swap(front_buffer, back_buffer);
+	}
+
+	back_buffer.resize(front_buffer.width, front_buffer.height, front_buffer.pitch, front_buffer.bpp);
+	back_buffer.aspect_ratio=front_buffer.aspect_ratio;
+	back_synced=false;
+
+	++frames;
+	++frames_flipped;
+
+	if (consumer_waiting)
+	{
+		{
+			std::unique_lock<std::mutex> l(m);
+		}
+
+		cv.notify_one();
+	}
+}
@@ -1,17 +1,22 @@
 #ifndef NET_H
 #define NET_H
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <regex>
 #include <thread>
 #include <mutex>
 #include <future>
+#include <deque>
 
 #include <boost/asio.hpp>
 #include <boost/asio/ip/udp.hpp>
 #include <boost/asio/high_resolution_timer.hpp>
 #include <boost/thread.hpp>
 
+#include "codec.h"
+#include "fec.h"
 #include "framebuffer.h"
 #include "protocol.h"
 
@@ -32,6 +37,7 @@ namespace netvid
 
 	struct socket_wrapper
 	{
+		boost::asio::io_service &service;
 		boost::asio::ip::udp::socket socket;
 		boost::asio::io_service::strand strand;
 
@@ -54,6 +60,60 @@ namespace netvid
 		return packet;
 	}
 
+	// an already assembled packet, header first
+	static const std::vector<boost::asio::const_buffer> &prepare_packet(const std::vector<boost::asio::const_buffer> &packet)
+	{
+		return packet;
+	}
+
+	// a set of datagrams for the same endpoint, pushed out with as few syscalls as possible (sendmmsg on linux)
+	struct packet_batch
+	{
+		std::vector<boost::asio::const_buffer> buffers;
+		std::vector<std::pair<std::size_t, std::size_t>> packets; // first buffer, buffer count
+		std::size_t sent=0;
+		std::size_t released=std::numeric_limits<std::size_t>::max(); // packets before this may go out, for pacing
+		std::size_t bytes=0;
+		std::size_t failed=0; // datagrams skipped after an error other than would_block, the rest still go out
+		std::size_t failed_bytes=0;
+		boost::system::error_code failure; // the last of them
+
+		template<class buffer_sequence>
+		void add(const buffer_sequence &packet)
+		{
+			packets.emplace_back(buffers.size(), 0);
+
+			for (const auto &i : packet)
+			{
+				buffers.push_back(i);
+				bytes+=boost::asio::buffer_size(i);
+				++packets.back().second;
+			}
+		}
+
+		bool done() const
+		{
+			return sent>=packets.size();
+		}
+
+		std::size_t end() const
+		{
+			return std::min(released, packets.size());
+		}
+
+		std::size_t packet_bytes(std::size_t i) const;
+
+		void clear();
+
+		// sends pending packets without blocking, error is would_block if the socket buffer is full
+		// datagrams failing otherwise are skipped and counted in failed
+		void send(socket_wrapper &sw, const boost::asio::ip::udp::endpoint &remote_endpoint, boost::system::error_code &error);
+	};
+
+	typedef std::function<void(const boost::system::error_code &error, std::size_t bytes_transferred)> batch_handler_type;
+
+	void async_send_batch(socket_wrapper &sw, const boost::asio::ip::udp::endpoint &remote_endpoint, packet_batch &batch, batch_handler_type handler);
+
 	struct unlimited_sender
 	{
 		socket_wrapper &sw;
@@ -70,90 +130,76 @@ namespace netvid
 		{
 			return sw.socket.async_send_to(prepare_packet(std::forward<args_type>(args)...), remote_endpoint, sent_handler);
 		}
+
+		void send_batch(packet_batch &batch, batch_handler_type sent_handler)
+		{
+			async_send_batch(sw, remote_endpoint, batch, sent_handler);
+		}
+
+		void begin_frame(std::size_t frame_bytes)
+		{
+		}
 	};
 
 	struct rate_limited_sender
 	{
+		typedef boost::asio::high_resolution_timer::clock_type clock_type;
+
 		socket_wrapper &sw;
 		boost::asio::ip::udp::endpoint remote_endpoint;
 		int max_rate_bytes=90*1024*1024/8; // default limit 90 mbps
+		int burst_bytes=64*1024; // bytes released back to back per timer tick at most
+		std::chrono::microseconds frame_interval{0}; // spread each frame evenly over this, 0 sends frames at max_rate_bytes
+		bool kernel_pacing=false; // pace with SO_MAX_PACING_RATE instead of timers, needs the fq qdisc on linux
 		boost::asio::high_resolution_timer timer;
-		bool sent=false;
-		bool expired=false;
 
 		rate_limited_sender(socket_wrapper &sw)
-			: sw(sw), timer(sw.socket.get_io_service())
+			: sw(sw), timer(sw.service)
 		{
 
 		}
 
-		std::chrono::microseconds bytes_to_us(int bytes_sent) const
+		std::chrono::microseconds bytes_to_us(std::size_t bytes_sent) const
 		{
-			return std::chrono::microseconds((bytes_sent*1000*1000)/max_rate_bytes);
+			return std::chrono::microseconds((std::int64_t(bytes_sent)*1000*1000)/max_rate_bytes);
 		}
 
-		template<class handler_type>
-		void delay(int bytes_sent, handler_type handler)
+		double current_rate() const
 		{
-			timer.expires_from_now(bytes_to_us(bytes_sent));
-			timer.async_wait(handler);
+			return rate>0 ? rate : max_rate_bytes;
 		}
 
+		void begin_frame(std::size_t frame_bytes);
+
 		template<class... args_type, class handler_type>
 		void send(handler_type sent_handler, args_type && ...args)
 		{
-			sent=false;
-			expired=false;
-
 			std::size_t bytes_to_send=0;
 			auto packet=prepare_packet(std::forward<args_type>(args)...);
 
 			for (const auto &i : packet)
 				bytes_to_send+=boost::asio::buffer_size(i);
 
-			timer.expires_from_now(bytes_to_us(bytes_to_send));
-
-			sw.socket.async_send_to(packet, remote_endpoint, [this, sent_handler] (const boost::system::error_code &error, std::size_t bytes_transferred)
+			acquire(bytes_to_send, [this, packet, sent_handler] (const boost::system::error_code &error)
 			{
-				transfer_complete(sent_handler, error, bytes_transferred);
-			});
+				if (error)
+					return sent_handler(error, 0);
 
-			timer.async_wait([this, sent_handler] (const boost::system::error_code &error)
-			{
-				wait_complete(sent_handler, error);
+				sw.socket.async_send_to(packet, remote_endpoint, sent_handler);
 			});
 		}
 
-		template<class handler_type>
-		void transfer_complete(handler_type handler, const boost::system::error_code &error, std::size_t bytes_transferred)
-		{
-			if (error)
-				return handler(error, bytes_transferred);
-
-			sent=true;
-
-			check_ready_to_write(handler, bytes_transferred);
-		}
-
-		template<class handler_type>
-		void wait_complete(handler_type handler, const boost::system::error_code &error)
-		{
-			if (error)
-				return handler(error, 0);
-
-			expired=true;
+		// releases the batch a burst at a time
+		void send_batch(packet_batch &batch, batch_handler_type sent_handler);
 
-			check_ready_to_write(handler, 0);
-		}
-
-		template<class handler_type>
-		void check_ready_to_write(handler_type handler, std::size_t bytes_transferred)
-		{
-			if (!sent || !expired)
-				return;
+	private:
+		double tokens=0;
+		double rate=0;
+		clock_type::time_point last_refill;
 
-			handler(boost::system::errc::make_error_code(boost::system::errc::success), bytes_transferred);
-		}
+		void acquire(std::size_t bytes, std::function<void(const boost::system::error_code &error)> continuation); // error if the wait was cancelled, this may be gone then
+		void refill();
+		void apply_kernel_pacing();
 	};
 
 	template<class sender_impl=unlimited_sender>
@@ -161,22 +207,62 @@ namespace netvid
 	{
 		std::uint32_t seq_id=~0;
 		std::uint32_t frame_id=~0;
+		int batch_chunks=1; // chunks per sendmmsg batch, 1 sends each chunk on its own, 0 batches the whole frame
+		bool zero_copy=false; // send chunk rows straight from the source frame instead of copying them out
+		bool compress=false; // rle code chunks of whole-byte pixels, those that don't shrink go out raw
+		chunk_layout layout=chunk_layout::tiles;
+		bool delta=false; // only send chunks that changed since the previous frame
+		int refresh_interval=60; // frames between full refreshes in delta mode
+		int max_pending_frames=1; // frames submitted and waiting behind the one being sent
+		int fec_group_size=0; // chunks covered by each xor parity packet (up to max_fec_group_size), 0 sends no parity
+		int retransmit_frames=0; // recently sent frames kept to answer NACKs from, 0 ignores NACKs
+
+		struct queue_statistics
+		{
+			std::uint64_t submitted=0;
+			std::uint64_t sent=0;
+			std::uint64_t dropped=0;
+		};
+
+		struct retransmit_statistics
+		{
+			std::uint64_t nacks=0;
+			std::uint64_t chunks=0;
+			std::uint64_t expired=0; // requested chunks not in the history, recycled or not sent (yet)
+		} retransmit_stats; // updated on the io thread
 
 		sender(socket_wrapper &sw);
 
 		void set_remote_endpoint(const std::string &remote_endpoint_str);
 		void set_remote_endpoint(const boost::asio::ip::udp::endpoint &endpoint={});
 
-		struct chunk_progress
+		struct chunk_slot
 		{
 			frame_data_managed buffer;
 			remote_chunk_header rch;
+			std::vector<boost::asio::const_buffer> packet;
+			std::vector<std::uint8_t> compressed;
+		};
+
+		struct chunk_progress : chunk_slot
+		{
+			remote_mode_header rmh;
 			int x=0;
 			int y=0;
 			int w_div;
 			int h_div;
 			std::uint32_t chunk_id=~0;
 			bool abort=false;
+			std::shared_ptr<const frame_data> keep_alive;
+			std::function<void(bool sent)> completion; // false if the socket was closed
+			std::vector<bool> changed; // chunks to send in a delta frame, empty sends all
+			std::uint32_t changed_count=0;
+
+			parity_encoder parity; // group being accumulated
+
+			std::vector<chunk_slot> batch_slots;
+			std::vector<parity_encoder> batch_parity; // completed groups, sent along with the batch
+			packet_batch batch;
 
 			void reset();
 		} current_chunk;
@@ -185,15 +271,71 @@ namespace netvid
 
 		void send(const frame_data &f, std::promise<void> &pr);
 		void send(const frame_data_managed &f, std::promise<void> &pr);
+		// holds on to the frame until its last chunk is sent, so zero-copy callers needn't
+		void send(std::shared_ptr<const frame_data> f, std::promise<void> &pr);
+
+		// non-blocking and thread-safe, queued frames are sent in order on the io thread; don't mix with send()
+		// the future turns true once the frame is sent, false if a newer one replaced it or the socket was closed
+		std::future<bool> submit(std::shared_ptr<const frame_data> f);
+		queue_statistics get_queue_stats();
 
 		void restart();
 
 
 	private:
-		void send_next_chunk(const frame_data &f, std::promise<void> &pr);
+		frame_data_managed previous_frame;
+		int frames_since_refresh=0;
+
+		struct pending_frame
+		{
+			std::shared_ptr<const frame_data> frame;
+			std::promise<bool> sent;
+		};
+
+		std::mutex queue_mutex;
+		std::deque<pending_frame> pending_frames;
+		bool queue_sending=false;
+		queue_statistics queue_stats;
 
-		template<class handler_type>
-		void send_chunk(const frame_data &f, int frame_id, int chunk_id, int total_chunks, int top, int left, int bottom, int right, handler_type sent_handler);
+		// copies of the chunk datagrams of a sent frame
+		struct sent_frame
+		{
+			std::uint32_t frame_id=0;
+			std::vector<std::uint8_t> data;
+			std::vector<std::pair<std::size_t, std::size_t>> chunks; // offset and size by chunk_id, size 0 if not sent
+			std::vector<bool> queued; // in retransmit_queue
+		};
+
+		std::deque<sent_frame> history;
+		std::deque<std::pair<std::uint32_t, std::uint32_t>> retransmit_queue; // frame_id, chunk_id
+		bool frame_in_progress=false;
+		bool retransmitting=false;
+		bool listening=false;
+		std::vector<std::uint8_t> nack_buffer;
+		boost::asio::ip::udp::endpoint nack_endpoint;
+		std::vector<std::uint8_t> retransmit_packet;
+
+		static const std::size_t max_retransmit_queue=64*1024;
+
+		void send_frame(const frame_data &f, std::function<void(bool sent)> completion); // completes on every path
+		void send_pending();
+		void send_next_chunk(const frame_data &f);
+		void send_next_batch(const frame_data &f);
+		bool next_chunk(const frame_data &f, int &top, int &left, int &bottom, int &right, std::uint32_t &chunk_id);
+		void frame_sent();
+		void find_changed_chunks(const frame_data &f);
+		bool add_parity(std::uint32_t chunk_id, const std::vector<boost::asio::const_buffer> &packet);
+
+		void begin_history(std::uint32_t total_chunks);
+		sent_frame *find_history(std::uint32_t requested_frame_id);
+		void record_chunk(std::uint32_t chunk_id, const std::vector<boost::asio::const_buffer> &packet);
+		const std::uint8_t *next_retransmit(std::size_t &size);
+		void listen_for_nacks();
+		void nack_handler(std::size_t bytes_received);
+		void send_retransmits();
+
+		void prepare_chunk(const frame_data &f, int frame_id, int chunk_id, int total_chunks, int top, int left, int bottom, int right, chunk_slot &slot);
+		bool compress_chunk(const frame_data &f, int top, int left, chunk_slot &slot);
 
 		//std::function<void()> sent_handler;
 	};
@@ -205,76 +347,199 @@ namespace netvid
 		boost::asio::ip::udp::endpoint remote_endpoint;
 	};
 
+	// a preallocated slab of equal, cache aligned slots, packet i is in slot i
 	struct packets
 	{
-		std::vector<std::uint8_t> internal_buffer;
+		static const std::size_t alignment=64;
+
 		std::vector<packet> packets;
 
+		void allocate(std::size_t slots, std::size_t slot_size); // keeps the packets it holds
+		std::size_t capacity() const;
+		std::size_t slot_size() const;
+		std::uint8_t *slot(std::size_t i);
+		const std::uint8_t *data(const packet &pkt) const;
 		void clear();
+
+	private:
+		std::vector<std::uint8_t> storage;
+		std::uint8_t *slab=nullptr;
+		std::size_t slots=0;
+		std::size_t stride=0;
+	};
+
+	struct received_packet
+	{
+		const std::uint8_t *data_begin=nullptr;
+		const std::uint8_t *data_end=nullptr;
+		boost::asio::ip::udp::endpoint remote_endpoint;
+		std::chrono::nanoseconds kernel_time{ 0 }; // CLOCK_REALTIME the kernel received it at, 0 without kernel_timestamps
 	};
 
 	struct receiver
 	{
 		socket_wrapper &sw;
 		boost::asio::ip::udp::endpoint remote_endpoint;
+		int batch_size=1; // datagrams drained per recvmmsg, 1 receives each with async_receive_from
+		bool kernel_timestamps=false; // stamp datagrams with SO_TIMESTAMPNS as they arrive, set before start(), cleared there if the socket can't
 
 		static const std::size_t max_pkt_size=64*1024;
+		static const int max_batch_size=1024;
+		static const int max_batches_per_wakeup=16;
+
+		struct statistics
+		{
+			std::uint64_t batches=0;
+			std::uint64_t packets=0;
+			std::uint64_t truncated=0; // datagrams larger than the slot they were received into, dropped
+
+			double average_batch_size() const
+			{
+				return batches ? double(packets)/batches : 0;
+			}
+		} stats;
 
 		receiver(socket_wrapper &sw);
 		~receiver();
 
 		std::function<void(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)> on_live_packet;
+		std::function<void(const received_packet &pkt)> on_live_received_packet; // with the kernel's receive time
 
 		void start();
 
 	protected:
 		virtual void packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint);
+		virtual void packets_handler(const std::vector<received_packet> &batch);
+
+		// where recvmmsg puts the next datagrams, up to count slots, by default the receiver's own buffer
+		virtual int receive_slots(int count, std::array<boost::asio::mutable_buffer, max_batch_size> &slots);
 		
 	private:
 		boost::asio::ip::udp::endpoint threaded_endpoint;
 		std::vector<std::uint8_t> recv_buffer;
+		std::vector<received_packet> recv_batch;
 
 		void recv_next_packet();
 		void recv_handler(const boost::system::error_code &error, std::size_t bytes_transferred);
-		void internal_packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint);
+		void recv_next_batch();
+		void recv_batches();
+		void internal_packets_handler(const std::vector<received_packet> &batch);
 	};
 
+	enum class overflow_policy
+	{
+		grow, // the slab is reallocated twice as large, nothing is dropped
+		drop_newest, // datagrams arriving at a full slab are dropped
+		drop_oldest, // a full slab is emptied, the consumer never sees what it held
+	};
+
+	// the io thread fills one packet buffer while the consumer processes the other, they trade them through atomics
+	// with batch_size>1 datagrams are received straight into their slots
 	struct batched_receiver : receiver
 	{
-		packets buffered_packets;
+		std::size_t ring_slots=1024; // per buffer
+		std::size_t slot_size=2048; // largest datagram kept, larger ones are dropped
+		overflow_policy overflow=overflow_policy::grow;
 
-		static const std::size_t max_pkt_size=64*1024;
+		struct ring_statistics
+		{
+			std::uint64_t dropped=0;
+			std::uint64_t grown=0;
+		} ring_stats; // updated on the io thread
 
 		batched_receiver(socket_wrapper &sw);
 		~batched_receiver();
 
+		void start();
+
 		std::function<void(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)> on_packet;
 		std::function<void()> on_batch_complete;
 
+		// runs on_packet for the packets the io thread handed over so far, never waits for it
 		void process_packets();
 
-		std::future<void> flip_buffer_packets(std::promise<void> &promise);
-
 	protected:
 		void packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint) override;
+		void packets_handler(const std::vector<received_packet> &batch) override;
+		int receive_slots(int count, std::array<boost::asio::mutable_buffer, max_batch_size> &slots) override;
+
+		// io thread, whether the filled buffer should go to the consumer, by default as soon as it holds a packet
+		virtual bool packets_due() const;
+		void publish_packets();
+
+		std::function<void()> on_packets_published; // io thread, the consumer can take the packets now
+
+		std::atomic<std::uint32_t> publications{ 0 }; // counted once the buffer is there to take
+		std::uint32_t publications_taken=0; // consumer's, publications when it last took a buffer
 
-		std::function<void()> on_flip_packet_buffer;
-		
 	private:
-		packets threaded_packets;
+		std::array<packets, 2> packet_buffers;
+		packets *filling=&packet_buffers[0]; // io thread's
+		std::atomic<packets *> published{ nullptr }; // waiting for the consumer
+		std::atomic<packets *> returned{ &packet_buffers[1] }; // processed, back for the io thread
+		std::atomic<bool> publish_wanted{ false }; // the io thread found no buffer to trade, the consumer asks again once it returned one
+		bool in_batch=false; // slots past the packets may hold the rest of the batch, publishing waits for its end
+
+		bool make_room();
 	};
 
+	// several frames may be in flight, frames complete in order and the fields below describe the oldest
+	// chunks of later frames are counted as they arrive, on_chunk only sees them once their frame is the oldest
 	struct chunk_validator
 	{
 		std::chrono::steady_clock::time_point frame_id_assign_time;
 		boost::optional<std::uint32_t> frame_id;
+		boost::optional<std::uint32_t> completed_frame_id;
 		std::vector<bool> chunks_received;
+		std::uint32_t chunks_expected=0;
+		std::uint32_t chunks_count=0;
+		bool delta_frame=false;
 		std::function<void (const remote_chunk_header &header, const std::uint8_t *data, int length)> on_chunk;
 		std::function<void (std::uint32_t frame_id)> frame_completed;
 
+		struct reorder_settings
+		{
+			std::uint32_t window=1; // frames in flight, 1 gives up a frame as soon as the next one begins
+			std::uint32_t tolerance=64; // chunks of later frames the oldest may trail before it's given up
+			std::chrono::milliseconds deadline{50}; // or once this long passed since its first chunk and a later frame began
+		} reorder;
+
+		static const std::uint32_t max_chunks=1024*1024;
+		static const std::uint32_t max_window=60;
+
 		bool process(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint);
 		bool complete() const;
 		void trace_missing_chunks();
+
+		// gives up the oldest frame once later ones waited on it past the tolerance or deadline, process() does too but chunks may stop coming
+		void expire(std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now());
+
+		bool later_frames_pending() const
+		{
+			return !pending.empty();
+		}
+
+	private:
+		struct pending_frame
+		{
+			std::uint32_t frame_id=0;
+			std::chrono::steady_clock::time_point first_chunk_time;
+			std::vector<bool> chunks_received;
+			std::uint32_t chunks_expected=0;
+			std::uint32_t chunks_count=0;
+			bool delta_frame=false;
+			std::vector<std::uint8_t> chunks; // held for on_chunk, header and payload back to back
+			std::vector<std::uint32_t> chunk_sizes;
+		};
+
+		std::deque<pending_frame> pending; // later frames in flight, by frame_id
+		std::uint32_t pending_chunks=0;
+
+		void reset_chunks();
+		void finish_frame();
+		void trace_missed_frames(std::uint32_t next_frame_id) const;
+		pending_frame &pending_for(std::uint32_t id, std::chrono::steady_clock::time_point now);
+		static bool mark_chunk(std::vector<bool> &received, std::uint32_t &expected, std::uint32_t &count, bool &delta_frame, const remote_chunk_header &rch, bool delta);
 	};
 
 	struct frame_receiver : batched_receiver
@@ -287,33 +552,205 @@ namespace netvid
 		std::function<void()> on_frame;
 		boost::optional<std::uint32_t> last_mode_set;
 		boost::optional<std::uint32_t> current_seq_id;
+		chunk_layout layout=chunk_layout::tiles;
+		fec_decoder fec; // group size follows the sender's mode header
+		std::chrono::milliseconds nack_deadline{0}; // missing chunks are requested for this long after a frame's first chunk, 0 sends no NACKs, otherwise reorder.window is 2 at least
+		std::chrono::microseconds nack_idle{5000}; // once a frame's chunks stop for this long, whatever is still missing is requested (again), keep it above the pacing gaps
+		std::uint32_t nack_reorder_margin=16; // chunks a gap may trail the newest chunk before it's requested
+		bool inline_assembly=false; // the io thread places chunks and flips frames as they arrive, on_mode_set, on_chunk and on_frame run there too, set before start()
+		chunk_validator::reorder_settings reorder; // how long a frame waits for its stragglers while later ones arrive, set before start()
+
+		struct nack_statistics
+		{
+			std::uint64_t nacks=0;
+			std::uint64_t chunks=0;
+		} nack_stats; // updated on the io thread
+
+		static const std::uint32_t max_nack_chunks=256;
 		bool frame_pending=false;
 		bool buffers_flipped=false;
-		bool frame_pending_processing=false;
 
 		static const auto seq_diff_out_of_range=std::numeric_limits<std::uint32_t>::max()/2;
 
 		frame_receiver(socket_wrapper &sw);
 
+		void start();
+
+		// consumer thread: waits for packets completing a frame, process_packets() then flips it to front_buffer
+		// with inline_assembly it waits for a frame acquire_frame() hasn't returned yet
 		void wait_for_frame();
+		bool wait_for_frame(std::chrono::steady_clock::duration timeout); // false if no frame completed in time
+
+		// consumer thread: processes the packets at hand without waiting, true if front_buffer holds a frame newer than when it last returned true
+		bool acquire_frame();
+		bool acquire_frame(std::chrono::steady_clock::duration timeout); // waits for one if there's none yet
+
+		// front_buffer only changes in acquire_frame() and process_packets(), other threads reading it hold this
 		std::unique_lock<std::mutex> lock_front_buffer();
-		boost::optional<std::uint32_t> get_front_frame_id() const;
+		boost::optional<std::uint32_t> get_front_frame_id() const; // any thread
 
 	protected:
 		void packet_handler(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint) override;
+		void packets_handler(const std::vector<received_packet> &batch) override;
+		int receive_slots(int count, std::array<boost::asio::mutable_buffer, max_batch_size> &slots) override;
+		bool packets_due() const override;
 
 	private:
 		void init();
 
-		void flip_buffers();
+		bool frame_ready() const;
+		void wake_consumer();
+		void flip_buffers(std::uint32_t frame_id);
+		void track_chunk(const remote_chunk_header &header);
+		bool copy_forward();
 
 		void expire(boost::optional<std::uint32_t> &seq_id);
 		bool check_new(boost::optional<std::uint32_t> &stored_seq_id, std::uint32_t new_seq_id);
 
+		// packets are only handed over with a completed frame, the io thread locks m just to wake a consumer that sleeps
+		std::uint32_t frames_unpublished=0; // io thread's, completed in the buffer it fills
+		std::atomic<std::uint32_t> frames_flipped{ 0 };
+		std::uint32_t frames_acquired=0; // consumer's
+		std::atomic<bool> consumer_waiting{ false };
 		std::condition_variable cv;
 		std::mutex m;
+		std::atomic<std::int64_t> front_frame_id{ -1 }; // -1 before the first frame
+
+		// inline the io thread hands frames over through a third buffer, it never waits for the consumer to finish one
+		frame_data_managed ready_buffer;
+		std::mutex ready_mutex; // only held for swaps
+		std::uint32_t ready_frame_id=0;
 		chunk_validator live_chunk_validator;
 		chunk_validator processed_chunk_validator;
+
+		boost::asio::high_resolution_timer nack_timer;
+		bool nack_timer_armed=false;
+		boost::optional<std::uint32_t> nack_frame_id;
+		std::uint32_t nack_checked=0; // chunks below were requested already, or arrived
+		std::uint32_t highest_chunk_id=0;
+		std::chrono::steady_clock::time_point last_chunk_time;
+		boost::asio::ip::udp::endpoint nack_endpoint;
+		std::vector<std::uint32_t> nack_chunks;
+		std::uint32_t nack_fec_group_size=0;
+		std::vector<bool> parity_received; // by fec group
+
+		struct chunk_rect
+		{
+			std::uint32_t x=0;
+			std::uint32_t y=0;
+			std::uint32_t width=0;
+			std::uint32_t height=0;
+		};
+
+		// flips only swap the buffers, the back buffer then catches up on chunks the newest frame changed and the next one didn't
+		// each buffer's generations stay with its slot, which moves along with it
+		std::uint32_t generation=1; // of the frame being assembled, 0 marks chunks never written
+		std::array<std::vector<std::uint32_t>, 3> generations; // by slot and chunk_id, the frame a buffer's chunk came from
+		std::array<bool, 3> stale_slots{}; // missed a full copy, caught up wholly once back
+		int back_slot=0;
+		int front_slot=1;
+		int ready_slot=2;
+		int latest_slot=1; // the newest frame's, the io thread reads it while the consumer may too
+		frame_data latest; // the newest frame, front_buffer's or ready_buffer's or the consumer's by now
+		std::vector<chunk_rect> chunk_rects;
+		bool chunks_tracked=true; // false once a chunk_id moved or the mode changed, the next flip copies the whole frame
+		bool chunk_placed=false; // the default on_chunk's result, a chunk that didn't land keeps its region copied forward
+		std::vector<std::uint8_t> decoded_chunk; // compressed chunks are decoded here before they're placed
+
+		void track_missing_chunks(const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint);
+		void request_missing_chunks(std::uint32_t begin, std::uint32_t end);
+		void select_nack_frame(std::uint32_t frame_id);
+		bool fec_recoverable(std::uint32_t chunk_id) const;
+		void nack_timeout();
+		void arm_nack_timer(std::chrono::steady_clock::duration wait);
+
+		// gives up frames waiting in the reorder window when the stream stalls
+		boost::asio::high_resolution_timer reorder_timer;
+		bool reorder_timer_armed=false;
+
+		void arm_reorder_timer();
+	};
+
+	// receives one stream on several io threads, each with its own socket, and places chunks straight into back_buffer
+	// chunks cover disjoint regions of a frame, the threads only meet to begin, complete and flip one
+	// there's no FEC or NACKs, and a frame needs a mode header to be sized by
+	struct sharded_receiver
+	{
+		frame_data_managed back_buffer;
+		frame_data_managed front_buffer;
+		int batch_size=32; // datagrams per recvmmsg on each shard
+
+		std::function<void(const remote_chunk_header &header)> on_chunk_placed; // io threads, before the chunk counts towards its frame, flips wait for it
+
+		struct statistics
+		{
+			std::uint64_t frames=0;
+			std::uint64_t chunks=0;
+			std::uint64_t dropped=0; // chunks without a frame to go to, or not fitting it
+		};
+
+		// with reuse_port every shard binds its own SO_REUSEPORT socket, the kernel then spreads flows over them, not the datagrams of one flow
+		// otherwise the shards share one socket and take turns draining it
+		sharded_receiver(int shards, bool reuse_port=false);
+		~sharded_receiver();
+
+		void bind(const boost::asio::ip::udp::endpoint &endpoint);
+		void bind(const std::string &endpoint);
+		boost::asio::ip::udp::endpoint local_endpoint() const;
+
+		void start();
+		void stop();
+
+		// true if a newer frame reached front_buffer since the last call, never waits for the io threads
+		bool acquire_frame();
+		bool acquire_frame(std::chrono::steady_clock::duration timeout); // waits for one if there's none yet
+
+		// flips happen on the io threads, hold it while reading front_buffer
+		std::unique_lock<std::mutex> lock_front_buffer();
+
+		statistics get_stats() const;
+
+	private:
+		struct shard;
+
+		static const std::uint64_t idle=~std::uint64_t(0);
+
+		int shard_count;
+		bool reuse_port;
+		std::vector<std::unique_ptr<shard>> shards;
+
+		std::mutex assembly_mutex; // beginning, completing and flipping frames and mode changes
+		std::atomic<std::uint64_t> assembling{ idle }; // frame_id the shards may place chunks of
+		std::unique_ptr<std::atomic<std::uint64_t>[]> chunks_received; // bitmap by chunk_id, sized by the mode
+		std::size_t chunk_words=0;
+		int chunk_columns=0; // the mode's grid, chunk_id runs along its rows
+		int chunk_rows=0;
+		std::atomic<std::uint32_t> chunks_count{ 0 };
+		std::atomic<std::uint32_t> chunks_expected{ 0 };
+		boost::optional<std::uint32_t> last_frame_id;
+		std::chrono::steady_clock::time_point last_frame_time;
+		boost::optional<std::uint32_t> last_mode_set;
+		chunk_layout layout=chunk_layout::tiles;
+		bool back_synced=false; // back_buffer matches front_buffer, which delta frames build on
+
+		std::mutex front_buffer_mutex;
+		std::atomic<std::uint32_t> frames_flipped{ 0 };
+		std::uint32_t frames_acquired=0;
+		std::atomic<bool> consumer_waiting{ false };
+		std::condition_variable cv;
+		std::mutex m;
+
+		std::atomic<std::uint64_t> frames{ 0 };
+		std::atomic<std::uint64_t> chunks{ 0 };
+		std::atomic<std::uint64_t> dropped{ 0 };
+
+		void on_packet(shard &s, const std::uint8_t *data_begin, const std::uint8_t *data_end);
+		void set_mode(const remote_mode_header &rmh);
+		bool begin_frame(const remote_chunk_header &rch);
+		void complete_frame(std::uint32_t frame_id);
+		void quiesce(std::uint64_t frame_id);
+		void copy_missing_chunks();
+		void flip_buffers();
 	};
 }
 
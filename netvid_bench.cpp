@@ -0,0 +1,804 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "check.h"
+#include "protocol.h"
+#include "net.h"
+#include "pixel_convert.h"
+
+using namespace boost;
+using namespace boost::asio;
+using namespace boost::asio::ip;
+namespace po=boost::program_options;
+
+typedef std::chrono::steady_clock bench_clock_t;
+
+struct bench_options
+{
+	int width;
+	int height;
+	int bpp;
+	int frames;
+	bool zero_copy;
+	bool strips;
+	bool delta;
+	bool compress;
+	bool retro;
+	double rate_mbit;
+	int burst_bytes;
+	double frame_interval_ms;
+	bool kernel_pacing;
+	std::vector<int> batches;
+	std::vector<int> recv_batches;
+	std::vector<int> fec_groups;
+	std::vector<int> shards;
+	int send_threads;
+	bool reuse_port;
+};
+
+static frame_data_managed make_test_frame(const bench_options &opt)
+{
+	frame_data_managed f;
+
+	f.resize(opt.width, opt.height, opt.bpp);
+
+	for (int y=0; y<f.height; ++y)
+	{
+		for (int x=0; x<f.pitch; ++x)
+			f.data[y*f.pitch+x]=std::uint8_t(x^y);
+	}
+
+	if (!opt.retro)
+		return f;
+
+	// console-like content: a flat backdrop with 8x8 tiles from a small palette over the lower half
+	int pixel_bytes=std::max(1, f.bpp/8);
+
+	for (int y=0; y<f.height; ++y)
+	{
+		for (int x=0; x<f.width; ++x)
+		{
+			int tile=(x/8*7+y/8*13)%5;
+			std::uint8_t color=y<f.height/2 ? 0x3c : std::uint8_t(tile*40+((x+y)%8<2 ? 16 : 0));
+
+			std::fill(f.data+y*f.pitch+x*pixel_bytes, f.data+y*f.pitch+(x+1)*pixel_bytes, color);
+		}
+	}
+
+	return f;
+}
+
+static void draw_box(frame_data &f, int left, int top, int size, std::uint8_t value)
+{
+	for (int y=top; y<top+size; ++y)
+		std::fill(f.pixel<std::uint8_t>(left, y), f.pixel<std::uint8_t>(left+size, y), value);
+}
+
+// counts datagrams arriving on a loopback socket until stopped
+struct loopback_sink
+{
+	io_service ios;
+	udp::socket socket;
+	std::atomic<bool> stopped{ false };
+	std::atomic<std::size_t> packets{ 0 };
+	std::atomic<std::size_t> bytes{ 0 };
+	std::thread thread;
+
+	loopback_sink()
+		: socket(ios, udp::endpoint(address_v4::loopback(), 0))
+	{
+		timeval tv={ 0, 100*1000 };
+
+		socket.set_option(socket_base::receive_buffer_size(8*1024*1024));
+		CHECK(setsockopt(socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+
+		thread=std::thread([this]
+		{
+			std::vector<std::uint8_t> buffer(64*1024);
+
+			// plain recv, asio's blocking receive would poll past SO_RCVTIMEO
+			while (!stopped)
+			{
+				auto result=recv(socket.native_handle(), buffer.data(), buffer.size(), 0);
+
+				if (result<0)
+					continue;
+
+				++packets;
+				bytes+=result;
+			}
+		});
+	}
+
+	~loopback_sink()
+	{
+		stopped=true;
+		thread.join();
+	}
+};
+
+static void bench_send(const bench_options &opt)
+{
+	auto f=make_test_frame(opt);
+	int w_div;
+	int h_div;
+
+	std::tie(w_div, h_div)=get_frame_divisions(f.width, f.height, f.bpp, 1400, opt.strips ? chunk_layout::strips : chunk_layout::tiles);
+
+	std::size_t packets_per_frame=1+w_div*h_div;
+
+	std::cout << "send: " << f.width << "x" << f.height << " " << f.bpp << "bpp, " << packets_per_frame << " packets/frame, " << opt.frames << " frames" << (opt.zero_copy ? ", zero-copy" : "") << (opt.strips ? ", strips" : "") << (opt.delta ? ", delta" : "") << (opt.compress ? ", compressed" : "") << std::endl;
+
+	for (auto batch : opt.batches)
+	{
+		loopback_sink sink;
+		netvid::io_service_wrapper io_service;
+		netvid::socket_wrapper socket(io_service.io_service);
+		netvid::sender<netvid::unlimited_sender> s(socket);
+
+		socket.socket.set_option(socket_base::send_buffer_size(8*1024*1024));
+		s.set_remote_endpoint(sink.socket.local_endpoint());
+		s.batch_chunks=batch;
+		s.zero_copy=opt.zero_copy;
+		s.layout=opt.strips ? chunk_layout::strips : chunk_layout::tiles;
+		s.delta=opt.delta;
+		s.compress=opt.compress;
+		io_service.run();
+
+		auto start=bench_clock_t::now();
+
+		for (int i=0; i<opt.frames; ++i)
+		{
+			std::promise<void> pr;
+			auto future=pr.get_future();
+
+			// desktop-like content for delta runs: a small box moving over a static background
+			if (opt.delta)
+				draw_box(f, (i*16)%(f.width-64), (i*8)%(f.height-64), 64, std::uint8_t(i));
+
+			io_service.io_service.post([&] { s.send(f, pr); });
+			future.wait();
+		}
+
+		std::chrono::duration<double> elapsed=bench_clock_t::now()-start;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+		// delta frames vary in size, count what arrived instead
+		auto sent=opt.delta ? sink.packets.load() : packets_per_frame*opt.frames;
+
+		std::cout << "  batch " << std::setw(5) << batch << ": "
+			<< std::fixed << std::setprecision(0) << sent/elapsed.count() << " packets/s sent, "
+			<< std::setprecision(1) << opt.frames/elapsed.count() << " frames/s, "
+			<< sink.packets << "/" << sent << " received, "
+			<< std::setprecision(1) << double(sink.packets)/opt.frames << " packets/frame" << std::endl;
+	}
+}
+
+static void bench_recv(const bench_options &opt)
+{
+	auto f=make_test_frame(opt);
+
+	std::cout << "recv: " << f.width << "x" << f.height << " " << f.bpp << "bpp, " << opt.frames << " frames" << std::endl;
+
+	for (auto batch : opt.recv_batches)
+	{
+		netvid::io_service_wrapper recv_service;
+		netvid::socket_wrapper recv_socket(recv_service.io_service);
+		netvid::receiver r(recv_socket);
+
+		recv_socket.bind(udp::endpoint(address_v4::loopback(), 0));
+		recv_socket.socket.set_option(socket_base::receive_buffer_size(8*1024*1024));
+		r.batch_size=batch;
+		r.start();
+		recv_service.run();
+
+		netvid::io_service_wrapper send_service;
+		netvid::socket_wrapper send_socket(send_service.io_service);
+		netvid::sender<netvid::unlimited_sender> s(send_socket);
+
+		s.set_remote_endpoint(recv_socket.socket.local_endpoint());
+		s.batch_chunks=0;
+		send_service.run();
+
+		auto start=bench_clock_t::now();
+
+		for (int i=0; i<opt.frames; ++i)
+		{
+			std::promise<void> pr;
+			auto future=pr.get_future();
+
+			send_service.io_service.post([&] { s.send(f, pr); });
+			future.wait();
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+		std::promise<netvid::receiver::statistics> stats_promise;
+
+		recv_service.io_service.post([&] { stats_promise.set_value(r.stats); });
+
+		auto stats=stats_promise.get_future().get();
+		std::chrono::duration<double> elapsed=bench_clock_t::now()-start;
+
+		recv_service.io_service.stop();
+
+		std::cout << "  batch " << std::setw(5) << batch << ": "
+			<< std::fixed << std::setprecision(0) << stats.packets/elapsed.count() << " packets/s received, "
+			<< std::setprecision(1) << stats.average_batch_size() << " average batch size" << std::endl;
+	}
+}
+
+// the datagrams of one frame as the sender puts them on the wire, mode header first
+static std::vector<std::vector<std::uint8_t>> capture_frame(const bench_options &opt, const frame_data &f)
+{
+	int w_div;
+	int h_div;
+
+	std::tie(w_div, h_div)=get_frame_divisions(f.width, f.height, f.bpp, 1400, opt.strips ? chunk_layout::strips : chunk_layout::tiles);
+
+	std::size_t packets_per_frame=1+w_div*h_div;
+	std::vector<std::vector<std::uint8_t>> datagrams;
+	io_service ios;
+	udp::socket capture(ios, udp::endpoint(address_v4::loopback(), 0));
+	timeval tv={ 0, 200*1000 };
+
+	capture.set_option(socket_base::receive_buffer_size(8*1024*1024));
+	CHECK(setsockopt(capture.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+
+	std::thread capture_thread([&]
+	{
+		std::vector<std::uint8_t> buffer(64*1024);
+
+		while (datagrams.size()<packets_per_frame)
+		{
+			auto result=recv(capture.native_handle(), buffer.data(), buffer.size(), 0);
+
+			if (result<0)
+				break;
+
+			datagrams.emplace_back(buffer.begin(), buffer.begin()+result);
+		}
+	});
+
+	{
+		// paced, so the capture keeps up
+		netvid::io_service_wrapper io_service;
+		netvid::socket_wrapper socket(io_service.io_service);
+		netvid::sender<netvid::rate_limited_sender> s(socket);
+		std::promise<void> pr;
+		auto future=pr.get_future();
+
+		s.set_remote_endpoint(capture.local_endpoint());
+		s.layout=opt.strips ? chunk_layout::strips : chunk_layout::tiles;
+		s.compress=opt.compress;
+		s.max_rate_bytes=200*1000*1000;
+		io_service.run();
+		io_service.io_service.post([&] { s.send(f, pr); });
+		future.wait();
+	}
+
+	capture_thread.join();
+
+	if (datagrams.size()!=packets_per_frame)
+		throw std::runtime_error("Captured "+std::to_string(datagrams.size())+" of "+std::to_string(packets_per_frame)+" datagrams");
+
+	return datagrams;
+}
+
+// replays a captured frame from several threads, each sending every send_threads-th chunk over its own socket, into a sharded_receiver
+static void bench_shards(const bench_options &opt)
+{
+	auto f=make_test_frame(opt);
+	auto datagrams=capture_frame(opt, f);
+	int send_threads=std::max(1, opt.send_threads);
+
+	std::cout << "shards: " << f.width << "x" << f.height << " " << f.bpp << "bpp, " << datagrams.size() << " packets/frame, " << opt.frames << " frames, "
+		<< send_threads << " send threads" << (opt.reuse_port ? ", SO_REUSEPORT sockets" : ", one shared socket") << ", " << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+	for (auto shard_count : opt.shards)
+	{
+		netvid::sharded_receiver r(shard_count, opt.reuse_port);
+
+		r.bind(udp::endpoint(address_v4::loopback(), 0));
+		r.batch_size=opt.recv_batches.empty() ? 32 : opt.recv_batches.back();
+		r.start();
+
+		// the threads move on to the next frame together, or the receiver would see frames interleaved
+		std::mutex frame_mutex;
+		std::condition_variable frame_cv;
+		int frame=0;
+		int finished=0;
+		std::vector<std::thread> threads;
+		auto start=bench_clock_t::now();
+
+		for (int t=0; t<send_threads; ++t)
+		{
+			threads.emplace_back([&, t]
+			{
+				io_service ios;
+				udp::socket socket(ios, udp::endpoint(address_v4::loopback(), 0));
+				std::vector<std::vector<std::uint8_t>> slice;
+
+				socket.set_option(socket_base::send_buffer_size(8*1024*1024));
+				socket.connect(r.local_endpoint());
+
+				for (std::size_t i=t==0 ? 0 : 1; i<datagrams.size(); ++i)
+				{
+					if (i==0 || (i-1)%send_threads==std::size_t(t))
+						slice.push_back(datagrams[i]);
+				}
+
+				for (int n=0; n<opt.frames; ++n)
+				{
+					for (auto &d : slice)
+					{
+						auto &rh=*reinterpret_cast<remote_header *>(d.data());
+
+						if (pkt_type(rh.pkt_id)==remote_chunk_header().pkt_id)
+							reinterpret_cast<remote_chunk_header *>(d.data())->frame_id=n+1;
+						else
+							rh.seq_id=n+1;
+
+						send(socket.native_handle(), d.data(), d.size(), 0);
+					}
+
+					std::unique_lock<std::mutex> l(frame_mutex);
+
+					if (++finished==send_threads)
+					{
+						finished=0;
+						++frame;
+						frame_cv.notify_all();
+					}
+					else
+						frame_cv.wait(l, [&] { return frame>n; });
+				}
+			});
+		}
+
+		for (auto &thread : threads)
+			thread.join();
+
+		std::chrono::duration<double> elapsed=bench_clock_t::now()-start;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		r.stop();
+
+		auto stats=r.get_stats();
+		std::size_t chunks_sent=(datagrams.size()-1)*opt.frames;
+
+		std::cout << "  shards " << std::setw(3) << shard_count << ": "
+			<< std::fixed << std::setprecision(0) << stats.chunks/elapsed.count() << " chunks/s placed, "
+			<< std::setprecision(1) << stats.frames/elapsed.count() << " frames/s, "
+			<< 100.0*stats.chunks/chunks_sent << "% of chunks received" << std::endl;
+	}
+}
+
+static void bench_pace(const bench_options &opt)
+{
+	auto f=make_test_frame(opt);
+	double target=opt.rate_mbit*1000*1000/8;
+
+	std::cout << "pace: " << f.width << "x" << f.height << " " << f.bpp << "bpp, " << opt.frames << " frames, " << opt.rate_mbit << " Mbit/s, burst " << opt.burst_bytes << " bytes";
+
+	if (opt.frame_interval_ms>0)
+		std::cout << ", " << opt.frame_interval_ms << " ms/frame";
+
+	std::cout << (opt.kernel_pacing ? ", kernel pacing" : "") << (opt.compress ? ", compressed" : "") << std::endl;
+
+	for (auto batch : opt.batches)
+	{
+		loopback_sink sink;
+		netvid::io_service_wrapper io_service;
+		netvid::socket_wrapper socket(io_service.io_service);
+		netvid::sender<netvid::rate_limited_sender> s(socket);
+
+		socket.socket.set_option(socket_base::send_buffer_size(8*1024*1024));
+		s.set_remote_endpoint(sink.socket.local_endpoint());
+		s.batch_chunks=batch;
+		s.layout=opt.strips ? chunk_layout::strips : chunk_layout::tiles;
+		s.compress=opt.compress;
+		s.max_rate_bytes=target;
+		s.burst_bytes=opt.burst_bytes;
+		s.frame_interval=std::chrono::microseconds(static_cast<std::int64_t>(opt.frame_interval_ms*1000));
+		s.kernel_pacing=opt.kernel_pacing;
+		io_service.run();
+
+		std::vector<double> frame_times;
+		auto start=bench_clock_t::now();
+
+		for (int i=0; i<opt.frames; ++i)
+		{
+			std::promise<void> pr;
+			auto future=pr.get_future();
+			auto frame_start=bench_clock_t::now();
+
+			io_service.io_service.post([&] { s.send(f, pr); });
+			future.wait();
+
+			frame_times.push_back(std::chrono::duration<double, std::milli>(bench_clock_t::now()-frame_start).count());
+		}
+
+		std::chrono::duration<double> elapsed=bench_clock_t::now()-start;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+		auto minmax=std::minmax_element(frame_times.begin(), frame_times.end());
+
+		std::cout << "  batch " << std::setw(5) << batch << ": "
+			<< std::fixed << std::setprecision(1) << sink.bytes*8/elapsed.count()/1000/1000 << " Mbit/s ("
+			<< 100*sink.bytes/elapsed.count()/target << "% of target), "
+			<< *minmax.first << "-" << *minmax.second << " ms/frame, "
+			<< opt.frames/elapsed.count() << " frames/s, "
+			<< sink.packets << " packets received" << std::endl;
+	}
+}
+
+// rle coding of each chunk of the frame, as the sender and frame_receiver do it
+static void bench_codec(const bench_options &opt)
+{
+	auto f=make_test_frame(opt);
+	int w_div;
+	int h_div;
+
+	std::tie(w_div, h_div)=get_frame_divisions(f.width, f.height, f.bpp, 1400, opt.strips ? chunk_layout::strips : chunk_layout::tiles);
+
+	if (f.bpp%8!=0)
+		throw std::invalid_argument("Only whole-byte pixels are compressed");
+
+	frame_data_managed decoded;
+	std::vector<std::uint8_t> encoded;
+	std::size_t raw_bytes=0;
+	std::size_t decoded_bytes=0;
+	std::size_t sent_bytes=0;
+	std::size_t raw_chunks=0;
+	std::chrono::duration<double> encode_time{ 0 };
+	std::chrono::duration<double> decode_time{ 0 };
+
+	decoded.resize(f.width, f.height, f.pitch, f.bpp);
+
+	for (int i=0; i<opt.frames; ++i)
+	{
+		for (int row=0; row<h_div; ++row)
+		{
+			for (int col=0; col<w_div; ++col)
+			{
+				int top;
+				int left;
+				int bottom;
+				int right;
+
+				std::tie(top, left, bottom, right)=get_chunk(f.width, f.height, w_div, h_div, row, col);
+
+				std::size_t row_bytes=(right-left)*f.bpp/8;
+				std::size_t rows=bottom-top;
+				std::size_t unit=netvid::codec_unit_size(f.bpp, row_bytes);
+				std::size_t chunk_bytes=row_bytes*rows;
+
+				encoded.resize(chunk_bytes-chunk_bytes/16);
+
+				auto encode_start=bench_clock_t::now();
+				auto size=netvid::rle_encode(f.pixel<std::uint8_t>(left, top), f.pitch, row_bytes, rows, unit, encoded.data(), encoded.size());
+
+				encode_time+=bench_clock_t::now()-encode_start;
+				raw_bytes+=chunk_bytes;
+
+				if (size==0)
+				{
+					++raw_chunks;
+					sent_bytes+=chunk_bytes;
+
+					for (int y=top; y<bottom; ++y)
+						std::copy(f.pixel<std::uint8_t>(left, y), f.pixel<std::uint8_t>(right, y), decoded.pixel<std::uint8_t>(left, y));
+
+					continue;
+				}
+
+				sent_bytes+=size;
+				decoded_bytes+=chunk_bytes;
+
+				auto decode_start=bench_clock_t::now();
+
+				if (!netvid::rle_decode(encoded.data(), size, decoded.pixel<std::uint8_t>(left, top), decoded.pitch, row_bytes, rows, unit))
+					throw std::runtime_error("Failed to decode chunk");
+
+				decode_time+=bench_clock_t::now()-decode_start;
+			}
+		}
+	}
+
+	if (!std::equal(f.data, f.end(), decoded.data))
+		throw std::runtime_error("Decoded frame differs");
+
+	std::cout << "codec: " << f.width << "x" << f.height << " " << f.bpp << "bpp, " << w_div*h_div << " chunks/frame, " << opt.frames << " frames" << (opt.strips ? ", strips" : "") << (opt.retro ? ", retro content" : "") << std::endl;
+	std::cout << "  " << std::fixed << std::setprecision(1) << 100.0*sent_bytes/raw_bytes << "% of raw size, "
+		<< 100.0*raw_chunks/(w_div*h_div*opt.frames) << "% of chunks sent raw, "
+		<< raw_bytes/encode_time.count()/1000/1000 << " MB/s encode, "
+		<< decoded_bytes/std::max(decode_time.count(), 1e-9)/1000/1000 << " MB/s decode, "
+		<< std::setprecision(3) << 1000*encode_time.count()/opt.frames << " ms/frame encode" << std::endl;
+}
+
+// xor parity cost on prebuilt chunk datagrams, one chunk of each group lost on the way
+static void bench_fec(const bench_options &opt)
+{
+	auto f=make_test_frame(opt);
+	auto layout=opt.strips ? chunk_layout::strips : chunk_layout::tiles;
+	int w_div;
+	int h_div;
+
+	std::tie(w_div, h_div)=get_frame_divisions(f.width, f.height, f.bpp, 1400, layout);
+
+	std::uint32_t total_chunks=w_div*h_div;
+	std::vector<std::vector<std::uint8_t>> chunks;
+	std::size_t frame_bytes=0;
+
+	for (int row=0; row<h_div; ++row)
+	{
+		for (int col=0; col<w_div; ++col)
+		{
+			int top;
+			int left;
+			int bottom;
+			int right;
+			remote_chunk_header rch;
+
+			std::tie(top, left, bottom, right)=get_chunk(f.width, f.height, w_div, h_div, row, col);
+
+			rch.x=left;
+			rch.y=top;
+			rch.width=right-left;
+			rch.height=bottom-top;
+			rch.bpp=f.bpp;
+			rch.pitch=calc_pitch(rch.width, f.bpp);
+			rch.chunk_id=row*w_div+col;
+			rch.frame_chunks=total_chunks;
+
+			auto header=reinterpret_cast<const std::uint8_t *>(&rch);
+			std::vector<std::uint8_t> chunk(header, header+sizeof(rch));
+
+			for (int y=top; y<bottom; ++y)
+				chunk.insert(chunk.end(), f.pixel<std::uint8_t>(left, y), f.pixel<std::uint8_t>(right, y));
+
+			frame_bytes+=chunk.size();
+			chunks.push_back(std::move(chunk));
+		}
+	}
+
+	std::cout << "fec: " << f.width << "x" << f.height << " " << f.bpp << "bpp, " << total_chunks << " chunks/frame, " << opt.frames << " frames" << (opt.strips ? ", strips" : "") << std::endl;
+
+	for (auto group_size : opt.fec_groups)
+	{
+		if (group_size<1 || group_size>int(netvid::max_fec_group_size))
+			throw std::invalid_argument("Invalid fec group size "+std::to_string(group_size));
+
+		std::uint32_t g=group_size;
+		netvid::parity_encoder encoder;
+		std::vector<netvid::parity_encoder> parity((total_chunks+g-1)/g);
+		netvid::fec_decoder decoder;
+		std::chrono::duration<double, std::milli> encode_time{ 0 };
+		std::chrono::duration<double, std::milli> decode_time{ 0 };
+		std::size_t parity_bytes=0;
+
+		decoder.group_size=g;
+
+		for (int i=0; i<opt.frames; ++i)
+		{
+			auto encode_start=bench_clock_t::now();
+
+			for (std::uint32_t id=0; id<total_chunks; ++id)
+			{
+				auto &chunk=chunks[id];
+
+				if (encoder.empty())
+					encoder.reset(i, id);
+
+				reinterpret_cast<remote_chunk_header *>(chunk.data())->frame_id=i;
+				encoder.add(id, std::array<boost::asio::const_buffer, 1>{ { asio::buffer(chunk) } });
+
+				if ((id+1)%g!=0 && id+1<total_chunks)
+					continue;
+
+				std::swap(encoder, parity[id/g]);
+				encoder.reset(i, 0);
+			}
+
+			encode_time+=bench_clock_t::now()-encode_start;
+
+			auto decode_start=bench_clock_t::now();
+
+			for (std::uint32_t id=0; id<total_chunks; ++id)
+			{
+				// the middle chunk of each group goes missing
+				if (id%g!=g/2)
+					decoder.process(chunks[id].data(), chunks[id].data()+chunks[id].size());
+
+				if ((id+1)%g!=0 && id+1<total_chunks)
+					continue;
+
+				std::vector<std::uint8_t> packet;
+
+				for (const auto &b : parity[id/g].packet())
+					packet.insert(packet.end(), asio::buffer_cast<const std::uint8_t *>(b), asio::buffer_cast<const std::uint8_t *>(b)+asio::buffer_size(b));
+
+				parity_bytes+=packet.size();
+				decoder.process(packet.data(), packet.data()+packet.size());
+			}
+
+			decode_time+=bench_clock_t::now()-decode_start;
+		}
+
+		std::cout << "  group " << std::setw(3) << g << ": "
+			<< std::fixed << std::setprecision(1) << 100.0*parity_bytes/opt.frames/frame_bytes << "% overhead, "
+			<< std::setprecision(3) << encode_time.count()/opt.frames << " ms/frame encode, "
+			<< decode_time.count()/opt.frames << " ms/frame decode, "
+			<< decoder.stats.recovered << " recovered, " << decoder.stats.unrecoverable << " unrecoverable" << std::endl;
+	}
+}
+
+template<class src_type, class dst_type>
+static void bench_convert_pair(const bench_options &opt, const char *src_name, const pixel_format<src_type> &src_fmt, const char *dst_name, const pixel_format<dst_type> &dst_fmt)
+{
+	bench_options src_opt=opt;
+
+	src_opt.bpp=src_fmt.bits();
+
+	auto src=make_test_frame(src_opt);
+	frame_data_managed dst;
+
+	dst.resize(src.width, src.height, dst_fmt.bits());
+
+	for (auto kernel : { pixel_kernel::scalar, pixel_kernel::sse2, pixel_kernel::avx2 })
+	{
+		if (!pixel_kernel_supported(kernel))
+			continue;
+
+		auto start=bench_clock_t::now();
+
+		for (int i=0; i<opt.frames; ++i)
+			convert_frame(src_fmt, src, dst_fmt, dst, kernel);
+
+		std::chrono::duration<double> elapsed=bench_clock_t::now()-start;
+
+		std::cout << "  " << std::setw(8) << src_name << " -> " << std::setw(8) << dst_name << " " << std::setw(6) << pixel_kernel_name(kernel) << ": "
+			<< std::fixed << std::setprecision(1) << double(src.width)*src.height*opt.frames/elapsed.count()/1000/1000 << " Mpixels/s, "
+			<< std::setprecision(3) << 1000*elapsed.count()/opt.frames << " ms/frame" << std::endl;
+	}
+}
+
+// batch pixel format conversion between the known formats with each kernel the cpu runs
+static void bench_convert(const bench_options &opt)
+{
+	std::cout << "convert: " << opt.width << "x" << opt.height << ", " << opt.frames << " frames, best kernel " << pixel_kernel_name(best_pixel_kernel()) << std::endl;
+
+	bench_convert_pair(opt, "a1r5g5b5", fmt_a1r5g5b5, "r5g6b5", fmt_r5g6b5);
+	bench_convert_pair(opt, "a1r5g5b5", fmt_a1r5g5b5, "a8r8g8b8", fmt_a8r8g8b8);
+	bench_convert_pair(opt, "r5g6b5", fmt_r5g6b5, "a1r5g5b5", fmt_a1r5g5b5);
+	bench_convert_pair(opt, "r5g6b5", fmt_r5g6b5, "a8r8g8b8", fmt_a8r8g8b8);
+	bench_convert_pair(opt, "a8r8g8b8", fmt_a8r8g8b8, "a1r5g5b5", fmt_a1r5g5b5);
+	bench_convert_pair(opt, "a8r8g8b8", fmt_a8r8g8b8, "r5g6b5", fmt_r5g6b5);
+}
+
+// srgb transfer functions over a frame's worth of linear pixels, std::pow per channel against the batch kernels
+static void bench_transfer(const bench_options &opt)
+{
+	std::size_t pixels=std::size_t(opt.width)*opt.height;
+	std::vector<std::array<float, 3>> src(pixels);
+	std::vector<std::array<float, 3>> dst(pixels);
+
+	for (std::size_t i=0; i<pixels; ++i)
+		src[i]={ { (i%256)/255.f, (i/256%256)/255.f, (i*7%256)/255.f } };
+
+	std::cout << "transfer: " << opt.width << "x" << opt.height << ", " << opt.frames << " frames" << std::endl;
+
+	auto report=[&] (const char *name, const char *kernel, const std::function<void()> &run)
+	{
+		auto start=bench_clock_t::now();
+
+		for (int i=0; i<opt.frames; ++i)
+			run();
+
+		std::chrono::duration<double> elapsed=bench_clock_t::now()-start;
+
+		std::cout << "  " << std::setw(9) << name << " " << std::setw(9) << kernel << ": "
+			<< std::fixed << std::setprecision(1) << double(pixels)*opt.frames/elapsed.count()/1000/1000 << " Mpixels/s, "
+			<< std::setprecision(3) << 1000*elapsed.count()/opt.frames << " ms/frame" << std::endl;
+	};
+
+	report("to_linear", "reference", [&] { std::transform(src.begin(), src.end(), dst.begin(), [] (const std::array<float, 3> &c) { return to_linear(c); }); });
+	report("to_srgb", "reference", [&] { std::transform(src.begin(), src.end(), dst.begin(), [] (const std::array<float, 3> &c) { return to_srgb(c); }); });
+
+	for (auto kernel : { pixel_kernel::scalar, pixel_kernel::sse2, pixel_kernel::avx2 })
+	{
+		if (!pixel_kernel_supported(kernel))
+			continue;
+
+		report("to_linear", pixel_kernel_name(kernel), [&] { to_linear(src[0].data(), dst[0].data(), 3*pixels, kernel); });
+		report("to_srgb", pixel_kernel_name(kernel), [&] { to_srgb(src[0].data(), dst[0].data(), 3*pixels, kernel); });
+	}
+
+	std::vector<std::uint16_t> packed(pixels);
+
+	for (std::size_t i=0; i<pixels; ++i)
+		packed[i]=std::uint16_t(i*2654435761u >> 16);
+
+	report("r5g6b5", "table", [&] { pixels_to_linear(fmt_r5g6b5, packed.data(), dst.data(), pixels); });
+	report("r5g6b5", pixel_kernel_name(best_pixel_kernel()), [&] { linear_to_pixels(src.data(), fmt_r5g6b5, packed.data(), pixels); });
+}
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		po::options_description desc("Allowed options");
+		std::string bench;
+		bench_options opt;
+
+		desc.add_options()
+			("help", "produce help message")
+			("bench,b", po::value<std::string>(&bench)->default_value("send"), "benchmark [send, recv, shards, pace, fec, codec, convert, transfer]")
+			("width", po::value<int>(&opt.width)->default_value(1920), "frame width [pixels]")
+			("height", po::value<int>(&opt.height)->default_value(1080), "frame height [pixels]")
+			("bpp", po::value<int>(&opt.bpp)->default_value(32), "bits per pixel")
+			("frames", po::value<int>(&opt.frames)->default_value(30), "frames per run")
+			("zero-copy", po::bool_switch(&opt.zero_copy), "send chunk rows straight from the frame")
+			("strips", po::bool_switch(&opt.strips), "use the full-width strip chunk layout")
+			("delta", po::bool_switch(&opt.delta), "only send changed chunks of mostly static content")
+			("compress", po::bool_switch(&opt.compress), "rle code chunks")
+			("retro", po::bool_switch(&opt.retro), "flat, tiled content instead of noise-like patterns")
+			("batch", po::value<std::vector<int>>(&opt.batches)->multitoken()->default_value({ 1, 16, 64, 0 }, "1 16 64 0"), "chunks per batch [0=whole frame]")
+			("rate", po::value<double>(&opt.rate_mbit)->default_value(90), "pace rate [Mbit/s]")
+			("burst", po::value<int>(&opt.burst_bytes)->default_value(64*1024), "pace burst [bytes]")
+			("frame-interval", po::value<double>(&opt.frame_interval_ms)->default_value(0), "spread frames over [ms, 0=send at full rate]")
+			("kernel-pacing", po::bool_switch(&opt.kernel_pacing), "pace with SO_MAX_PACING_RATE")
+			("recv-batch", po::value<std::vector<int>>(&opt.recv_batches)->multitoken()->default_value({ 1, 8, 32, 64 }, "1 8 32 64"), "datagrams per recvmmsg")
+			("fec-group", po::value<std::vector<int>>(&opt.fec_groups)->multitoken()->default_value({ 4, 8, 16, 32 }, "4 8 16 32"), "chunks per parity packet")
+			("shards", po::value<std::vector<int>>(&opt.shards)->multitoken()->default_value({ 1, 2, 4 }, "1 2 4"), "receive threads of the sharded receiver")
+			("send-threads", po::value<int>(&opt.send_threads)->default_value(4), "threads replaying frames to the sharded receiver")
+			("reuse-port", po::bool_switch(&opt.reuse_port), "shard over SO_REUSEPORT sockets rather than one shared socket")
+			;
+
+		po::variables_map vm;
+
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help"))
+		{
+			std::cout << desc << std::endl;
+
+			return 1;
+		}
+
+		po::notify(vm);
+
+		if (bench=="send")
+			bench_send(opt);
+		else if (bench=="recv")
+			bench_recv(opt);
+		else if (bench=="shards")
+			bench_shards(opt);
+		else if (bench=="pace")
+			bench_pace(opt);
+		else if (bench=="fec")
+			bench_fec(opt);
+		else if (bench=="codec")
+			bench_codec(opt);
+		else if (bench=="convert")
+			bench_convert(opt);
+		else if (bench=="transfer")
+			bench_transfer(opt);
+		else
+			throw std::invalid_argument("Unknown benchmark "+bench);
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
@@ -8,6 +8,7 @@
 #include "check.h"
 #include "protocol.h"
 #include "net.h"
+#include "recording.h"
 
 using namespace boost;
 using namespace boost::asio;
@@ -24,6 +25,8 @@ int main(int argc, char **argv)
 		std::string in_filename;
 		double speed;
 		int seek;
+		double seek_time;
+		int reorder_window;
 		int stop;
 
 		desc.add_options()
@@ -32,7 +35,9 @@ int main(int argc, char **argv)
 			("file,f", po::value<std::string>(&in_filename)->required(), "input file [filename]")
 			("speed,s", po::value<double>(&speed)->default_value(1), "speed [real, 1=normal speed]")
 			("seek", po::value<int>(&seek)->default_value(0), "seek [frame]")
+			("seek-time", po::value<double>(&seek_time)->default_value(0), "seek [s]")
 			("stop", po::value<int>(&stop)->default_value(-1), "stop [frame]")
+			("reorder-window", po::value<int>(&reorder_window)->default_value(2), "frames in flight, chunks of later ones may overtake the current [1=none]")
 			;
 
 		po::variables_map vm;
@@ -51,34 +56,21 @@ int main(int argc, char **argv)
 		netvid::io_service_wrapper io_service;
 		netvid::socket_wrapper socket(io_service.io_service);
 		auto remote_endpoint=socket.string_to_endpoint(vm["send"].as<std::string>());
-		boost::optional<network_clock_t::duration> first_packet_time;
-		std::ifstream ifs_file;
-		std::istream *pifs=&std::cin;
-
-		if (in_filename!="-")
-		{
-			ifs_file.open(in_filename, std::ios::binary);
-			pifs=&ifs_file;
-		}
-
-		std::istream &ifs=*pifs;
+		boost::optional<std::chrono::nanoseconds> first_packet_time;
+		netvid::recording_reader reader(in_filename);
 
 		boost::asio::high_resolution_timer send_timer(io_service.io_service);
 		boost::asio::high_resolution_timer status_timer(io_service.io_service);
 
-		struct packet_t
-		{
-			network_clock_t::duration time;
-			std::string payload;
-		};
-
 		//boost::optional<packet_t> packet_peeked;
 		bool peeked=false;
-		packet_t current_packet;
+		netvid::recorded_packet current_packet;
 
 		netvid::chunk_validator validator;
 		boost::optional<std::uint32_t> last_frame_id;
 
+		validator.reorder.window=reorder_window;
+
 		validator.frame_completed=[&] (auto frame_id)
 		{
 			if (last_frame_id && *last_frame_id+1!=frame_id)
@@ -97,20 +89,10 @@ int main(int argc, char **argv)
 				return true;
 			}
 
-			//network_clock_t::duration packet_time;
-			std::uint32_t payload_size;
-
-			ifs.read(reinterpret_cast<char *>(&current_packet.time), sizeof(current_packet.time));
-			ifs.read(reinterpret_cast<char *>(&payload_size), sizeof(payload_size));
-
-			if (ifs.eof() || ifs.bad() || ifs.fail())
+			if (!reader.read(current_packet))
 				return false;
 
-			current_packet.payload.resize(payload_size);
-
-			ifs.read(&current_packet.payload[0], payload_size);
-
-			validator.process(reinterpret_cast<const std::uint8_t *>(current_packet.payload.data()), reinterpret_cast<const std::uint8_t *>(current_packet.payload.data()+payload_size), boost::asio::ip::udp::endpoint());
+			validator.process(current_packet.data, current_packet.end(), boost::asio::ip::udp::endpoint());
 
 			if (stop>=0 && validator.frame_id && *validator.frame_id>=stop)
 				return false;
@@ -118,6 +100,24 @@ int main(int argc, char **argv)
 			return true;
 		};
 
+		auto seek_to=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(seek_time));
+
+		// indexed recordings start at the frame, or the one before it, the rest is read in order
+		if (seek>0)
+			reader.seek_frame(seek);
+		else if (seek_time>0 && !reader.seek_time(seek_to))
+		{
+			while (process_packet())
+			{
+				if (current_packet.time<seek_to)
+					continue;
+
+				peeked=true;
+
+				break;
+			}
+		}
+
 		for (; seek>0;)
 		{
 			if (!process_packet())
@@ -145,7 +145,7 @@ int main(int argc, char **argv)
 			if (!first_packet_time)
 				first_packet_time=current_packet.time;
 
-			auto next=network_clock_t::duration(static_cast<network_clock_t::duration::rep>((current_packet.time-*first_packet_time).count()/speed));
+			auto next=network_clock_t::duration(static_cast<network_clock_t::duration::rep>(std::chrono::duration_cast<network_clock_t::duration>(current_packet.time-*first_packet_time).count()/speed));
 			auto expire_time=start_time+next;
 
 			send_timer.expires_at(expire_time);
@@ -158,7 +158,7 @@ int main(int argc, char **argv)
 						return;
 					}
 
-					socket.socket.async_send_to(boost::asio::buffer(current_packet.payload), remote_endpoint, [&self] (const boost::system::error_code &error, std::size_t bytes_transferred)
+					socket.socket.async_send_to(boost::asio::buffer(current_packet.data, current_packet.size), remote_endpoint, [&self] (const boost::system::error_code &error, std::size_t bytes_transferred)
 						{
 							if (error)
 							{
@@ -186,7 +186,7 @@ int main(int argc, char **argv)
 			if (last_frame_id)
 				std::cout << "frame: " << *last_frame_id;
 			else
-				std::cout << "bytes: " << ifs.tellg();
+				std::cout << "bytes: " << reader.offset();
 
 			if (first_packet_time)
 			{
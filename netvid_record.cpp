@@ -6,6 +6,7 @@
 #include "check.h"
 #include "protocol.h"
 #include "net.h"
+#include "recording.h"
 
 using namespace boost;
 using namespace boost::asio;
@@ -29,11 +30,21 @@ int main(int argc, char **argv)
 	{
 		po::options_description desc("Allowed options");
 		std::string out_filename;
+		int recv_batch;
+		int compress;
+		int queue_size;
+		bool direct;
+		bool handler_timestamps;
 
 		desc.add_options()
 			("help,h", "produce help message")
 			("recv", po::value<std::string>()->required(), "recv [ip:port]")
 			("file,f", po::value<std::string>(&out_filename)->required(), "output file [filename]")
+			("recv-batch", po::value<int>(&recv_batch)->default_value(32), "datagrams per recvmmsg [1=no batching]")
+			("compress", po::value<int>(&compress)->default_value(-1), "compress blocks of packets with this xz preset on all cores [0-9, -1=off]")
+			("queue-size", po::value<int>(&queue_size)->default_value(64), "packets wait for the writer thread in a queue this large, the rest is dropped [MiB]")
+			("direct", po::bool_switch(&direct), "write the file with O_DIRECT, past the page cache")
+			("handler-timestamps", po::bool_switch(&handler_timestamps), "stamp packets when the receive handler sees them instead of when the kernel received them")
 			;
 
 		po::variables_map vm;
@@ -55,46 +66,68 @@ int main(int argc, char **argv)
 		socket.bind(vm["recv"].as<std::string>());
 
 		netvid::receiver fr(socket);
+
+		fr.batch_size=recv_batch;
+		fr.kernel_timestamps=!handler_timestamps;
 		boost::asio::high_resolution_timer flush_timer(io_service.io_service);
 		auto start_time=network_clock_t::now();
-		std::ofstream ofs_real;
-		std::ostream *pofs=&ofs_real;
-		
+		auto kernel_start_time=std::chrono::system_clock::now().time_since_epoch(); // kernel timestamps are CLOCK_REALTIME
+		std::unique_ptr<netvid::aligned_file_buffer> file_buffer;
+		std::unique_ptr<std::ostream> ofs_file;
+		std::ostream *pofs=&std::cout;
+
 		if (out_filename!="-")
-			ofs_real.open(out_filename, std::ios::binary);
-		else
-			pofs=&std::cout;
+		{
+			file_buffer=std::make_unique<netvid::aligned_file_buffer>(out_filename, direct);
+			ofs_file=std::make_unique<std::ostream>(file_buffer.get());
+			pofs=ofs_file.get();
+
+			if (direct && !file_buffer->is_direct())
+				std::cerr << "O_DIRECT isn't supported for " << out_filename << ", writing through the page cache" << std::endl;
+		}
 
 		std::ostream &ofs=*pofs;
-		std::size_t written=0;
+		netvid::block_compression compression;
 
-		fr.on_live_packet=[&] (const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
-		{
-			auto now=network_clock_t::now();
-			auto diff=now-start_time;
-			std::uint32_t sz=data_end-data_begin;
+		if (compress>=0)
+			compression.preset=std::min(compress, 9);
 
-			ofs.write(reinterpret_cast<const char *>(&diff), sizeof(diff));
-			ofs.write(reinterpret_cast<const char *>(&sz), sizeof(sz));
-			ofs.write(reinterpret_cast<const char *>(data_begin), sz);
+		// start() tells whether the socket stamps packets, which the header records, nothing is received before run()
+		fr.start();
 
-			written+=sizeof(diff);
-			written+=sizeof(sz);
-			written+=sz;
-		};
+		netvid::recording_writer writer(ofs, compression, fr.kernel_timestamps);
+		netvid::write_behind_recorder recorder(writer, std::size_t(std::max(queue_size, 1))*1024*1024);
 
-		fr.start();
+		// stamped by the kernel or here, written (and compressed) on the recorder's thread
+		if (fr.kernel_timestamps)
+		{
+			fr.on_live_received_packet=[&] (const netvid::received_packet &pkt)
+			{
+				auto time=pkt.kernel_time.count() ? pkt.kernel_time : std::chrono::system_clock::now().time_since_epoch();
+
+				recorder.push(std::chrono::duration_cast<std::chrono::nanoseconds>(time-kernel_start_time), pkt.data_begin, pkt.data_end);
+			};
+		}
+		else
+		{
+			fr.on_live_packet=[&] (const std::uint8_t *data_begin, const std::uint8_t *data_end, const boost::asio::ip::udp::endpoint &remote_endpoint)
+			{
+				recorder.push(std::chrono::duration_cast<std::chrono::nanoseconds>(network_clock_t::now()-start_time), data_begin, data_end);
+			};
+		}
+
+		std::cerr << "Packets are stamped " << (fr.kernel_timestamps ? "by the kernel as they arrive" : "by the receive handler") << std::endl;
 
 		auto flush_handler=[&] (auto &self) -> void
 		{
 			using namespace std::chrono_literals;
 
-			ofs.flush();
-			std::cerr << written << " bytes written...\r" << std::flush;
+			std::cerr << recorder.stats.bytes_written << " bytes written, " << recorder.stats.packets << " packets, " << recorder.stats.dropped << " dropped, "
+				<< recorder.stats.queued_high_water/1024 << " KiB queued at most, " << fr.stats.average_batch_size() << " packets/batch...\r" << std::flush;
 
-			if (interrupted)
+			if (interrupted || recorder.stats.write_failed)
 			{
-				std::cerr << std::endl << "Stopping..." << std::endl;
+				std::cerr << std::endl << (interrupted ? "Stopping..." : "Writing failed, stopping...") << std::endl;
 				io_service.io_service.stop();
 
 				return;
@@ -117,10 +150,38 @@ int main(int argc, char **argv)
 		flush_handler(flush_handler);
 
 		io_service.io_service.run();
+
+		// the index goes last, a recording cut short is still readable in order
+		recorder.stop();
+		writer.finish();
+		ofs.flush();
+
+		// a full disk only sets the stream's badbit, the recording is cut short
+		bool failed=recorder.stats.write_failed || !writer.good();
+
+		if (file_buffer && !file_buffer->close())
+			failed=true;
+
+		std::cerr << recorder.stats.packets << " packets recorded, " << recorder.stats.dropped << " dropped, "
+			<< recorder.stats.queued_high_water/1024 << " KiB queued at most" << std::endl;
+
+		if (failed)
+		{
+			std::cerr << "Writing " << out_filename << " failed";
+
+			if (file_buffer && file_buffer->error())
+				std::cerr << ": " << boost::system::system_category().message(file_buffer->error());
+
+			std::cerr << ", the recording is incomplete" << std::endl;
+
+			return 1;
+		}
 	}
 	catch (const std::exception &e)
 	{
 		std::cerr << e.what() << std::endl;
+
+		return 1;
 	}
 
 	return 0;
@@ -8,6 +8,7 @@
 #include "check.h"
 #include "protocol.h"
 #include "net.h"
+#include "recording.h"
 
 using namespace boost;
 using namespace boost::asio;
@@ -24,14 +25,20 @@ int main(int argc, char **argv)
 		std::string in_filename;
 		std::string out_filename;
 		int seek;
+		double seek_time;
+		int reorder_window;
 		int stop;
+		int compress;
 
 		desc.add_options()
 			("help", "produce help message")
 			("input-file,i", po::value<std::string>(&in_filename)->required(), "input file [filename]")
 			("output-file,o", po::value<std::string>(&out_filename)->required(), "output file [filename]")
 			("seek", po::value<int>(&seek)->default_value(0), "seek [frame]")
+			("seek-time", po::value<double>(&seek_time)->default_value(0), "seek [s]")
 			("stop", po::value<int>(&stop)->default_value(-1), "stop [frame]")
+			("reorder-window", po::value<int>(&reorder_window)->default_value(2), "frames in flight, chunks of later ones may overtake the current [1=none]")
+			("compress", po::value<int>(&compress)->default_value(-1), "compress blocks of packets with this xz preset on all cores [0-9, -1=off]")
 			;
 
 		po::variables_map vm;
@@ -47,16 +54,7 @@ int main(int argc, char **argv)
 
 		po::notify(vm);
 
-		std::ifstream ifs_file;
-		std::istream *pifs=&std::cin;
-
-		if (in_filename!="-")
-		{
-			ifs_file.open(in_filename, std::ios::binary);
-			pifs=&ifs_file;
-		}
-
-		std::istream &ifs=*pifs;
+		netvid::recording_reader reader(in_filename);
 
 		std::ofstream ofs_real;
 		std::ostream *pofs=&ofs_real;
@@ -68,17 +66,20 @@ int main(int argc, char **argv)
 
 		std::ostream &ofs=*pofs;
 
-		struct packet_t
-		{
-			network_clock_t::duration time;
-			std::string payload;
-		};
+		netvid::block_compression compression;
 
+		if (compress>=0)
+			compression.preset=std::min(compress, 9);
+
+		// old recordings come out in the indexed format, slicing nothing off converts them
+		netvid::recording_writer writer(ofs, compression, reader.kernel_timestamps());
 		bool peeked=false;
-		packet_t current_packet;
+		netvid::recorded_packet current_packet;
 
 		netvid::chunk_validator validator;
 
+		validator.reorder.window=reorder_window;
+
 		auto process_packet=[&] () -> bool
 		{
 			if (peeked)
@@ -88,19 +89,10 @@ int main(int argc, char **argv)
 				return true;
 			}
 
-			std::uint32_t payload_size;
-
-			ifs.read(reinterpret_cast<char *>(&current_packet.time), sizeof(current_packet.time));
-			ifs.read(reinterpret_cast<char *>(&payload_size), sizeof(payload_size));
-
-			if (ifs.eof() || ifs.bad() || ifs.fail())
+			if (!reader.read(current_packet))
 				return false;
 
-			current_packet.payload.resize(payload_size);
-
-			ifs.read(&current_packet.payload[0], payload_size);
-
-			validator.process(reinterpret_cast<const std::uint8_t *>(current_packet.payload.data()), reinterpret_cast<const std::uint8_t *>(current_packet.payload.data()+payload_size), boost::asio::ip::udp::endpoint());
+			validator.process(current_packet.data, current_packet.end(), boost::asio::ip::udp::endpoint());
 
 			if (stop>=0 && validator.frame_id && *validator.frame_id>=stop)
 				return false;
@@ -108,6 +100,24 @@ int main(int argc, char **argv)
 			return true;
 		};
 
+		auto seek_to=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(seek_time));
+
+		// indexed recordings start at the frame, or the one before it, the rest is read in order
+		if (seek>0)
+			reader.seek_frame(seek);
+		else if (seek_time>0 && !reader.seek_time(seek_to))
+		{
+			while (process_packet())
+			{
+				if (current_packet.time<seek_to)
+					continue;
+
+				peeked=true;
+
+				break;
+			}
+		}
+
 		for (; seek>0;)
 		{
 			if (!process_packet())
@@ -122,13 +132,9 @@ int main(int argc, char **argv)
 		}
 
 		while (process_packet())
-		{
-			auto sz=std::uint32_t(current_packet.payload.size());
+			writer.write(current_packet.time, current_packet.data, current_packet.end());
 
-			ofs.write(reinterpret_cast<const char *>(&current_packet.time), sizeof(current_packet.time));
-			ofs.write(reinterpret_cast<const char *>(&sz), sizeof(sz));
-			ofs.write(reinterpret_cast<const char *>(current_packet.payload.data()), sz);
-		}
+		writer.finish();
 	}
 	catch (const std::exception &e)
 	{
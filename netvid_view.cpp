@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "frame_scaler.h"
+#include "linux_framebuffer.h"
+#include "net.h"
+#include "pixel_convert.h"
+#include "protocol.h"
+
+using namespace boost;
+using namespace boost::asio;
+using namespace boost::asio::ip;
+namespace po=boost::program_options;
+
+typedef std::chrono::steady_clock view_clock_t;
+
+static volatile bool interrupted=false;
+
+void interrupt_handler(int)
+{
+	interrupted=true;
+}
+
+int main(int argc, char **argv)
+{
+	signal(SIGINT, interrupt_handler);
+
+	try
+	{
+		po::options_description desc("Allowed options");
+		std::string fb_path;
+		std::string tty_path;
+		std::string fb_file;
+		std::string format16;
+		int fb_width;
+		int fb_height;
+		int fb_bpp;
+		int recv_batch;
+		int nack_deadline;
+		int reorder_window;
+		int reorder_tolerance;
+		int max_frames;
+		bool no_vsync;
+		bool page_flip;
+		bool inline_assembly;
+
+		desc.add_options()
+			("help,h", "produce help message")
+			("recv", po::value<std::string>()->required(), "recv [ip:port]")
+			("fb", po::value<std::string>(&fb_path)->default_value("/dev/fb0"), "framebuffer device")
+			("tty", po::value<std::string>(&tty_path)->default_value(""), "terminal to keep from blanking [e.g. /dev/tty1]")
+			("fb-file", po::value<std::string>(&fb_file)->default_value(""), "render into this file instead of a device [filename]")
+			("fb-width", po::value<int>(&fb_width)->default_value(1920), "width of the --fb-file screen [pixels]")
+			("fb-height", po::value<int>(&fb_height)->default_value(1080), "height of the --fb-file screen [pixels]")
+			("fb-bpp", po::value<int>(&fb_bpp)->default_value(32), "depth of the --fb-file screen, 16 is r5g6b5 [16, 32]")
+			("format16", po::value<std::string>(&format16)->default_value("r5g6b5"), "layout of 16bpp streams [r5g6b5, a1r5g5b5]")
+			("no-vsync", po::bool_switch(&no_vsync), "present frames as soon as they arrive")
+			("page-flip", po::bool_switch(&page_flip), "draw into a second page and flip to it at vsync")
+			("recv-batch", po::value<int>(&recv_batch)->default_value(32), "datagrams per recvmmsg [1=no batching]")
+			("inline", po::bool_switch(&inline_assembly), "assemble frames on the receive thread as chunks arrive")
+			("nack-deadline", po::value<int>(&nack_deadline)->default_value(0), "request missing chunks for this long [ms, 0=never], keeps 2 frames in flight at least")
+			("reorder-window", po::value<int>(&reorder_window)->default_value(2), "frames in flight, chunks of later ones may overtake the current [1=none]")
+			("reorder-tolerance", po::value<int>(&reorder_tolerance)->default_value(64), "chunks of later frames before the current one is shown with holes")
+			("frames", po::value<int>(&max_frames)->default_value(0), "stop after showing this many frames [0=run until interrupted]")
+			;
+
+		po::variables_map vm;
+
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+
+		if (vm.count("help"))
+		{
+			std::cerr << desc << std::endl;
+
+			return 1;
+		}
+
+		po::notify(vm);
+
+		frame_scaler scaler;
+
+		if (format16=="a1r5g5b5")
+			scaler.format16=fmt_a1r5g5b5;
+		else if (format16!="r5g6b5")
+			throw std::invalid_argument("Unknown 16bpp format "+format16);
+
+		std::unique_ptr<linux_framebuffer> fb;
+
+		if (!fb_file.empty())
+			fb=std::make_unique<linux_framebuffer>(fb_file, fb_width, fb_height, page_flip, fb_bpp);
+		else
+		{
+			fb=std::make_unique<linux_framebuffer>(fb_path, tty_path, page_flip);
+			fb->disable_blanking();
+			fb->hide_cursor();
+			fb->wake_up();
+		}
+
+		// the driver may not have taken the 32bpp asked for
+		if (!frame_scaler::screen_supported(fb->screen))
+			throw std::runtime_error("Unsupported screen depth "+std::to_string(fb->screen.bpp)+"bpp, 16 or 32 is converted");
+
+		netvid::io_service_wrapper io_service;
+		netvid::socket_wrapper socket(io_service.io_service);
+
+		socket.bind(vm["recv"].as<std::string>());
+
+		netvid::frame_receiver fr(socket);
+
+		fr.batch_size=recv_batch;
+		fr.nack_deadline=std::chrono::milliseconds(nack_deadline);
+		fr.inline_assembly=inline_assembly;
+		fr.reorder.window=reorder_window;
+		fr.reorder.tolerance=reorder_tolerance;
+		fr.start();
+		io_service.run();
+
+		std::size_t received=0;
+		std::size_t shown=0;
+		std::size_t skipped=0;
+		std::chrono::duration<double, std::milli> render_time{ 0 };
+		auto status_time=view_clock_t::now();
+
+		while (!interrupted && (max_frames<=0 || int(shown)<max_frames))
+		{
+			using namespace std::chrono_literals;
+
+			if (fr.acquire_frame(100ms))
+			{
+				++received;
+
+				// a single page is drawn right after vsync, racing the beam
+				if (!fb->back_page && !no_vsync)
+					fb->wait_for_vsync();
+
+				auto start=view_clock_t::now();
+
+				// front_buffer only changes in acquire_frame() on this thread, inline frames wait in a buffer of their own meanwhile
+				bool scaled=scaler.scale(fr.front_buffer, fb->back_page ? fb->back_page : fb->screen, fb->channels);
+
+				if (scaled)
+				{
+					render_time+=view_clock_t::now()-start;
+					++shown;
+
+					if (fb->back_page)
+						fb->flip(!no_vsync);
+				}
+				else
+					++skipped;
+			}
+
+			auto now=view_clock_t::now();
+
+			if (now-status_time>=1s)
+			{
+				std::cerr << received << " frames received, " << shown << " shown, " << skipped << " skipped, "
+					<< std::fixed << std::setprecision(3) << render_time.count()/std::max<std::size_t>(shown, 1) << " ms/frame rendering...\r" << std::flush;
+
+				status_time=now;
+			}
+		}
+
+		std::cerr << std::endl << received << " frames received, " << shown << " shown, "
+			<< std::fixed << std::setprecision(3) << render_time.count()/std::max<std::size_t>(shown, 1) << " ms/frame rendering" << std::endl;
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	return 0;
+}
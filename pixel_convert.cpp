@@ -0,0 +1,315 @@
+#include "pixel_convert.h"
+#include "pixel_kernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static_assert(sizeof(std::array<float, 3>)==3*sizeof(float), "Linear pixels are processed as plain floats");
+
+static bool same_channels(const std::array<channel_bits, 3> &left, const std::array<channel_bits, 3> &right)
+{
+	for (int i=0; i<3; ++i)
+	{
+		if (left[i].start_bit!=right[i].start_bit || left[i].bits!=right[i].bits)
+			return false;
+	}
+
+	return true;
+}
+
+static int find_known_format(const std::array<channel_bits, 3> &channels, std::size_t size)
+{
+	if (size==sizeof(std::uint16_t) && same_channels(channels, fmt_a1r5g5b5.channels))
+		return known_a1r5g5b5;
+
+	if (size==sizeof(std::uint16_t) && same_channels(channels, fmt_r5g6b5.channels))
+		return known_r5g6b5;
+
+	if (size==sizeof(std::uint32_t) && same_channels(channels, fmt_a8r8g8b8.channels))
+		return known_a8r8g8b8;
+
+	return -1;
+}
+
+static std::uint32_t load_pixel(const std::uint8_t *p, std::size_t size)
+{
+	switch (size)
+	{
+	case 1:
+		return *p;
+	case 2:
+		std::uint16_t v16;
+		std::memcpy(&v16, p, sizeof(v16));
+		return v16;
+	default:
+		std::uint32_t v32;
+		std::memcpy(&v32, p, sizeof(v32));
+		return v32;
+	}
+}
+
+static void store_pixel(std::uint8_t *p, std::size_t size, std::uint32_t value)
+{
+	switch (size)
+	{
+	case 1:
+		*p=std::uint8_t(value);
+		break;
+	case 2:
+	{
+		auto v16=std::uint16_t(value);
+		std::memcpy(p, &v16, sizeof(v16));
+		break;
+	}
+	default:
+		std::memcpy(p, &value, sizeof(value));
+		break;
+	}
+}
+
+// the same rounding as the kernels, for any channel sizes
+static void convert_generic(const std::array<channel_bits, 3> &src_channels, std::size_t src_size, const std::uint8_t *src, const std::array<channel_bits, 3> &dst_channels, std::size_t dst_size, std::uint8_t *dst, std::size_t count)
+{
+	std::array<std::uint64_t, 3> src_masks;
+	std::array<std::uint64_t, 3> dst_masks;
+
+	for (int c=0; c<3; ++c)
+	{
+		src_masks[c]=(std::uint64_t(1) << src_channels[c].bits)-1;
+		dst_masks[c]=(std::uint64_t(1) << dst_channels[c].bits)-1;
+	}
+
+	for (std::size_t i=0; i<count; ++i)
+	{
+		auto p=load_pixel(src+i*src_size, src_size);
+		std::uint32_t out=0;
+
+		for (int c=0; c<3; ++c)
+		{
+			if (src_masks[c]==0)
+				continue;
+
+			auto v=(p >> src_channels[c].start_bit) & src_masks[c];
+
+			out|=std::uint32_t((2*v*dst_masks[c]+src_masks[c])/(2*src_masks[c])) << dst_channels[c].start_bit;
+		}
+
+		store_pixel(dst+i*dst_size, dst_size, out);
+	}
+}
+
+bool pixel_kernel_supported(pixel_kernel kernel)
+{
+	switch (kernel)
+	{
+	case pixel_kernel::scalar:
+		return true;
+	case pixel_kernel::sse2:
+#ifdef __SSE2__
+		return true;
+#else
+		return false;
+#endif
+	case pixel_kernel::avx2:
+#ifdef NETVID_AVX2
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+
+	return false;
+}
+
+const char *pixel_kernel_name(pixel_kernel kernel)
+{
+	switch (kernel)
+	{
+	case pixel_kernel::scalar:
+		return "scalar";
+	case pixel_kernel::sse2:
+		return "sse2";
+	case pixel_kernel::avx2:
+		return "avx2";
+	}
+
+	return "unknown";
+}
+
+pixel_kernel best_pixel_kernel()
+{
+	static const pixel_kernel best=pixel_kernel_supported(pixel_kernel::avx2) ? pixel_kernel::avx2 : pixel_kernel_supported(pixel_kernel::sse2) ? pixel_kernel::sse2 : pixel_kernel::scalar;
+
+	return best;
+}
+
+static const convert_table &get_convert_table(pixel_kernel kernel)
+{
+	static const convert_table scalar=make_convert_table<scalar_ops>();
+
+#ifdef __SSE2__
+	static const convert_table sse2=make_convert_table<sse2_ops>();
+
+	if (kernel==pixel_kernel::sse2)
+		return sse2;
+#endif
+
+#ifdef NETVID_AVX2
+	static const convert_table avx2=avx2_convert_table();
+
+	if (kernel==pixel_kernel::avx2)
+		return avx2;
+#endif
+
+	return scalar;
+}
+
+void convert_pixel_data(const std::array<channel_bits, 3> &src_channels, std::size_t src_size, const void *src, const std::array<channel_bits, 3> &dst_channels, std::size_t dst_size, void *dst, std::size_t count, pixel_kernel kernel)
+{
+	if (src_size!=1 && src_size!=2 && src_size!=4)
+		throw std::invalid_argument("Unsupported source pixel size");
+
+	if (dst_size!=1 && dst_size!=2 && dst_size!=4)
+		throw std::invalid_argument("Unsupported destination pixel size");
+
+	if (!pixel_kernel_supported(kernel))
+		kernel=pixel_kernel::scalar;
+
+	auto src_id=find_known_format(src_channels, src_size);
+	auto dst_id=find_known_format(dst_channels, dst_size);
+
+	if (src_id>=0 && dst_id>=0)
+	{
+		get_convert_table(kernel)[src_id][dst_id](src, dst, count);
+
+		return;
+	}
+
+	convert_generic(src_channels, src_size, static_cast<const std::uint8_t *>(src), dst_channels, dst_size, static_cast<std::uint8_t *>(dst), count);
+}
+
+static const transfer_functions &get_transfer_functions(pixel_kernel kernel)
+{
+	static const transfer_functions scalar=make_transfer_functions<scalar_ops>();
+
+#ifdef __SSE2__
+	static const transfer_functions sse2=make_transfer_functions<sse2_ops>();
+
+	if (kernel==pixel_kernel::sse2)
+		return sse2;
+#endif
+
+#ifdef NETVID_AVX2
+	static const transfer_functions avx2=avx2_transfer_functions();
+
+	if (kernel==pixel_kernel::avx2)
+		return avx2;
+#endif
+
+	return scalar;
+}
+
+void to_linear(const float *src, float *dst, std::size_t count, pixel_kernel kernel)
+{
+	if (!pixel_kernel_supported(kernel))
+		kernel=pixel_kernel::scalar;
+
+	get_transfer_functions(kernel).to_linear(src, dst, count);
+}
+
+void to_srgb(const float *src, float *dst, std::size_t count, pixel_kernel kernel)
+{
+	if (!pixel_kernel_supported(kernel))
+		kernel=pixel_kernel::scalar;
+
+	get_transfer_functions(kernel).to_srgb(src, dst, count);
+}
+
+const float *linear_table(int bits)
+{
+	static const std::array<std::vector<float>, 9> tables=[]
+	{
+		std::array<std::vector<float>, 9> ret;
+
+		for (int b=1; b<=8; ++b)
+		{
+			int mask=(1 << b)-1;
+
+			for (int v=0; v<=mask; ++v)
+				ret[b].push_back(to_linear(std::array<float, 3>{ { v/float(mask), 0, 0 } })[0]);
+		}
+
+		return ret;
+	}();
+
+	if (bits<1 || bits>8)
+		throw std::invalid_argument("No table for "+std::to_string(bits)+" bit channels");
+
+	return tables[bits].data();
+}
+
+void pixel_data_to_linear(const std::array<channel_bits, 3> &channels, std::size_t size, const void *src, std::array<float, 3> *dst, std::size_t count, pixel_kernel kernel)
+{
+	if (size!=1 && size!=2 && size!=4)
+		throw std::invalid_argument("Unsupported pixel size");
+
+	auto src_bytes=static_cast<const std::uint8_t *>(src);
+	bool lookup=true;
+	std::array<const float *, 3> tables;
+
+	for (int c=0; c<3; ++c)
+	{
+		if (channels[c].bits<1 || channels[c].bits>8)
+			lookup=false;
+		else
+			tables[c]=linear_table(channels[c].bits);
+	}
+
+	if (lookup)
+	{
+		for (std::size_t i=0; i<count; ++i)
+		{
+			auto p=load_pixel(src_bytes+i*size, size);
+
+			for (int c=0; c<3; ++c)
+				dst[i][c]=tables[c][(p >> channels[c].start_bit) & channels[c].mask()];
+		}
+
+		return;
+	}
+
+	// wider channels go through the float path
+	for (std::size_t i=0; i<count; ++i)
+		dst[i]=to_float_srgb(pixel_format<std::uint32_t>{ channels }, load_pixel(src_bytes+i*size, size));
+
+	to_linear(dst->data(), dst->data(), 3*count, kernel);
+}
+
+void linear_to_pixel_data(const std::array<float, 3> *src, const std::array<channel_bits, 3> &channels, std::size_t size, void *dst, std::size_t count, pixel_kernel kernel)
+{
+	if (size!=1 && size!=2 && size!=4)
+		throw std::invalid_argument("Unsupported pixel size");
+
+	const std::size_t block=256;
+	std::array<std::array<float, 3>, block> srgb;
+	auto dst_bytes=static_cast<std::uint8_t *>(dst);
+
+	for (std::size_t begin=0; begin<count; begin+=block)
+	{
+		auto n=std::min(block, count-begin);
+
+		to_srgb(src[begin].data(), srgb[0].data(), 3*n, kernel);
+
+		for (std::size_t i=0; i<n; ++i)
+		{
+			std::uint32_t out=0;
+
+			for (int c=0; c<3; ++c)
+				out|=static_cast<std::uint32_t>(srgb[i][c]*channels[c].mask()+.5f) << channels[c].start_bit;
+
+			store_pixel(dst_bytes+(begin+i)*size, size, out);
+		}
+	}
+}
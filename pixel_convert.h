@@ -0,0 +1,72 @@
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include <cstddef>
+#include <stdexcept>
+
+#include "framebuffer.h"
+
+// instruction sets of the batch conversion kernels
+enum class pixel_kernel
+{
+	scalar,
+	sse2,
+	avx2,
+};
+
+extern bool pixel_kernel_supported(pixel_kernel kernel);
+extern const char *pixel_kernel_name(pixel_kernel kernel);
+
+// the fastest kernel the cpu runs, detected once
+extern pixel_kernel best_pixel_kernel();
+
+// converts count pixels of any layout, pixel sizes of 1, 2 or 4 bytes
+extern void convert_pixel_data(const std::array<channel_bits, 3> &src_channels, std::size_t src_size, const void *src, const std::array<channel_bits, 3> &dst_channels, std::size_t dst_size, void *dst, std::size_t count, pixel_kernel kernel);
+
+// converts count pixels, each channel rounded to the nearest destination value as from_float_srgb(to_float_srgb()) does, bits outside the channels cleared
+// pairs of fmt_a1r5g5b5, fmt_r5g6b5 and fmt_a8r8g8b8 run vector kernels, other formats a generic scalar loop
+template<class src_type, class dst_type>
+void convert_pixels(const pixel_format<src_type> &src_fmt, const src_type *src, const pixel_format<dst_type> &dst_fmt, dst_type *dst, std::size_t count, pixel_kernel kernel=best_pixel_kernel())
+{
+	convert_pixel_data(src_fmt.channels, sizeof(src_type), src, dst_fmt.channels, sizeof(dst_type), dst, count, kernel);
+}
+
+// converts a frame into one of the same size, row by row so pitches may differ
+template<class src_type, class dst_type>
+void convert_frame(const pixel_format<src_type> &src_fmt, const frame_data &src, const pixel_format<dst_type> &dst_fmt, frame_data &dst, pixel_kernel kernel=best_pixel_kernel())
+{
+	if (src.bpp!=src_fmt.bits() || dst.bpp!=dst_fmt.bits() || src.width!=dst.width || src.height!=dst.height)
+		throw std::invalid_argument("Frame doesn't match the conversion");
+
+	for (int y=0; y<src.height; ++y)
+		convert_pixels(src_fmt, src.pixel<src_type>(0, y), dst_fmt, dst.pixel<dst_type>(0, y), src.width, kernel);
+}
+
+// srgb transfer functions over buffers of floats, src and dst may be the same
+// inputs are clamped to [0, 1], results stay within max_transfer_error of to_linear and to_srgb in framebuffer.h
+static const float max_transfer_error=1e-6f;
+
+extern void to_linear(const float *src, float *dst, std::size_t count, pixel_kernel kernel=best_pixel_kernel());
+extern void to_srgb(const float *src, float *dst, std::size_t count, pixel_kernel kernel=best_pixel_kernel());
+
+// to_linear of every value of a channel of 1 to 8 bits, indexed by the value
+extern const float *linear_table(int bits);
+
+extern void pixel_data_to_linear(const std::array<channel_bits, 3> &channels, std::size_t size, const void *src, std::array<float, 3> *dst, std::size_t count, pixel_kernel kernel);
+extern void linear_to_pixel_data(const std::array<float, 3> *src, const std::array<channel_bits, 3> &channels, std::size_t size, void *dst, std::size_t count, pixel_kernel kernel);
+
+// linear channels of count pixels, channels up to 8 bits are looked up and match to_linear(to_float_srgb()) exactly
+template<class src_type>
+void pixels_to_linear(const pixel_format<src_type> &fmt, const src_type *src, std::array<float, 3> *dst, std::size_t count, pixel_kernel kernel=best_pixel_kernel())
+{
+	pixel_data_to_linear(fmt.channels, sizeof(src_type), src, dst, count, kernel);
+}
+
+// pixels from linear channels, rounded like from_float_srgb(to_srgb())
+template<class dst_type>
+void linear_to_pixels(const std::array<float, 3> *src, const pixel_format<dst_type> &fmt, dst_type *dst, std::size_t count, pixel_kernel kernel=best_pixel_kernel())
+{
+	linear_to_pixel_data(src, fmt.channels, sizeof(dst_type), dst, count, kernel);
+}
+
+#endif /* PIXEL_CONVERT_H */
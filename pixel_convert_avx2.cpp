@@ -0,0 +1,29 @@
+// only called once the cpu is known to support avx2
+// the file isn't built with -mavx2: shared inline functions and templates compiled here could be the copy the linker keeps
+// so everything outside the kernels is included first, only pixel_kernels.h and the two entry points get the avx2 target
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <immintrin.h>
+
+#include "framebuffer.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define PIXEL_KERNELS_AVX2
+#include "pixel_kernels.h"
+
+convert_table avx2_convert_table()
+{
+	return make_convert_table<avx2_ops>();
+}
+
+transfer_functions avx2_transfer_functions()
+{
+	return make_transfer_functions<avx2_ops>();
+}
+
+#pragma GCC pop_options
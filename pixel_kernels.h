@@ -0,0 +1,480 @@
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+// conversion kernels between the known formats, shared by pixel_convert.cpp and the translation units built for wider instruction sets
+// everything sits in an anonymous namespace so instantiations built with different target flags never get merged
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "framebuffer.h"
+
+enum known_format
+{
+	known_a1r5g5b5,
+	known_r5g6b5,
+	known_a8r8g8b8,
+	known_formats,
+};
+
+typedef void (*convert_function)(const void *src, void *dst, std::size_t count);
+typedef std::array<std::array<convert_function, known_formats>, known_formats> convert_table;
+
+typedef void (*transfer_function)(const float *src, float *dst, std::size_t count);
+
+struct transfer_functions
+{
+	transfer_function to_linear;
+	transfer_function to_srgb;
+};
+
+#ifdef NETVID_AVX2
+extern convert_table avx2_convert_table();
+extern transfer_functions avx2_transfer_functions();
+#endif
+
+namespace
+{
+	template<int id>
+	using known_type=typename std::conditional<id==known_a8r8g8b8, std::uint32_t, std::uint16_t>::type;
+
+	constexpr channel_bits known_channel(int id, int channel)
+	{
+		return id==known_a1r5g5b5 ? fmt_a1r5g5b5.channels[channel] : id==known_r5g6b5 ? fmt_r5g6b5.channels[channel] : fmt_a8r8g8b8.channels[channel];
+	}
+
+	// (v*mul+add) >> shift rounds v*dst_mask/src_mask to the nearest integer for every v, without exceeding 16 bits
+	struct channel_scale
+	{
+		std::uint16_t mul;
+		std::uint16_t add;
+		int shift;
+	};
+
+	constexpr channel_scale get_channel_scale(int src_bits, int dst_bits)
+	{
+		return src_bits==dst_bits ? channel_scale{ 1, 0, 0 }
+			: src_bits==5 && dst_bits==6 ? channel_scale{ 33, 0, 4 }
+			: src_bits==6 && dst_bits==5 ? channel_scale{ 1, 0, 1 }
+			: src_bits==5 && dst_bits==8 ? channel_scale{ 527, 23, 6 }
+			: src_bits==6 && dst_bits==8 ? channel_scale{ 259, 33, 6 }
+			: src_bits==8 && dst_bits==5 ? channel_scale{ 249, 1014, 11 }
+			: src_bits==8 && dst_bits==6 ? channel_scale{ 253, 505, 10 }
+			: channel_scale{ 0, 0, 0 };
+	}
+
+	template<int src_id, int dst_id, int channel>
+	struct channel_traits
+	{
+		static constexpr channel_bits src=known_channel(src_id, channel);
+		static constexpr channel_bits dst=known_channel(dst_id, channel);
+		static constexpr channel_scale scale=get_channel_scale(src.bits, dst.bits);
+		static constexpr std::uint32_t src_mask=(1u << src.bits)-1;
+
+		static_assert(scale.mul!=0, "No exact scale between these channel sizes");
+		static_assert(dst.start_bit%16+dst.bits<=16, "Channels must not straddle 16-bit halves");
+
+		static std::uint32_t convert(std::uint32_t pixel)
+		{
+			auto v=(pixel >> src.start_bit) & src_mask;
+
+			return ((v*scale.mul+scale.add) >> scale.shift) << dst.start_bit;
+		}
+	};
+
+	template<int src_id, int dst_id>
+	void convert_scalar(const known_type<src_id> *src, known_type<dst_id> *dst, std::size_t count)
+	{
+		for (std::size_t i=0; i<count; ++i)
+		{
+			std::uint32_t p=src[i];
+
+			dst[i]=known_type<dst_id>(channel_traits<src_id, dst_id, 0>::convert(p) | channel_traits<src_id, dst_id, 1>::convert(p) | channel_traits<src_id, dst_id, 2>::convert(p));
+		}
+	}
+
+	// the float part doubles as the tail of the vector transfer functions
+	struct scalar_ops
+	{
+		typedef float vecf;
+		typedef bool maskf;
+		typedef std::int32_t veci;
+
+		static const std::size_t float_lanes=1;
+
+		static vecf loadf(const float *p) { return *p; }
+		static void storef(float *p, vecf v) { *p=v; }
+		static vecf setf(float x) { return x; }
+		static vecf addf(vecf a, vecf b) { return a+b; }
+		static vecf subf(vecf a, vecf b) { return a-b; }
+		static vecf mulf(vecf a, vecf b) { return a*b; }
+		static vecf minf(vecf a, vecf b) { return b<a ? b : a; }
+		static vecf maxf(vecf a, vecf b) { return a<b ? b : a; }
+		static maskf gtf(vecf a, vecf b) { return a>b; }
+		static vecf selectf(maskf m, vecf a, vecf b) { return m ? a : b; }
+		static veci seti(std::int32_t x) { return x; }
+		static veci addi(veci a, veci b) { return a+b; }
+		static veci andi(veci a, veci b) { return a & b; }
+		static veci ori(veci a, veci b) { return a | b; }
+		static veci srli(veci a, int n) { return std::int32_t(std::uint32_t(a) >> n); }
+		static veci slli(veci a, int n) { return std::int32_t(std::uint32_t(a) << n); }
+		static vecf to_float(veci a) { return float(a); }
+		static veci truncate(vecf a) { return std::int32_t(a); }
+		static veci as_int(vecf a) { veci r; std::memcpy(&r, &a, sizeof(r)); return r; }
+		static vecf as_float(veci a) { vecf r; std::memcpy(&r, &a, sizeof(r)); return r; }
+	};
+
+#ifdef __SSE2__
+	struct sse2_ops
+	{
+		typedef __m128i vec;
+
+		// pixels per iteration, one per 16-bit lane
+		static const std::size_t lanes=8;
+
+		static vec load(const void *p) { return _mm_loadu_si128(static_cast<const __m128i *>(p)); }
+		static void store(void *p, vec v) { _mm_storeu_si128(static_cast<__m128i *>(p), v); }
+		static vec set16(std::uint16_t x) { return _mm_set1_epi16(std::int16_t(x)); }
+		static vec set32(std::uint32_t x) { return _mm_set1_epi32(std::int32_t(x)); }
+		static vec and_(vec a, vec b) { return _mm_and_si128(a, b); }
+		static vec or_(vec a, vec b) { return _mm_or_si128(a, b); }
+		static vec add16(vec a, vec b) { return _mm_add_epi16(a, b); }
+		static vec mul16(vec a, vec b) { return _mm_mullo_epi16(a, b); }
+		static vec srl16(vec a, int n) { return _mm_srli_epi16(a, n); }
+		static vec sll16(vec a, int n) { return _mm_slli_epi16(a, n); }
+		static vec srl32(vec a, int n) { return _mm_srli_epi32(a, n); }
+
+		// 32-bit lanes below 0x8000 of two vectors into the 16-bit lanes of one, in order
+		static vec narrow(vec first, vec second) { return _mm_packs_epi32(first, second); }
+
+		typedef __m128 vecf;
+		typedef __m128 maskf;
+		typedef __m128i veci;
+
+		static const std::size_t float_lanes=4;
+
+		static vecf loadf(const float *p) { return _mm_loadu_ps(p); }
+		static void storef(float *p, vecf v) { _mm_storeu_ps(p, v); }
+		static vecf setf(float x) { return _mm_set1_ps(x); }
+		static vecf addf(vecf a, vecf b) { return _mm_add_ps(a, b); }
+		static vecf subf(vecf a, vecf b) { return _mm_sub_ps(a, b); }
+		static vecf mulf(vecf a, vecf b) { return _mm_mul_ps(a, b); }
+		static vecf minf(vecf a, vecf b) { return _mm_min_ps(a, b); }
+		static vecf maxf(vecf a, vecf b) { return _mm_max_ps(a, b); }
+		static maskf gtf(vecf a, vecf b) { return _mm_cmpgt_ps(a, b); }
+		static vecf selectf(maskf m, vecf a, vecf b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+		static veci seti(std::int32_t x) { return _mm_set1_epi32(x); }
+		static veci addi(veci a, veci b) { return _mm_add_epi32(a, b); }
+		static veci andi(veci a, veci b) { return _mm_and_si128(a, b); }
+		static veci ori(veci a, veci b) { return _mm_or_si128(a, b); }
+		static veci srli(veci a, int n) { return _mm_srli_epi32(a, n); }
+		static veci slli(veci a, int n) { return _mm_slli_epi32(a, n); }
+		static vecf to_float(veci a) { return _mm_cvtepi32_ps(a); }
+		static veci truncate(vecf a) { return _mm_cvttps_epi32(a); }
+		static veci as_int(vecf a) { return _mm_castps_si128(a); }
+		static vecf as_float(veci a) { return _mm_castsi128_ps(a); }
+
+		// 16-bit lanes of low and high halves into the 32-bit lanes of two vectors, in order
+		static void widen(vec low, vec high, vec &first, vec &second)
+		{
+			first=_mm_unpacklo_epi16(low, high);
+			second=_mm_unpackhi_epi16(low, high);
+		}
+	};
+#endif
+
+	// the macro stays unset under a target pragma, the avx2 translation unit defines PIXEL_KERNELS_AVX2 instead
+#if defined(__AVX2__) || defined(PIXEL_KERNELS_AVX2)
+	struct avx2_ops
+	{
+		typedef __m256i vec;
+
+		static const std::size_t lanes=16;
+
+		static vec load(const void *p) { return _mm256_loadu_si256(static_cast<const __m256i *>(p)); }
+		static void store(void *p, vec v) { _mm256_storeu_si256(static_cast<__m256i *>(p), v); }
+		static vec set16(std::uint16_t x) { return _mm256_set1_epi16(std::int16_t(x)); }
+		static vec set32(std::uint32_t x) { return _mm256_set1_epi32(std::int32_t(x)); }
+		static vec and_(vec a, vec b) { return _mm256_and_si256(a, b); }
+		static vec or_(vec a, vec b) { return _mm256_or_si256(a, b); }
+		static vec add16(vec a, vec b) { return _mm256_add_epi16(a, b); }
+		static vec mul16(vec a, vec b) { return _mm256_mullo_epi16(a, b); }
+		static vec srl16(vec a, int n) { return _mm256_srli_epi16(a, n); }
+		static vec sll16(vec a, int n) { return _mm256_slli_epi16(a, n); }
+		static vec srl32(vec a, int n) { return _mm256_srli_epi32(a, n); }
+
+		// packs and unpacks work within 128-bit halves, the permutes restore pixel order
+		static vec narrow(vec first, vec second)
+		{
+			return _mm256_permute4x64_epi64(_mm256_packs_epi32(first, second), 0xd8);
+		}
+
+		static void widen(vec low, vec high, vec &first, vec &second)
+		{
+			auto a=_mm256_unpacklo_epi16(low, high);
+			auto b=_mm256_unpackhi_epi16(low, high);
+
+			first=_mm256_permute2x128_si256(a, b, 0x20);
+			second=_mm256_permute2x128_si256(a, b, 0x31);
+		}
+
+		typedef __m256 vecf;
+		typedef __m256 maskf;
+		typedef __m256i veci;
+
+		static const std::size_t float_lanes=8;
+
+		static vecf loadf(const float *p) { return _mm256_loadu_ps(p); }
+		static void storef(float *p, vecf v) { _mm256_storeu_ps(p, v); }
+		static vecf setf(float x) { return _mm256_set1_ps(x); }
+		static vecf addf(vecf a, vecf b) { return _mm256_add_ps(a, b); }
+		static vecf subf(vecf a, vecf b) { return _mm256_sub_ps(a, b); }
+		static vecf mulf(vecf a, vecf b) { return _mm256_mul_ps(a, b); }
+		static vecf minf(vecf a, vecf b) { return _mm256_min_ps(a, b); }
+		static vecf maxf(vecf a, vecf b) { return _mm256_max_ps(a, b); }
+		static maskf gtf(vecf a, vecf b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		static vecf selectf(maskf m, vecf a, vecf b) { return _mm256_blendv_ps(b, a, m); }
+		static veci seti(std::int32_t x) { return _mm256_set1_epi32(x); }
+		static veci addi(veci a, veci b) { return _mm256_add_epi32(a, b); }
+		static veci andi(veci a, veci b) { return _mm256_and_si256(a, b); }
+		static veci ori(veci a, veci b) { return _mm256_or_si256(a, b); }
+		static veci srli(veci a, int n) { return _mm256_srli_epi32(a, n); }
+		static veci slli(veci a, int n) { return _mm256_slli_epi32(a, n); }
+		static vecf to_float(veci a) { return _mm256_cvtepi32_ps(a); }
+		static veci truncate(vecf a) { return _mm256_cvttps_epi32(a); }
+		static veci as_int(vecf a) { return _mm256_castps_si256(a); }
+		static vecf as_float(veci a) { return _mm256_castsi256_ps(a); }
+	};
+#endif
+
+	// channel in 16-bit lanes, already scaled to the destination size
+	template<class ops, int src_id, int dst_id, int channel>
+	typename ops::vec load_channel(const known_type<src_id> *src)
+	{
+		typedef channel_traits<src_id, dst_id, channel> traits;
+		typename ops::vec v;
+
+		if (sizeof(known_type<src_id>)==2)
+			v=ops::and_(ops::srl16(ops::load(src), traits::src.start_bit), ops::set16(traits::src_mask));
+		else
+		{
+			auto mask=ops::set32(traits::src_mask);
+			auto first=ops::and_(ops::srl32(ops::load(src), traits::src.start_bit), mask);
+			auto second=ops::and_(ops::srl32(ops::load(src+ops::lanes/2), traits::src.start_bit), mask);
+
+			v=ops::narrow(first, second);
+		}
+
+		if (traits::scale.mul!=1)
+			v=ops::mul16(v, ops::set16(traits::scale.mul));
+
+		if (traits::scale.add!=0)
+			v=ops::add16(v, ops::set16(traits::scale.add));
+
+		return ops::srl16(v, traits::scale.shift);
+	}
+
+	// channel shifted into place within the destination's 16-bit half, or zero if it sits in the other half
+	template<class ops, int src_id, int dst_id, int channel>
+	typename ops::vec place_channel(typename ops::vec v, bool high)
+	{
+		typedef channel_traits<src_id, dst_id, channel> traits;
+
+		if ((traits::dst.start_bit>=16)!=high)
+			return ops::set16(0);
+
+		return ops::sll16(v, traits::dst.start_bit%16);
+	}
+
+	// converts whole vectors of pixels, returns how many
+	template<class ops, int src_id, int dst_id>
+	struct vector_kernel
+	{
+		static std::size_t convert(const known_type<src_id> *src, known_type<dst_id> *dst, std::size_t count);
+	};
+
+	template<int src_id, int dst_id>
+	struct vector_kernel<scalar_ops, src_id, dst_id>
+	{
+		static std::size_t convert(const known_type<src_id> *, known_type<dst_id> *, std::size_t)
+		{
+			return 0;
+		}
+	};
+
+	template<class ops, int src_id, int dst_id>
+	std::size_t vector_kernel<ops, src_id, dst_id>::convert(const known_type<src_id> *src, known_type<dst_id> *dst, std::size_t count)
+	{
+		std::size_t i=0;
+
+		for (; i+ops::lanes<=count; i+=ops::lanes)
+		{
+			auto c0=load_channel<ops, src_id, dst_id, 0>(src+i);
+			auto c1=load_channel<ops, src_id, dst_id, 1>(src+i);
+			auto c2=load_channel<ops, src_id, dst_id, 2>(src+i);
+
+			auto low=ops::or_(ops::or_(place_channel<ops, src_id, dst_id, 0>(c0, false), place_channel<ops, src_id, dst_id, 1>(c1, false)), place_channel<ops, src_id, dst_id, 2>(c2, false));
+
+			if (sizeof(known_type<dst_id>)==2)
+			{
+				ops::store(dst+i, low);
+
+				continue;
+			}
+
+			auto high=ops::or_(ops::or_(place_channel<ops, src_id, dst_id, 0>(c0, true), place_channel<ops, src_id, dst_id, 1>(c1, true)), place_channel<ops, src_id, dst_id, 2>(c2, true));
+			typename ops::vec first;
+			typename ops::vec second;
+
+			ops::widen(low, high, first, second);
+			ops::store(dst+i, first);
+			ops::store(dst+i+ops::lanes/2, second);
+		}
+
+		return i;
+	}
+
+	template<class ops, int src_id, int dst_id>
+	void convert_known(const void *src_data, void *dst_data, std::size_t count)
+	{
+		auto src=static_cast<const known_type<src_id> *>(src_data);
+		auto dst=static_cast<known_type<dst_id> *>(dst_data);
+		auto done=vector_kernel<ops, src_id, dst_id>::convert(src, dst, count);
+
+		convert_scalar<src_id, dst_id>(src+done, dst+done, count-done);
+	}
+
+	template<class ops, int src_id>
+	void add_convert_row(convert_table &table)
+	{
+		table[src_id][known_a1r5g5b5]=convert_known<ops, src_id, known_a1r5g5b5>;
+		table[src_id][known_r5g6b5]=convert_known<ops, src_id, known_r5g6b5>;
+		table[src_id][known_a8r8g8b8]=convert_known<ops, src_id, known_a8r8g8b8>;
+	}
+
+	// identical formats are converted too, which clears the alpha bits
+	template<class ops>
+	convert_table make_convert_table()
+	{
+		convert_table table;
+
+		add_convert_row<ops, known_a1r5g5b5>(table);
+		add_convert_row<ops, known_r5g6b5>(table);
+		add_convert_row<ops, known_a8r8g8b8>(table);
+
+		return table;
+	}
+
+	// log2 of positive normal floats, a degree 7 fit of the mantissa off by less than 4e-7
+	template<class ops>
+	typename ops::vecf fast_log2(typename ops::vecf x)
+	{
+		auto bits=ops::as_int(x);
+		auto exponent=ops::to_float(ops::addi(ops::srli(bits, 23), ops::seti(-127)));
+		auto t=ops::subf(ops::as_float(ops::ori(ops::andi(bits, ops::seti(0x007fffff)), ops::seti(0x3f800000))), ops::setf(1));
+		auto p=ops::setf(1.444035249e-02f);
+
+		p=ops::addf(ops::mulf(p, t), ops::setf(-7.565137468e-02f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(1.887527377e-01f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(-3.219602855e-01f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(4.720869162e-01f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(-7.203160644e-01f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(1.442647549e+00f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(3.685614098e-07f));
+
+		return ops::addf(exponent, p);
+	}
+
+	// 2^x for x up to 127, a degree 5 fit of the fraction with a relative error below 2e-7
+	template<class ops>
+	typename ops::vecf fast_exp2(typename ops::vecf x)
+	{
+		x=ops::maxf(x, ops::setf(-126));
+
+		auto whole=ops::to_float(ops::truncate(x));
+
+		// truncation rounds negatives up
+		whole=ops::subf(whole, ops::selectf(ops::gtf(whole, x), ops::setf(1), ops::setf(0)));
+
+		auto t=ops::subf(x, whole);
+		auto p=ops::setf(1.893754058e-03f);
+
+		p=ops::addf(ops::mulf(p, t), ops::setf(8.949590423e-03f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(5.586033708e-02f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(2.401418182e-01f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(6.931544897e-01f));
+		p=ops::addf(ops::mulf(p, t), ops::setf(9.999998984e-01f));
+
+		return ops::as_float(ops::addi(ops::as_int(p), ops::slli(ops::truncate(whole), 23)));
+	}
+
+	// same constants as to_linear and to_srgb in framebuffer.cpp, inputs clamped to [0, 1]
+	struct srgb_to_linear
+	{
+		template<class ops>
+		static typename ops::vecf apply(typename ops::vecf x)
+		{
+			const float a=0.055f;
+
+			x=ops::minf(ops::maxf(x, ops::setf(0)), ops::setf(1));
+
+			auto t=ops::mulf(ops::addf(x, ops::setf(a)), ops::setf(1/(1+a)));
+			auto curve=fast_exp2<ops>(ops::mulf(fast_log2<ops>(t), ops::setf(2.4f)));
+
+			return ops::selectf(ops::gtf(x, ops::setf(0.04045f)), curve, ops::mulf(x, ops::setf(1/12.92f)));
+		}
+	};
+
+	struct linear_to_srgb
+	{
+		template<class ops>
+		static typename ops::vecf apply(typename ops::vecf x)
+		{
+			const float a=0.055f;
+
+			x=ops::minf(ops::maxf(x, ops::setf(0)), ops::setf(1));
+
+			// zero takes the linear segment, its log2 is merely large and negative
+			auto curve=ops::subf(ops::mulf(fast_exp2<ops>(ops::mulf(fast_log2<ops>(x), ops::setf(1/2.4f))), ops::setf(1+a)), ops::setf(a));
+
+			return ops::selectf(ops::gtf(x, ops::setf(0.0031308f)), curve, ops::mulf(x, ops::setf(12.92f)));
+		}
+	};
+
+	template<class ops, class function>
+	void transfer(const float *src, float *dst, std::size_t count)
+	{
+		std::size_t i=0;
+
+		// two independent vectors per iteration hide the latency of the polynomials
+		for (; i+2*ops::float_lanes<=count; i+=2*ops::float_lanes)
+		{
+			auto first=function::template apply<ops>(ops::loadf(src+i));
+			auto second=function::template apply<ops>(ops::loadf(src+i+ops::float_lanes));
+
+			ops::storef(dst+i, first);
+			ops::storef(dst+i+ops::float_lanes, second);
+		}
+
+		for (; i+ops::float_lanes<=count; i+=ops::float_lanes)
+			ops::storef(dst+i, function::template apply<ops>(ops::loadf(src+i)));
+
+		for (; i<count; ++i)
+			dst[i]=function::template apply<scalar_ops>(src[i]);
+	}
+
+	template<class ops>
+	transfer_functions make_transfer_functions()
+	{
+		return { transfer<ops, srgb_to_linear>, transfer<ops, linear_to_srgb> };
+	}
+}
+
+#endif /* PIXEL_KERNELS_H */
@@ -1,6 +1,31 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+
+enum class chunk_layout : std::uint32_t
+{
+	tiles=0, // near-square grid of rectangles
+	strips=1, // full-width row strips, rows only split where they exceed a packet
+};
+
+// the upper half of pkt_id carries flags, receivers unaware of a flag see an unknown packet type and skip it
+static const std::uint32_t pkt_type_mask=0xffff;
+
+enum pkt_flags : std::uint32_t
+{
+	pkt_flag_delta=1 << 16, // chunk of a delta frame: frame_chunks counts the chunks sent, chunk_id indexes the whole frame
+	pkt_flag_compressed=1 << 17, // chunk payload is rle coded (codec.h), pitch*height bytes once decoded
+};
+
+inline std::uint32_t pkt_type(std::uint32_t pkt_id)
+{
+	return pkt_id & pkt_type_mask;
+}
+
 #pragma pack(push)
 #pragma pack(1)
 struct remote_header
@@ -21,6 +46,8 @@ struct remote_mode_header : remote_header
 	std::uint32_t pitch=0;
 	std::uint32_t bpp=0;
 	double aspect_ratio=4/3.;
+	chunk_layout layout=chunk_layout::tiles; // absent from older senders' packets
+	std::uint32_t fec_group_size=0; // chunks per parity packet, 0 without fec
 
 	bool operator==(const remote_mode_header &right) const
 	{
@@ -30,7 +57,9 @@ struct remote_mode_header : remote_header
 			height==right.height &&
 			pitch==right.pitch &&
 			bpp==right.bpp &&
-			aspect_ratio==right.aspect_ratio;
+			aspect_ratio==right.aspect_ratio &&
+			layout==right.layout &&
+			fec_group_size==right.fec_group_size;
 	}
 
 	bool operator!=(const remote_mode_header &right) const
@@ -64,8 +93,46 @@ struct remote_vsync_header : remote_header
 		pkt_id=2;
 	}
 };
+
+// followed by the xor of the group's chunk datagrams, each zero-padded to the longest
+struct remote_parity_header : remote_header
+{
+	remote_parity_header()
+	{
+		pkt_id=3;
+	}
+
+	std::uint32_t frame_id=0;
+	std::uint32_t first_chunk_id=0;
+	std::uint32_t chunk_mask=0; // bit i set if chunk first_chunk_id+i is covered
+	std::uint32_t length_xor=0; // xor of the covered datagrams' lengths
+};
+
+// receiver to sender, followed by chunk_count chunk ids of frame_id to send again
+struct remote_nack_header : remote_header
+{
+	remote_nack_header()
+	{
+		pkt_id=4;
+	}
+
+	std::uint32_t frame_id=0;
+	std::uint32_t chunk_count=0;
+};
 #pragma pack(pop)
 
+// copies a header out of a packet, fields missing from shorter (older) packets keep their defaults
+template<class header_type>
+inline header_type read_header(const std::uint8_t *data_begin, const std::uint8_t *data_end)
+{
+	header_type header;
+	std::size_t length=std::min<std::size_t>(data_end-data_begin, sizeof(header));
+
+	std::copy(data_begin, data_begin+length, reinterpret_cast<std::uint8_t *>(&header));
+
+	return header;
+}
+
 inline int calc_pitch(int width, int bpp)
 {
 	return (width*bpp+7)/8;
@@ -83,9 +150,24 @@ inline int int_div_rup(int num, int div)
 	return (num+div-1)/div;
 }
 
-inline std::tuple<int, int> get_frame_divisions(int width, int height, int bpp, int max_bytes=1400)
+inline std::tuple<int, int> get_strip_divisions(int width, int height, int bpp, int max_bytes=1400)
 {
 	auto pitch=calc_pitch(width, bpp);
+
+	if (pitch<=max_bytes)
+		return std::make_tuple(1, int_div_rup(height, max_bytes/pitch));
+
+	auto max_pixels=(max_bytes*8)/bpp;
+
+	return std::make_tuple(int_div_rup(width, max_pixels), height);
+}
+
+inline std::tuple<int, int> get_frame_divisions(int width, int height, int bpp, int max_bytes=1400, chunk_layout layout=chunk_layout::tiles)
+{
+	if (layout==chunk_layout::strips)
+		return get_strip_divisions(width, height, bpp, max_bytes);
+
+	auto pitch=calc_pitch(width, bpp);
 	auto total_bytes=pitch*height;
 	auto max_pixels=(max_bytes*8)/bpp;
 	auto min_packets_needed=int_div_rup(total_bytes, max_bytes);
@@ -0,0 +1,965 @@
+#include "recording.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/system/system_error.hpp>
+#include <lzma.h>
+
+#include "protocol.h"
+
+using namespace netvid;
+
+// runs work in the order it's submitted on a few threads, queued work is still done when it's destroyed
+struct netvid::work_pool
+{
+	work_pool(unsigned threads)
+	{
+		for (unsigned i=0; i<threads; ++i)
+			workers.emplace_back([this] { run(); });
+	}
+
+	~work_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stopping=true;
+		}
+
+		cv.notify_all();
+
+		for (auto &worker : workers)
+			worker.join();
+	}
+
+	template<class function_type>
+	auto submit(function_type f)
+	{
+		auto task=std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+		auto result=task->get_future();
+
+		{
+			std::lock_guard<std::mutex> lock(m);
+			tasks.push_back([task] { (*task)(); });
+		}
+
+		cv.notify_one();
+
+		return result;
+	}
+
+private:
+	std::mutex m;
+	std::condition_variable cv;
+	std::deque<std::function<void()>> tasks;
+	std::vector<std::thread> workers;
+	bool stopping=false;
+
+	void run()
+	{
+		for (;;)
+		{
+			std::function<void()> task;
+
+			{
+				std::unique_lock<std::mutex> lock(m);
+
+				cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+				if (tasks.empty())
+					return;
+
+				task=std::move(tasks.front());
+				tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+};
+
+static std::vector<std::uint8_t> compress_block_data(const std::vector<std::uint8_t> &data, std::uint32_t preset)
+{
+	std::vector<std::uint8_t> compressed(lzma_stream_buffer_bound(data.size()));
+	std::size_t compressed_size=0;
+
+	if (lzma_easy_buffer_encode(preset, LZMA_CHECK_CRC32, nullptr, data.data(), data.size(), compressed.data(), &compressed_size, compressed.size())!=LZMA_OK)
+		throw std::runtime_error("Compressing a block failed");
+
+	compressed.resize(compressed_size);
+
+	return compressed;
+}
+
+static std::vector<std::uint8_t> decompress_block_data(const std::uint8_t *data, std::size_t size, std::size_t decompressed_size)
+{
+	std::vector<std::uint8_t> decompressed(decompressed_size);
+	std::uint64_t memory_limit=std::numeric_limits<std::uint64_t>::max();
+	std::size_t in_pos=0;
+	std::size_t out_pos=0;
+
+	if (lzma_stream_buffer_decode(&memory_limit, 0, nullptr, data, &in_pos, size, decompressed.data(), &out_pos, decompressed.size())!=LZMA_OK || out_pos!=decompressed_size)
+		throw std::runtime_error("Corrupt compressed block");
+
+	return decompressed;
+}
+
+recording_writer::recording_writer(std::ostream &os, const block_compression &compression, bool kernel_timestamps)
+	: os(os), compression(compression)
+{
+	recording::file_header header;
+
+	std::memcpy(header.magic, recording::magic, sizeof(header.magic));
+	header.version=recording::version;
+
+	if (kernel_timestamps)
+		header.flags|=recording::flag_kernel_timestamps;
+
+	if (compression.preset)
+	{
+		header.flags|=recording::flag_compressed;
+		pool=std::make_unique<work_pool>(std::max(compression.threads, 1u));
+		block.reserve(compression.block_size);
+	}
+
+	put_file(&header, sizeof(header));
+	offset=sizeof(header);
+}
+
+recording_writer::~recording_writer()
+{
+}
+
+void recording_writer::write(std::chrono::nanoseconds time, const std::uint8_t *data_begin, const std::uint8_t *data_end)
+{
+	std::size_t size=data_end-data_begin;
+
+	// the first chunk of each frame is indexed, late chunks of earlier frames aren't, a sender restarting begins anew
+	if (size>=sizeof(remote_chunk_header))
+	{
+		auto &rch=*reinterpret_cast<const remote_chunk_header *>(data_begin);
+
+		if (pkt_type(rch.pkt_id)==remote_chunk_header().pkt_id && (!last_indexed_frame_id || rch.frame_id-*last_indexed_frame_id-1<std::numeric_limits<std::uint32_t>::max()-60))
+		{
+			index.push_back({ rch.frame_id, std::int64_t(time.count()), offset });
+			last_indexed_frame_id=rch.frame_id;
+		}
+	}
+
+	auto delta=std::int64_t(time.count())-last_time;
+	std::uint8_t header[20];
+	auto header_end=encode_varint(header, size+1);
+
+	header_end=encode_varint(header_end, (std::uint64_t(delta) << 1) ^ std::uint64_t(delta >> 63));
+	put(header, header_end-header);
+	put(data_begin, size);
+
+	last_time=time.count();
+
+	if (pool && block.size()>=compression.block_size)
+		compress_block();
+}
+
+void recording_writer::finish()
+{
+	if (finished)
+		return;
+
+	finished=true;
+
+	std::uint8_t records_end=0;
+
+	put(&records_end, sizeof(records_end));
+
+	recording::block_table_trailer table_trailer;
+
+	if (pool)
+	{
+		compress_block();
+		write_blocks(0);
+
+		recording::block_header blocks_end{ 0, 0 };
+
+		put_file(&blocks_end, sizeof(blocks_end));
+
+		table_trailer.table_offset=file_offset;
+		table_trailer.blocks=blocks.size();
+		std::memcpy(table_trailer.magic, recording::block_table_magic, sizeof(table_trailer.magic));
+		put_file(blocks.data(), blocks.size()*sizeof(recording::block_entry));
+	}
+
+	recording::index_trailer trailer;
+
+	trailer.index_offset=file_offset;
+	trailer.entries=index.size();
+	std::memcpy(trailer.magic, recording::index_magic, sizeof(trailer.magic));
+
+	put_file(index.data(), index.size()*sizeof(recording::index_entry));
+
+	if (pool)
+		put_file(&table_trailer, sizeof(table_trailer));
+
+	put_file(&trailer, sizeof(trailer));
+	os.flush();
+}
+
+void recording_writer::flush()
+{
+	os.flush();
+}
+
+void recording_writer::put(const void *data, std::size_t size)
+{
+	if (pool)
+	{
+		auto bytes=reinterpret_cast<const std::uint8_t *>(data);
+
+		block.insert(block.end(), bytes, bytes+size);
+	}
+	else
+		put_file(data, size);
+
+	offset+=size;
+}
+
+void recording_writer::put_file(const void *data, std::size_t size)
+{
+	os.write(reinterpret_cast<const char *>(data), size);
+	file_offset+=size;
+}
+
+void recording_writer::compress_block()
+{
+	if (block.empty())
+		return;
+
+	pending_block pending;
+
+	pending.size=block.size();
+	pending.offset=offset-block.size();
+	pending.compressed=pool->submit([data=std::move(block), preset=*compression.preset] { return compress_block_data(data, preset); });
+	compressing.push_back(std::move(pending));
+
+	block=std::vector<std::uint8_t>();
+	block.reserve(compression.block_size);
+
+	// blocks are written as they're done, only a backlog makes the writer wait
+	write_blocks(2*std::max(compression.threads, 1u));
+}
+
+void recording_writer::write_blocks(std::size_t in_flight)
+{
+	while (!compressing.empty())
+	{
+		auto &front=compressing.front();
+
+		if (compressing.size()<=in_flight && front.compressed.wait_for(std::chrono::seconds(0))!=std::future_status::ready)
+			break;
+
+		auto compressed=front.compressed.get();
+		recording::block_header header{ std::uint32_t(compressed.size()), front.size };
+
+		blocks.push_back({ file_offset, front.offset });
+		put_file(&header, sizeof(header));
+		put_file(compressed.data(), compressed.size());
+		compressing.pop_front();
+	}
+}
+
+std::uint8_t *recording_writer::encode_varint(std::uint8_t *out, std::uint64_t value)
+{
+	for (; value>=0x80; value>>=7)
+		*out++=std::uint8_t(value | 0x80);
+
+	*out++=std::uint8_t(value);
+
+	return out;
+}
+
+aligned_file_buffer::aligned_file_buffer(const std::string &filename, bool direct, std::size_t buffer_size)
+	: direct(direct), buffer_size((std::max(buffer_size, std::size_t(alignment))+alignment-1)/alignment*alignment)
+{
+	fd=open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+
+	// some file systems (tmpfs) refuse O_DIRECT
+	if (fd<0 && direct && errno==EINVAL)
+	{
+		this->direct=false;
+		fd=open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+
+	if (fd<0)
+		throw boost::system::system_error(errno, boost::system::system_category(), "open "+filename);
+
+	void *p=nullptr;
+
+	if (posix_memalign(&p, alignment, this->buffer_size))
+	{
+		::close(fd);
+
+		throw std::bad_alloc();
+	}
+
+	buffer.reset(static_cast<char *>(p));
+	setp(buffer.get(), buffer.get()+this->buffer_size);
+}
+
+aligned_file_buffer::~aligned_file_buffer()
+{
+	close();
+}
+
+bool aligned_file_buffer::close()
+{
+	if (fd<0)
+		return !write_error;
+
+	auto written=write_out(true);
+
+	if (::close(fd)<0 && !write_error)
+		write_error=errno;
+
+	fd=-1;
+
+	return written && !write_error;
+}
+
+aligned_file_buffer::int_type aligned_file_buffer::overflow(int_type c)
+{
+	if (!write_out(false))
+		return traits_type::eof();
+
+	if (!traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		*pptr()=traits_type::to_char_type(c);
+		pbump(1);
+	}
+
+	return traits_type::not_eof(c);
+}
+
+int aligned_file_buffer::sync()
+{
+	return write_out(false) ? 0 : -1;
+}
+
+bool aligned_file_buffer::write_out(bool all)
+{
+	std::size_t size=pptr()-pbase();
+	auto n=direct && !all ? size/alignment*alignment : size;
+
+	// the tail of a direct file is written as it is, through the page cache
+	if (direct && n%alignment)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+		direct=false;
+	}
+
+	for (std::size_t written=0; written<n;)
+	{
+		auto result=pwrite(fd, buffer.get()+written, n-written, file_offset+written);
+
+		if (result<0 && errno==EINTR)
+			continue;
+
+		if (result<=0)
+		{
+			if (!write_error)
+				write_error=result<0 ? errno : ENOSPC;
+
+			return false;
+		}
+
+		written+=result;
+	}
+
+	file_offset+=n;
+	std::memmove(buffer.get(), buffer.get()+n, size-n);
+	setp(buffer.get(), buffer.get()+buffer_size);
+	pbump(int(size-n));
+
+	return true;
+}
+
+write_behind_recorder::write_behind_recorder(recording_writer &writer, std::size_t queue_size)
+	: writer(writer), queue_size(std::max<std::size_t>(queue_size/sizeof(entry_header), 2)*sizeof(entry_header)), queue(new std::uint8_t[this->queue_size])
+{
+	thread=std::thread([this] { run(); });
+}
+
+write_behind_recorder::~write_behind_recorder()
+{
+	stop();
+}
+
+bool write_behind_recorder::push(std::chrono::nanoseconds time, const std::uint8_t *data_begin, const std::uint8_t *data_end)
+{
+	std::size_t size=data_end-data_begin;
+	auto needed=(sizeof(entry_header)+size+sizeof(entry_header)-1)/sizeof(entry_header)*sizeof(entry_header);
+	auto h=head.load(std::memory_order_relaxed);
+	auto t=tail.load(std::memory_order_acquire);
+	auto pos=h%queue_size;
+	auto contiguous=queue_size-pos;
+
+	// entries don't wrap, the end of the queue is skipped if it's too short
+	auto skipped=contiguous<needed ? contiguous : 0;
+
+	if (needed>queue_size || h-t+skipped+needed>queue_size)
+	{
+		stats.dropped.fetch_add(1, std::memory_order_relaxed);
+
+		return false;
+	}
+
+	if (skipped)
+	{
+		reinterpret_cast<entry_header *>(queue.get()+pos)->size=~0u;
+		h+=skipped;
+		pos=0;
+	}
+
+	auto &header=*reinterpret_cast<entry_header *>(queue.get()+pos);
+
+	header.time=time.count();
+	header.size=size;
+	std::memcpy(queue.get()+pos+sizeof(header), data_begin, size);
+
+	head.store(h+needed);
+	stats.packets.fetch_add(1, std::memory_order_relaxed);
+
+	if (h+needed-t>stats.queued_high_water.load(std::memory_order_relaxed))
+		stats.queued_high_water.store(h+needed-t, std::memory_order_relaxed);
+
+	// the lock's only taken to wake a writer that sleeps
+	if (writer_waiting)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		cv.notify_one();
+	}
+
+	return true;
+}
+
+void write_behind_recorder::stop()
+{
+	if (!thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stopping=true;
+	}
+
+	cv.notify_one();
+	thread.join();
+}
+
+void write_behind_recorder::run()
+{
+	auto t=tail.load(std::memory_order_relaxed);
+	auto last_flush=std::chrono::steady_clock::now();
+	bool unflushed=false;
+
+	for (;;)
+	{
+		bool stop=stopping;
+		auto h=head.load();
+
+		for (; t!=h;)
+		{
+			auto pos=t%queue_size;
+			auto &header=*reinterpret_cast<const entry_header *>(queue.get()+pos);
+
+			if (header.size==~0u)
+			{
+				t+=queue_size-pos;
+
+				continue;
+			}
+
+			auto data=queue.get()+pos+sizeof(header);
+
+			writer.write(std::chrono::nanoseconds(header.time), data, data+header.size);
+			t+=(sizeof(entry_header)+header.size+sizeof(entry_header)-1)/sizeof(entry_header)*sizeof(entry_header);
+			tail.store(t, std::memory_order_release);
+			unflushed=true;
+		}
+
+		stats.bytes_written.store(writer.bytes_written(), std::memory_order_relaxed);
+
+		if (stop)
+			break;
+
+		auto now=std::chrono::steady_clock::now();
+
+		if (unflushed && now>=last_flush+flush_interval)
+		{
+			writer.flush();
+			last_flush=now;
+			unflushed=false;
+
+			if (!writer.good())
+				stats.write_failed=true;
+		}
+
+		std::unique_lock<std::mutex> lock(m);
+
+		writer_waiting=true;
+		cv.wait_for(lock, flush_interval, [this, t] { return stopping || head.load()!=t; });
+		writer_waiting=false;
+	}
+
+	writer.flush();
+
+	if (!writer.good())
+		stats.write_failed=true;
+}
+
+recording_reader::recording_reader(const std::string &filename, unsigned threads)
+	: threads(std::max(threads, 1u))
+{
+	if (filename=="-")
+	{
+		fd=STDIN_FILENO;
+		open_stream();
+
+		return;
+	}
+
+	fd=open(filename.c_str(), O_RDONLY);
+
+	if (fd<0)
+		throw boost::system::system_error(errno, boost::system::system_category(), "open "+filename);
+
+	struct stat st;
+
+	if (fstat(fd, &st)<0 || !S_ISREG(st.st_mode) || st.st_size==0)
+	{
+		open_stream();
+
+		return;
+	}
+
+	mapping_size=st.st_size;
+	mapping=mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (mapping==MAP_FAILED)
+	{
+		mapping=nullptr;
+		open_stream();
+
+		return;
+	}
+
+	// read once front to back, the kernel reads ahead further and drops pages behind
+	madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+
+	file_begin=static_cast<const std::uint8_t *>(mapping);
+	file_cursor=file_begin;
+	file_end=file_begin+mapping_size;
+	seekable=true;
+	read_header();
+}
+
+recording_reader::recording_reader(const std::uint8_t *data, std::size_t size, unsigned threads)
+	: threads(std::max(threads, 1u)), file_begin(data), file_cursor(data), file_end(data+size), seekable(true)
+{
+	read_header();
+}
+
+recording_reader::~recording_reader()
+{
+	// blocks still decoding read the mapping
+	pool.reset();
+
+	if (mapping)
+		munmap(mapping, mapping_size);
+
+	if (fd>STDIN_FILENO)
+		close(fd);
+}
+
+void recording_reader::open_stream()
+{
+	file_buffer.resize(stream_block_size);
+	file_begin=file_buffer.data();
+	file_cursor=file_begin;
+	file_end=file_begin;
+	read_header();
+}
+
+void recording_reader::read_header()
+{
+	// old recordings start with the first packet's time, which is never this large
+	if (fill_file(sizeof(recording::file_header)) && !std::memcmp(file_cursor, recording::magic, sizeof(recording::magic)))
+	{
+		recording::file_header header;
+
+		std::memcpy(&header, file_cursor, sizeof(header));
+
+		if (header.version!=recording::version || (header.flags & ~recording::known_flags))
+			throw std::runtime_error("Unsupported recording version "+std::to_string(header.version)+" with flags "+std::to_string(header.flags));
+
+		file_cursor+=sizeof(header);
+		file_version=header.version;
+		file_flags=header.flags;
+
+		if (seekable)
+			read_index();
+	}
+
+	if (compressed())
+	{
+		pool=std::make_unique<work_pool>(threads);
+		next_block_offset=sizeof(recording::file_header);
+		buffer_offset=next_block_offset;
+		decode_ahead();
+
+		return;
+	}
+
+	begin=file_begin;
+	cursor=file_cursor;
+	end=file_end;
+	buffer_offset=file_buffer_offset;
+}
+
+void recording_reader::read_index()
+{
+	std::size_t size=file_end-file_begin;
+	recording::index_trailer trailer;
+
+	if (size<sizeof(trailer))
+		return;
+
+	std::memcpy(&trailer, file_end-sizeof(trailer), sizeof(trailer));
+
+	// a recording cut short has no trailer, it's still readable in order
+	if (std::memcmp(trailer.magic, recording::index_magic, sizeof(trailer.magic)))
+		return;
+
+	auto tables_end=size-sizeof(trailer);
+
+	if (compressed())
+	{
+		recording::block_table_trailer table_trailer;
+
+		if (tables_end<sizeof(table_trailer))
+			return;
+
+		tables_end-=sizeof(table_trailer);
+		std::memcpy(&table_trailer, file_begin+tables_end, sizeof(table_trailer));
+
+		if (std::memcmp(table_trailer.magic, recording::block_table_magic, sizeof(table_trailer.magic)) || table_trailer.table_offset>tables_end ||
+			table_trailer.blocks>(tables_end-table_trailer.table_offset)/sizeof(recording::block_entry))
+			return;
+
+		blocks.resize(table_trailer.blocks);
+		std::memcpy(blocks.data(), file_begin+table_trailer.table_offset, blocks.size()*sizeof(recording::block_entry));
+	}
+
+	if (trailer.index_offset>tables_end || trailer.entries>(tables_end-trailer.index_offset)/sizeof(recording::index_entry))
+	{
+		blocks.clear();
+
+		return;
+	}
+
+	index.resize(trailer.entries);
+	std::memcpy(index.data(), file_begin+trailer.index_offset, index.size()*sizeof(recording::index_entry));
+
+	// binary searches need these, a sender restarting or the clock stepping breaks them
+	frames_ordered=std::is_sorted(index.begin(), index.end(), [] (const recording::index_entry &left, const recording::index_entry &right)
+		{
+			return left.frame_id<right.frame_id;
+		});
+	times_ordered=std::is_sorted(index.begin(), index.end(), [] (const recording::index_entry &left, const recording::index_entry &right)
+		{
+			return left.time<right.time;
+		});
+}
+
+bool recording_reader::fill(std::size_t bytes)
+{
+	if (std::size_t(end-cursor)>=bytes)
+		return true;
+
+	// blocks hold whole records
+	if (compressed())
+		return cursor==end && next_block() && std::size_t(end-cursor)>=bytes;
+
+	file_cursor=cursor;
+
+	bool filled=fill_file(bytes);
+
+	begin=file_begin;
+	cursor=file_cursor;
+	end=file_end;
+	buffer_offset=file_buffer_offset;
+
+	return filled;
+}
+
+bool recording_reader::fill_file(std::size_t bytes)
+{
+	if (std::size_t(file_end-file_cursor)>=bytes)
+		return true;
+
+	if (seekable)
+		return false;
+
+	// the rest moves to the front, records never straddle the end of the buffer
+	std::size_t left=file_end-file_cursor;
+
+	std::memmove(file_buffer.data(), file_cursor, left);
+	file_buffer_offset+=file_cursor-file_begin;
+
+	if (file_buffer.size()<bytes)
+		file_buffer.resize(bytes);
+
+	file_begin=file_buffer.data();
+	file_cursor=file_begin;
+	file_end=file_begin+left;
+
+	while (std::size_t(file_end-file_cursor)<bytes)
+	{
+		auto n=::read(fd, file_buffer.data()+(file_end-file_begin), file_buffer.size()-(file_end-file_begin));
+
+		if (n<0 && errno==EINTR)
+			continue;
+
+		if (n<=0)
+			return false;
+
+		file_end+=n;
+	}
+
+	return true;
+}
+
+bool recording_reader::next_block()
+{
+	decode_ahead();
+
+	if (decoding.empty())
+		return false;
+
+	current_block=decoding.front().get();
+	decoding.pop_front();
+	decode_ahead();
+
+	begin=current_block.data.data();
+	cursor=begin;
+	end=begin+current_block.data.size();
+	buffer_offset=current_block.offset;
+
+	return true;
+}
+
+// keeps twice as many blocks decoding as there are threads, so the next one's usually done when it's needed
+void recording_reader::decode_ahead()
+{
+	while (!blocks_ended && decoding.size()<2*threads)
+	{
+		recording::block_header header;
+
+		if (!fill_file(sizeof(header)))
+		{
+			blocks_ended=true;
+
+			break;
+		}
+
+		std::memcpy(&header, file_cursor, sizeof(header));
+
+		// a recording cut short ends with the last whole block
+		if (header.compressed_size==0 || header.size>recording::max_block_size || header.compressed_size>recording::max_block_size ||
+			!fill_file(sizeof(header)+header.compressed_size))
+		{
+			blocks_ended=true;
+
+			break;
+		}
+
+		auto data=file_cursor+sizeof(header);
+		auto offset=next_block_offset;
+
+		// mapped blocks stay put, buffered ones move with the next read
+		if (seekable)
+		{
+			decoding.push_back(pool->submit([data, header, offset]
+				{
+					return decoded_block{ decompress_block_data(data, header.compressed_size, header.size), offset };
+				}));
+		}
+		else
+		{
+			decoding.push_back(pool->submit([data=std::vector<std::uint8_t>(data, data+header.compressed_size), header, offset]
+				{
+					return decoded_block{ decompress_block_data(data.data(), data.size(), header.size), offset };
+				}));
+		}
+
+		file_cursor+=sizeof(header)+header.compressed_size;
+		next_block_offset+=header.size;
+	}
+}
+
+bool recording_reader::read(recorded_packet &packet)
+{
+	if (ended)
+		return false;
+
+	std::uint64_t size;
+
+	if (file_version==1)
+	{
+		std::int64_t time;
+		std::uint32_t size32;
+
+		if (!fill(sizeof(time)+sizeof(size32)))
+		{
+			ended=true;
+
+			return false;
+		}
+
+		std::memcpy(&time, cursor, sizeof(time));
+		std::memcpy(&size32, cursor+sizeof(time), sizeof(size32));
+		cursor+=sizeof(time)+sizeof(size32);
+		packet.time=std::chrono::nanoseconds(time);
+		size=size32;
+	}
+	else
+	{
+		std::uint64_t zigzag;
+
+		// both varints, or what's left of the file
+		fill(20);
+
+		if (!get_varint(size) || size==0 || !get_varint(zigzag))
+		{
+			ended=true;
+
+			return false;
+		}
+
+		--size;
+
+		auto delta=std::int64_t(zigzag >> 1) ^ -std::int64_t(zigzag & 1);
+
+		last_time=rebased_time ? *rebased_time : last_time+delta;
+		rebased_time=boost::none;
+		packet.time=std::chrono::nanoseconds(last_time);
+	}
+
+	if (size>recording::max_payload_size || !fill(size))
+	{
+		ended=true;
+
+		return false;
+	}
+
+	packet.data=cursor;
+	packet.size=size;
+	cursor+=size;
+
+	return true;
+}
+
+bool recording_reader::seek_frame(std::uint32_t frame_id)
+{
+	if (!frames_ordered)
+		return false;
+
+	auto i=std::upper_bound(index.cbegin(), index.cend(), frame_id, [] (std::uint32_t id, const recording::index_entry &entry)
+		{
+			return id<entry.frame_id;
+		});
+
+	return seek_to(i);
+}
+
+bool recording_reader::seek_time(std::chrono::nanoseconds time)
+{
+	if (!times_ordered)
+		return false;
+
+	auto i=std::upper_bound(index.cbegin(), index.cend(), std::int64_t(time.count()), [] (std::int64_t t, const recording::index_entry &entry)
+		{
+			return t<entry.time;
+		});
+
+	return seek_to(i);
+}
+
+// i is the first entry past the target, the one before it is where to start
+bool recording_reader::seek_to(std::vector<recording::index_entry>::const_iterator i)
+{
+	if (i==index.cbegin() || !seekable)
+		return false;
+
+	--i;
+
+	if (!compressed())
+	{
+		if (i->offset>std::uint64_t(end-begin))
+			return false;
+
+		cursor=begin+i->offset;
+	}
+	else
+	{
+		auto block=std::upper_bound(blocks.cbegin(), blocks.cend(), i->offset, [] (std::uint64_t offset, const recording::block_entry &entry)
+			{
+				return offset<entry.offset;
+			});
+
+		if (block==blocks.cbegin() || (--block)->file_offset>std::uint64_t(file_end-file_begin))
+			return false;
+
+		// whatever was decoding ahead is finished unseen
+		decoding.clear();
+		blocks_ended=false;
+		file_cursor=file_begin+block->file_offset;
+		next_block_offset=block->offset;
+
+		if (!next_block() || i->offset-block->offset>std::uint64_t(end-begin))
+			return false;
+
+		cursor=begin+(i->offset-block->offset);
+	}
+
+	rebased_time=i->time;
+	ended=false;
+
+	return true;
+}
+
+bool recording_reader::get_varint(std::uint64_t &value)
+{
+	value=0;
+
+	for (int shift=0; shift<64 && cursor<end; shift+=7)
+	{
+		auto c=*cursor++;
+
+		value|=std::uint64_t(c & 0x7f) << shift;
+
+		if (!(c & 0x80))
+			return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,342 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+namespace netvid
+{
+	// netvid_record files, version 1 is the bare (duration, uint32 size, payload) sequence of old recordings
+	// version 2 starts with a header, its records are varints (size+1, zigzagged time delta) and the payload,
+	// a 0 ends them and an index of where each frame begins trails the file
+	// compressed files hold the same bytes past the header in blocks, each an xz stream of its own with whole records,
+	// a table of the blocks precedes the index, whose offsets are the ones the records would have uncompressed
+	namespace recording
+	{
+		static const char magic[8]={ 'n', 'e', 't', 'v', 'i', 'd', 'r', 'c' };
+		static const char index_magic[8]={ 'n', 'e', 't', 'v', 'i', 'd', 'i', 'x' };
+		static const char block_table_magic[8]={ 'n', 'e', 't', 'v', 'i', 'd', 'b', 't' };
+		static const std::uint32_t version=2;
+		static const std::uint32_t flag_compressed=1;
+		static const std::uint32_t flag_kernel_timestamps=2; // times are from the kernel's receive timestamps rather than the recorder's clock
+		static const std::uint32_t known_flags=flag_compressed | flag_kernel_timestamps;
+		static const std::uint32_t max_payload_size=1024*1024; // larger sizes mean a corrupt file
+		static const std::uint32_t max_block_size=64*1024*1024;
+
+#pragma pack(push)
+#pragma pack(1)
+		struct file_header
+		{
+			char magic[8];
+			std::uint32_t version;
+			std::uint32_t flags=0;
+		};
+
+		struct index_entry
+		{
+			std::uint32_t frame_id;
+			std::int64_t time; // ns since the recording started, of the record at offset
+			std::uint64_t offset; // from the start of the file
+		};
+
+		struct index_trailer
+		{
+			std::uint64_t index_offset;
+			std::uint64_t entries;
+			char magic[8];
+		};
+
+		// a 0 sized block ends the blocks
+		struct block_header
+		{
+			std::uint32_t compressed_size;
+			std::uint32_t size;
+		};
+
+		struct block_entry
+		{
+			std::uint64_t file_offset; // of its header
+			std::uint64_t offset; // of its first record, uncompressed
+		};
+
+		// precedes the index trailer of compressed files
+		struct block_table_trailer
+		{
+			std::uint64_t table_offset;
+			std::uint64_t blocks;
+			char magic[8];
+		};
+#pragma pack(pop)
+	}
+
+	struct block_compression
+	{
+		boost::optional<std::uint32_t> preset; // xz preset [0-9], none writes the records as they are
+		std::size_t block_size=1024*1024; // records are gathered into blocks of about this size
+		unsigned threads=std::max(std::thread::hardware_concurrency(), 1u);
+	};
+
+	struct recorded_packet
+	{
+		std::chrono::nanoseconds time{ 0 };
+		const std::uint8_t *data=nullptr; // points into the reader's mapping, or its buffer until the next read()
+		std::size_t size=0;
+
+		const std::uint8_t *end() const
+		{
+			return data+size;
+		}
+	};
+
+	struct work_pool;
+
+	struct recording_writer
+	{
+		recording_writer(std::ostream &os, const block_compression &compression={}, bool kernel_timestamps=false);
+		~recording_writer();
+
+		void write(std::chrono::nanoseconds time, const std::uint8_t *data_begin, const std::uint8_t *data_end);
+		void flush();
+		void finish(); // ends the records and writes the index, the file is complete afterwards
+
+		std::uint64_t bytes_written() const
+		{
+			return file_offset;
+		}
+
+		bool good() const // false once the stream failed to take a write
+		{
+			return bool(os);
+		}
+
+	private:
+		struct pending_block
+		{
+			std::future<std::vector<std::uint8_t>> compressed;
+			std::uint32_t size;
+			std::uint64_t offset;
+		};
+
+		std::ostream &os;
+		block_compression compression;
+		std::uint64_t offset=0; // as if uncompressed
+		std::uint64_t file_offset=0;
+		std::int64_t last_time=0;
+		boost::optional<std::uint32_t> last_indexed_frame_id;
+		std::vector<recording::index_entry> index;
+		std::vector<std::uint8_t> block; // records the next block gathers
+		std::deque<pending_block> compressing; // written in order as they're done
+		std::vector<recording::block_entry> blocks;
+		std::unique_ptr<work_pool> pool;
+		bool finished=false;
+
+		void put(const void *data, std::size_t size);
+		void put_file(const void *data, std::size_t size);
+		void compress_block();
+		void write_blocks(std::size_t in_flight); // waits until no more than this many blocks are left
+		static std::uint8_t *encode_varint(std::uint8_t *out, std::uint64_t value);
+	};
+
+	// writes a file from a large aligned buffer at explicit offsets, with direct the page cache is bypassed
+	// direct writes stay whole multiples of the alignment until the buffer is closed
+	struct aligned_file_buffer : std::streambuf
+	{
+		static const std::size_t alignment=4096;
+
+		aligned_file_buffer(const std::string &filename, bool direct=false, std::size_t buffer_size=4*1024*1024);
+		~aligned_file_buffer();
+
+		bool close(); // writes the rest, including a direct file's unaligned tail, false if any write failed
+
+		bool is_direct() const
+		{
+			return direct;
+		}
+
+		int error() const // errno of the first failed write, 0 if none failed
+		{
+			return write_error;
+		}
+
+	protected:
+		int_type overflow(int_type c) override;
+		int sync() override;
+
+	private:
+		struct free_deleter
+		{
+			void operator()(char *p) const
+			{
+				std::free(p);
+			}
+		};
+
+		int fd=-1;
+		bool direct;
+		std::size_t buffer_size;
+		std::unique_ptr<char, free_deleter> buffer;
+		std::uint64_t file_offset=0;
+		int write_error=0;
+
+		bool write_out(bool all);
+	};
+
+	// hands packets from the receive thread to a thread of its own that writes them, the receive thread never waits for it
+	// packets that don't fit into the queue are dropped and counted
+	struct write_behind_recorder
+	{
+		struct statistics
+		{
+			std::atomic<std::uint64_t> packets{ 0 };
+			std::atomic<std::uint64_t> dropped{ 0 };
+			std::atomic<std::size_t> queued_high_water{ 0 }; // bytes
+			std::atomic<std::uint64_t> bytes_written{ 0 }; // by the writer, compressed or not
+			std::atomic<bool> write_failed{ false }; // the stream failed a flush, the recording is cut short
+		} stats;
+
+		std::chrono::milliseconds flush_interval{ 1000 }; // the writer flushes when it runs out of packets, this often at most
+
+		write_behind_recorder(recording_writer &writer, std::size_t queue_size=64*1024*1024);
+		~write_behind_recorder();
+
+		bool push(std::chrono::nanoseconds time, const std::uint8_t *data_begin, const std::uint8_t *data_end); // receive thread, false if dropped
+		void stop(); // returns once what's queued is written
+
+	private:
+		// 16 byte aligned in the queue, a size of ~0 skips to the start
+		struct entry_header
+		{
+			std::int64_t time;
+			std::uint32_t size;
+			std::uint32_t reserved;
+		};
+
+		recording_writer &writer;
+		std::size_t queue_size;
+		std::unique_ptr<std::uint8_t[]> queue;
+		alignas(64) std::atomic<std::size_t> head{ 0 }; // bytes pushed ever, the receive thread's
+		alignas(64) std::atomic<std::size_t> tail{ 0 }; // bytes written ever, the writer's
+		std::atomic<bool> writer_waiting{ false };
+		std::atomic<bool> stopping{ false };
+		std::mutex m;
+		std::condition_variable cv;
+		std::thread thread;
+
+		void run();
+	};
+
+	// reads either version, files are mapped and their packets are views into the mapping
+	// streams that can't be mapped (stdin, pipes) go through a buffer in large blocks, they're read in order only
+	// compressed blocks are decompressed ahead on a pool of threads, seeking needs a version 2 index
+	struct recording_reader
+	{
+		static const std::size_t stream_block_size=4*1024*1024;
+
+		recording_reader(const std::string &filename, unsigned threads=std::max(std::thread::hardware_concurrency(), 1u)); // - reads stdin
+		recording_reader(const std::uint8_t *data, std::size_t size, unsigned threads=std::max(std::thread::hardware_concurrency(), 1u)); // a recording already in memory
+		~recording_reader();
+
+		recording_reader(const recording_reader &)=delete;
+		recording_reader &operator=(const recording_reader &)=delete;
+
+		std::uint32_t version() const
+		{
+			return file_version;
+		}
+
+		bool compressed() const
+		{
+			return file_flags & recording::flag_compressed;
+		}
+
+		bool kernel_timestamps() const
+		{
+			return file_flags & recording::flag_kernel_timestamps;
+		}
+
+		bool indexed() const
+		{
+			return !index.empty();
+		}
+
+		// from the start of the file, as if uncompressed
+		std::uint64_t offset() const
+		{
+			return buffer_offset+(cursor-begin);
+		}
+
+		bool read(recorded_packet &packet); // false at the end of the records
+		// once the sender restarted frame_ids run backwards in the index, only seeking by time goes by it then
+		bool seek_frame(std::uint32_t frame_id); // to the latest indexed frame beginning at or before frame_id
+		bool seek_time(std::chrono::nanoseconds time); // to the latest indexed frame beginning at or before time
+
+	private:
+		struct decoded_block
+		{
+			std::vector<std::uint8_t> data;
+			std::uint64_t offset=0;
+		};
+
+		int fd=-1;
+		void *mapping=nullptr;
+		std::size_t mapping_size=0;
+		unsigned threads;
+
+		// the file's bytes, all of it when mapped
+		std::vector<std::uint8_t> file_buffer;
+		const std::uint8_t *file_begin=nullptr;
+		const std::uint8_t *file_cursor=nullptr;
+		const std::uint8_t *file_end=nullptr;
+		std::uint64_t file_buffer_offset=0; // of file_begin
+		bool seekable=false;
+
+		// the records' bytes, the file's own unless compressed
+		const std::uint8_t *begin=nullptr;
+		const std::uint8_t *cursor=nullptr;
+		const std::uint8_t *end=nullptr;
+		std::uint64_t buffer_offset=0; // of begin
+
+		std::uint32_t file_version=1;
+		std::uint32_t file_flags=0;
+		std::int64_t last_time=0;
+		boost::optional<std::int64_t> rebased_time; // seeking lands on a record whose delta is from one never read
+		bool ended=false;
+		std::vector<recording::index_entry> index;
+		bool frames_ordered=false; // the index is sorted by frame_id as well as by time
+		bool times_ordered=false;
+
+		std::vector<recording::block_entry> blocks;
+		std::deque<std::future<decoded_block>> decoding; // the blocks after the current one, as far as read-ahead goes
+		decoded_block current_block;
+		std::uint64_t next_block_offset=0; // uncompressed
+		bool blocks_ended=false;
+		std::unique_ptr<work_pool> pool;
+
+		void open_stream();
+		void read_header();
+		void read_index();
+		bool fill(std::size_t bytes); // true once there are this many bytes past cursor
+		bool fill_file(std::size_t bytes);
+		bool next_block();
+		void decode_ahead();
+		bool seek_to(std::vector<recording::index_entry>::const_iterator i);
+		bool get_varint(std::uint64_t &value);
+	};
+}
+
+#endif /* RECORDING_H */
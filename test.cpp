@@ -1,8 +1,14 @@
 #define BOOST_TEST_MODULE netvid
 #include <boost/test/included/unit_test.hpp>
 
+#include "codec.h"
+#include "frame_scaler.h"
 #include "framebuffer.h"
+#include "linux_framebuffer.h"
+#include "pixel_convert.h"
 #include "protocol.h"
+#include "net.h"
+#include "recording.h"
 
 #define BOOST_TEST_INFO_VAR(var) \
 	BOOST_TEST_INFO("With parameter " #var " = " << (var))
@@ -60,6 +66,253 @@ BOOST_AUTO_TEST_CASE(srgb_linear)
 	BOOST_TEST(to_linear(s({ 0, 0, 0 }))==s({ 0, 0, 0 }));
 }
 
+template<class src_type, class dst_type>
+static void check_conversion(const pixel_format<src_type> &src_fmt, const std::vector<src_type> &src, const pixel_format<dst_type> &dst_fmt)
+{
+	for (auto kernel : { pixel_kernel::scalar, pixel_kernel::sse2, pixel_kernel::avx2 })
+	{
+		if (!pixel_kernel_supported(kernel))
+			continue;
+
+		BOOST_TEST_CONTEXT("With kernel " << pixel_kernel_name(kernel))
+		{
+			std::vector<dst_type> dst(src.size());
+
+			convert_pixels(src_fmt, src.data(), dst_fmt, dst.data(), src.size(), kernel);
+
+			std::size_t mismatches=0;
+
+			for (std::size_t i=0; i<src.size(); ++i)
+			{
+				if (dst[i]!=from_float_srgb(dst_fmt, to_float_srgb(src_fmt, src[i])))
+					++mismatches;
+			}
+
+			BOOST_TEST(mismatches==0);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(pixel_conversion)
+{
+	// every 16-bit value, odd counts so the scalar tails run too
+	std::vector<std::uint16_t> all16(65536+7);
+
+	for (std::size_t i=0; i<all16.size(); ++i)
+		all16[i]=std::uint16_t(i);
+
+	// every 8-bit value in each channel against a few of the others, with alpha set
+	std::vector<std::uint32_t> some32;
+
+	for (std::uint32_t r=0; r<256; r+=3)
+	{
+		for (std::uint32_t g=0; g<256; ++g)
+		{
+			for (std::uint32_t b=(r+g)%5; b<256; b+=5)
+				some32.push_back(0xff000000 | r << 16 | g << 8 | b);
+		}
+	}
+
+	some32.push_back(0xffffffff);
+
+	check_conversion(fmt_a1r5g5b5, all16, fmt_a1r5g5b5);
+	check_conversion(fmt_a1r5g5b5, all16, fmt_r5g6b5);
+	check_conversion(fmt_a1r5g5b5, all16, fmt_a8r8g8b8);
+	check_conversion(fmt_r5g6b5, all16, fmt_a1r5g5b5);
+	check_conversion(fmt_r5g6b5, all16, fmt_r5g6b5);
+	check_conversion(fmt_r5g6b5, all16, fmt_a8r8g8b8);
+	check_conversion(fmt_a8r8g8b8, some32, fmt_a1r5g5b5);
+	check_conversion(fmt_a8r8g8b8, some32, fmt_r5g6b5);
+	check_conversion(fmt_a8r8g8b8, some32, fmt_a8r8g8b8);
+
+	// layouts without a kernel take the generic path
+	static constexpr pixel_format<std::uint16_t> fmt_b5g6r5={ { { { 0, 5 },{ 5, 6 },{ 11, 5 } } } };
+	static constexpr pixel_format<std::uint32_t> fmt_x2r10g10b10={ { { { 20, 10 },{ 10, 10 },{ 0, 10 } } } };
+
+	check_conversion(fmt_r5g6b5, all16, fmt_b5g6r5);
+	check_conversion(fmt_b5g6r5, all16, fmt_x2r10g10b10);
+	check_conversion(fmt_a8r8g8b8, some32, fmt_x2r10g10b10);
+
+	frame_data_managed src;
+	frame_data_managed dst;
+
+	src.resize(33, 5, 70, 16);
+	dst.resize(33, 5, 32);
+
+	for (int y=0; y<src.height; ++y)
+	{
+		for (int x=0; x<src.width; ++x)
+			*src.pixel<std::uint16_t>(x, y)=std::uint16_t(x*2039+y*977);
+	}
+
+	convert_frame(fmt_r5g6b5, src, fmt_a8r8g8b8, dst);
+
+	BOOST_TEST(*dst.pixel<std::uint32_t>(32, 4)==from_float_srgb(fmt_a8r8g8b8, to_float_srgb(fmt_r5g6b5, *src.pixel<std::uint16_t>(32, 4))));
+	BOOST_CHECK_THROW(convert_frame(fmt_a8r8g8b8, src, fmt_r5g6b5, dst), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(srgb_linear_batch)
+{
+	const std::size_t count=(1 << 20)+3;
+	std::vector<float> x(count);
+	std::vector<float> y(count);
+
+	for (std::size_t i=0; i<count; ++i)
+		x[i]=i/float(count-1);
+
+	for (auto kernel : { pixel_kernel::scalar, pixel_kernel::sse2, pixel_kernel::avx2 })
+	{
+		if (!pixel_kernel_supported(kernel))
+			continue;
+
+		BOOST_TEST_CONTEXT("With kernel " << pixel_kernel_name(kernel))
+		{
+			float linear_error=0;
+			float srgb_error=0;
+
+			to_linear(x.data(), y.data(), count, kernel);
+
+			for (std::size_t i=0; i<count; ++i)
+				linear_error=std::max(linear_error, std::abs(y[i]-to_linear(std::array<float, 3>{ { x[i], 0, 0 } })[0]));
+
+			to_srgb(x.data(), y.data(), count, kernel);
+
+			for (std::size_t i=0; i<count; ++i)
+				srgb_error=std::max(srgb_error, std::abs(y[i]-to_srgb(std::array<float, 3>{ { x[i], 0, 0 } })[0]));
+
+			BOOST_TEST(linear_error<=max_transfer_error);
+			BOOST_TEST(srgb_error<=max_transfer_error);
+
+			float out_of_range[]={ -1, 2, 0, 1 };
+
+			to_srgb(out_of_range, out_of_range, 4, kernel);
+
+			BOOST_TEST(out_of_range[0]==0);
+			BOOST_TEST(std::abs(out_of_range[1]-1)<=max_transfer_error);
+			BOOST_TEST(out_of_range[2]==0);
+			BOOST_TEST(std::abs(out_of_range[3]-1)<=max_transfer_error);
+		}
+	}
+
+	// tables give the reference results, and the float path gets them back to the same pixels
+	std::vector<std::uint16_t> all16(65536);
+	std::vector<std::array<float, 3>> linear(all16.size());
+	std::vector<std::uint16_t> back(all16.size());
+
+	for (std::size_t i=0; i<all16.size(); ++i)
+		all16[i]=std::uint16_t(i);
+
+	pixels_to_linear(fmt_r5g6b5, all16.data(), linear.data(), all16.size());
+	linear_to_pixels(linear.data(), fmt_r5g6b5, back.data(), back.size());
+
+	std::size_t mismatches=0;
+
+	for (std::size_t i=0; i<all16.size(); ++i)
+	{
+		if (linear[i]!=to_linear(to_float_srgb(fmt_r5g6b5, all16[i])))
+			++mismatches;
+	}
+
+	BOOST_TEST(mismatches==0);
+	BOOST_TEST(back==all16);
+
+	std::vector<std::uint32_t> all8(256);
+	std::vector<std::array<float, 3>> linear8(all8.size());
+	std::vector<std::uint32_t> back8(all8.size());
+
+	for (std::uint32_t i=0; i<all8.size(); ++i)
+		all8[i]=(255-i) << 16 | i << 8 | (i*7 & 0xff);
+
+	pixels_to_linear(fmt_a8r8g8b8, all8.data(), linear8.data(), all8.size());
+	linear_to_pixels(linear8.data(), fmt_a8r8g8b8, back8.data(), back8.size());
+
+	BOOST_TEST(back8==all8);
+}
+
+template<class pixel_type>
+static void check_scaled(const frame_data &src, const frame_data &screen, const pixel_format<pixel_type> &screen_fmt, int left, int width)
+{
+	int mismatched=0;
+
+	for (int y=0; y<screen.height; ++y)
+	{
+		for (int x=0; x<screen.width; ++x)
+		{
+			pixel_type expected=0;
+
+			if (x>=left && x<left+width)
+			{
+				auto src_x=(2*(x-left)+1)*src.width/(2*width);
+				auto src_y=(2*y+1)*src.height/(2*screen.height);
+
+				convert_pixels(fmt_a8r8g8b8, src.pixel<std::uint32_t>(src_x, src_y), screen_fmt, &expected, 1, pixel_kernel::scalar);
+			}
+
+			if (*screen.pixel<pixel_type>(x, y)!=expected)
+				++mismatched;
+		}
+	}
+
+	BOOST_TEST(mismatched==0);
+}
+
+BOOST_AUTO_TEST_CASE(frame_scaler_screen_depths)
+{
+	auto filename="/tmp/netvid_test_"+std::to_string(getpid())+".fb";
+	frame_data_managed src;
+
+	src.resize(40, 30, 32);
+
+	for (int y=0; y<src.height; ++y)
+	{
+		for (int x=0; x<src.width; ++x)
+			*src.pixel<std::uint32_t>(x, y)=0xff000000u | (x*6) << 16 | (y*8) << 8 | ((x+y)*3);
+	}
+
+	// a 4:3 frame on a 100x60 screen is 80 wide, letterboxed from x=10
+	for (int bpp : { 16, 32 })
+	{
+		BOOST_TEST_INFO_VAR(bpp);
+
+		{
+			linux_framebuffer fb(filename, 100, 60, true, bpp);
+			frame_scaler scaler;
+
+			BOOST_TEST(fb.screen.pitch==100*bpp/8);
+			BOOST_TEST(scaler.scale(src, fb.back_page, fb.channels));
+
+			if (bpp==16)
+				check_scaled(src, fb.back_page, fmt_r5g6b5, 10, 80);
+			else
+				check_scaled(src, fb.back_page, fmt_a8r8g8b8, 10, 80);
+		}
+
+		struct stat st;
+
+		BOOST_TEST(stat(filename.c_str(), &st)==0);
+		BOOST_TEST(st.st_size==2*100*60*bpp/8);
+	}
+
+	std::remove(filename.c_str());
+
+	// a depth that isn't converted is left alone
+	std::vector<std::uint8_t> pixels(100*60*3, 0x55);
+	frame_data screen;
+
+	screen.data=pixels.data();
+	screen.width=100;
+	screen.height=60;
+	screen.pitch=300;
+	screen.bpp=24;
+
+	frame_scaler scaler;
+
+	BOOST_TEST(!frame_scaler::screen_supported(screen));
+	BOOST_TEST(!scaler.scale(src, screen, fmt_a8r8g8b8.channels));
+	BOOST_TEST(std::all_of(pixels.begin(), pixels.end(), [] (std::uint8_t b) { return b==0x55; }));
+	BOOST_CHECK_THROW(linux_framebuffer(filename, 100, 60, false, 24), std::invalid_argument);
+}
+
 BOOST_AUTO_TEST_CASE(frame_div)
 {
 	const int width=640;
@@ -114,3 +367,1740 @@ BOOST_AUTO_TEST_CASE(frame_div)
 		}
 	}
 }
+
+BOOST_AUTO_TEST_CASE(frame_div_strips)
+{
+	const int data_size=1400;
+
+	for (auto mode : { std::make_tuple(640, 480, 16), std::make_tuple(1920, 1080, 32), std::make_tuple(3840, 2160, 32), std::make_tuple(333, 7, 24) })
+	{
+		int width;
+		int height;
+		int bpp;
+
+		std::tie(width, height, bpp)=mode;
+
+		BOOST_TEST_CONTEXT("With mode " << width << "x" << height << " " << bpp << "bpp")
+		{
+			const int pitch=calc_pitch(width, bpp);
+			int w_div=0;
+			int h_div=0;
+
+			std::tie(w_div, h_div)=get_frame_divisions(width, height, bpp, data_size, chunk_layout::strips);
+
+			// rows are only split when a single row doesn't fit
+			BOOST_TEST((w_div==1)==(pitch<=data_size));
+
+			if (w_div>1)
+				BOOST_TEST(h_div==height);
+
+			int rows_covered=0;
+
+			for (int h=0; h<h_div; ++h)
+			{
+				int pixels_covered=0;
+				int h_begin=0;
+				int h_end=0;
+
+				for (int w=0; w<w_div; ++w)
+				{
+					int w_begin=0;
+					int w_end=0;
+
+					std::tie(h_begin, w_begin, h_end, w_end)=get_chunk(width, height, w_div, h_div, h, w);
+
+					BOOST_TEST(w_begin==pixels_covered);
+					BOOST_TEST(h_begin==rows_covered);
+					BOOST_TEST(calc_pitch(w_end-w_begin, bpp)*(h_end-h_begin)<=data_size);
+
+					pixels_covered=w_end;
+				}
+
+				BOOST_TEST(pixels_covered==width);
+
+				rows_covered=h_end;
+			}
+
+			BOOST_TEST(rows_covered==height);
+		}
+	}
+}
+
+static std::vector<std::uint8_t> make_chunk_packet(std::uint32_t frame_id, std::uint32_t chunk_id, std::uint32_t frame_chunks, std::uint32_t flags=0)
+{
+	remote_chunk_header rch;
+
+	rch.pkt_id|=flags;
+	rch.frame_id=frame_id;
+	rch.chunk_id=chunk_id;
+	rch.frame_chunks=frame_chunks;
+
+	auto begin=reinterpret_cast<const std::uint8_t *>(&rch);
+
+	return std::vector<std::uint8_t>(begin, begin+sizeof(rch));
+}
+
+BOOST_AUTO_TEST_CASE(chunk_validator_delta)
+{
+	netvid::chunk_validator validator;
+	std::vector<std::uint32_t> completed;
+
+	validator.frame_completed=[&] (std::uint32_t frame_id)
+	{
+		completed.push_back(frame_id);
+	};
+
+	auto process=[&] (const std::vector<std::uint8_t> &pkt)
+	{
+		return validator.process(pkt.data(), pkt.data()+pkt.size(), boost::asio::ip::udp::endpoint());
+	};
+
+	// full frame of 4 chunks
+	for (std::uint32_t i=0; i<4; ++i)
+		BOOST_TEST(process(make_chunk_packet(0, i, 4)));
+
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 0 }));
+
+	// delta frame sending 2 of the 4 chunks, a duplicate doesn't count twice
+	BOOST_TEST(process(make_chunk_packet(1, 3, 2, pkt_flag_delta)));
+	BOOST_TEST(process(make_chunk_packet(1, 3, 2, pkt_flag_delta)));
+	BOOST_TEST(completed.size()==1);
+	BOOST_TEST(process(make_chunk_packet(1, 1, 2, pkt_flag_delta)));
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 0, 1 }));
+
+	// out of range chunks and unknown flags are rejected
+	BOOST_TEST(!process(make_chunk_packet(2, 4, 4)));
+	BOOST_TEST(!process(make_chunk_packet(2, 0, 4, 1 << 31)));
+}
+
+BOOST_AUTO_TEST_CASE(chunk_validator_late_copies)
+{
+	netvid::chunk_validator validator;
+	std::vector<std::uint32_t> completed;
+
+	validator.frame_completed=[&] (std::uint32_t frame_id)
+	{
+		completed.push_back(frame_id);
+	};
+
+	auto process=[&] (const std::vector<std::uint8_t> &pkt)
+	{
+		return validator.process(pkt.data(), pkt.data()+pkt.size(), boost::asio::ip::udp::endpoint());
+	};
+
+	for (std::uint32_t i=0; i<2; ++i)
+		BOOST_TEST(process(make_chunk_packet(5, i, 2)));
+
+	// a retransmitted chunk of the completed frame, or of an older one, doesn't start it over
+	BOOST_TEST(!process(make_chunk_packet(5, 1, 2)));
+	BOOST_TEST(!process(make_chunk_packet(4, 0, 2)));
+	BOOST_TEST(!validator.frame_id);
+
+	BOOST_TEST(process(make_chunk_packet(6, 0, 2)));
+	BOOST_TEST(process(make_chunk_packet(6, 1, 2)));
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 5, 6 }));
+}
+
+BOOST_AUTO_TEST_CASE(chunk_validator_reorder_window)
+{
+	netvid::chunk_validator validator;
+	std::vector<std::uint32_t> completed;
+	std::vector<std::uint32_t> chunks_seen;
+
+	validator.reorder.window=3;
+	validator.reorder.tolerance=2;
+	validator.reorder.deadline=std::chrono::hours(1);
+
+	validator.frame_completed=[&] (std::uint32_t frame_id)
+	{
+		completed.push_back(frame_id);
+	};
+
+	validator.on_chunk=[&] (const remote_chunk_header &header, const std::uint8_t *, int)
+	{
+		chunks_seen.push_back(header.frame_id*10+header.chunk_id);
+	};
+
+	auto process=[&] (const std::vector<std::uint8_t> &pkt)
+	{
+		return validator.process(pkt.data(), pkt.data()+pkt.size(), boost::asio::ip::udp::endpoint());
+	};
+
+	// a chunk of the next frame overtaking the last of this one doesn't end it, and is seen after it
+	BOOST_TEST(process(make_chunk_packet(0, 0, 2)));
+	BOOST_TEST(process(make_chunk_packet(1, 0, 2)));
+	BOOST_TEST(completed.empty());
+	BOOST_TEST(process(make_chunk_packet(0, 1, 2)));
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 0 }));
+	BOOST_TEST(chunks_seen==std::vector<std::uint32_t>({ 0, 1, 10 }));
+	BOOST_TEST(*validator.frame_id==1u);
+
+	// a later frame arriving complete waits for the earlier one too
+	BOOST_TEST(process(make_chunk_packet(2, 0, 1)));
+	BOOST_TEST(process(make_chunk_packet(1, 1, 2)));
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 0, 1, 2 }));
+	BOOST_TEST(chunks_seen==std::vector<std::uint32_t>({ 0, 1, 10, 11, 20 }));
+	BOOST_TEST(!validator.frame_id);
+
+	// past the tolerance the oldest frame is given up with its holes
+	BOOST_TEST(process(make_chunk_packet(3, 0, 2)));
+	BOOST_TEST(process(make_chunk_packet(4, 0, 2)));
+	BOOST_TEST(process(make_chunk_packet(4, 1, 2)));
+	BOOST_TEST(completed.size()==3);
+	BOOST_TEST(process(make_chunk_packet(5, 0, 2)));
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 0, 1, 2, 3, 4 }));
+	BOOST_TEST(*validator.frame_id==5u);
+	BOOST_TEST(!process(make_chunk_packet(3, 1, 2)));
+
+	// as is one the new frame is a window ahead of
+	BOOST_TEST(process(make_chunk_packet(8, 0, 2)));
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 0, 1, 2, 3, 4, 5 }));
+	BOOST_TEST(*validator.frame_id==8u);
+
+	// or once its deadline passed
+	validator.reorder.deadline=std::chrono::milliseconds(0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	BOOST_TEST(process(make_chunk_packet(9, 0, 2)));
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 0, 1, 2, 3, 4, 5, 8 }));
+	BOOST_TEST(*validator.frame_id==9u);
+
+	// a stream that stalls gives up the oldest frame through expire()
+	validator.reorder.deadline=std::chrono::milliseconds(20);
+	BOOST_TEST(process(make_chunk_packet(10, 0, 2)));
+	validator.expire();
+	BOOST_TEST(completed.size()==7);
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	validator.expire();
+	BOOST_TEST(completed==std::vector<std::uint32_t>({ 0, 1, 2, 3, 4, 5, 8, 9 }));
+	BOOST_TEST(*validator.frame_id==10u);
+
+	// a later frame starting over with another chunk count lets go of the chunks it held
+	validator.reorder.deadline=std::chrono::hours(1);
+	chunks_seen.clear();
+	BOOST_TEST(process(make_chunk_packet(11, 0, 3)));
+	BOOST_TEST(process(make_chunk_packet(11, 1, 2)));
+	BOOST_TEST(process(make_chunk_packet(10, 1, 2)));
+	BOOST_TEST(completed.back()==10u);
+	BOOST_TEST(chunks_seen==std::vector<std::uint32_t>({ 101, 111 }));
+	BOOST_TEST(validator.chunks_count==1u);
+
+	// frames aren't kept in flight unless asked for
+	BOOST_TEST(netvid::chunk_validator().reorder.window==1u);
+}
+
+BOOST_AUTO_TEST_CASE(packet_batch_skips_failed)
+{
+	using namespace boost::asio::ip;
+
+	netvid::io_service_wrapper service;
+	netvid::socket_wrapper socket(service.io_service);
+	udp::socket destination(service.io_service, udp::endpoint(address_v4::loopback(), 0));
+
+	socket.bind(udp::endpoint(address_v4::loopback(), 0));
+	service.run();
+
+	// the middle datagram exceeds what udp can carry, the others still go out and the batch succeeds
+	std::vector<std::uint8_t> small(100, 1);
+	std::vector<std::uint8_t> too_large(70000, 2);
+	netvid::packet_batch batch;
+	auto endpoint=destination.local_endpoint();
+
+	batch.add(std::array<boost::asio::const_buffer, 1>({ { boost::asio::buffer(small) } }));
+	batch.add(std::array<boost::asio::const_buffer, 1>({ { boost::asio::buffer(too_large) } }));
+	batch.add(std::array<boost::asio::const_buffer, 1>({ { boost::asio::buffer(small) } }));
+
+	std::promise<std::pair<boost::system::error_code, std::size_t>> done;
+	auto done_future=done.get_future();
+
+	service.io_service.post([&]
+	{
+		netvid::async_send_batch(socket, endpoint, batch, [&] (const boost::system::error_code &error, std::size_t bytes_transferred)
+		{
+			done.set_value({ error, bytes_transferred });
+		});
+	});
+
+	auto result=done_future.get();
+
+	BOOST_TEST(!result.first);
+	BOOST_TEST(result.second==2*small.size());
+	BOOST_TEST(batch.done());
+	BOOST_TEST(batch.failed==1u);
+	BOOST_TEST(batch.failure==boost::system::errc::message_size);
+
+	std::vector<std::uint8_t> received(128);
+
+	for (int i=0; i<2; ++i)
+		BOOST_TEST(destination.receive(boost::asio::buffer(received))==small.size());
+
+	service.io_service.stop();
+	service.stop();
+}
+
+BOOST_AUTO_TEST_CASE(rate_limited_sender_pacing)
+{
+	using namespace boost::asio::ip;
+
+	netvid::io_service_wrapper service;
+	netvid::socket_wrapper socket(service.io_service);
+	udp::socket destination(service.io_service, udp::endpoint(address_v4::loopback(), 0));
+
+	socket.bind(udp::endpoint(address_v4::loopback(), 0));
+	service.run();
+
+	auto pacer=std::make_unique<netvid::rate_limited_sender>(socket);
+
+	pacer->remote_endpoint=destination.local_endpoint();
+	pacer->max_rate_bytes=1024*1024;
+	pacer->burst_bytes=16*1024;
+	pacer->begin_frame(0);
+
+	std::vector<std::uint8_t> packet(1000);
+
+	auto send=[&] (netvid::packet_batch &batch)
+	{
+		std::promise<boost::system::error_code> done;
+		auto done_future=done.get_future();
+		auto start=std::chrono::steady_clock::now();
+
+		service.io_service.post([&]
+		{
+			pacer->send_batch(batch, [&] (const boost::system::error_code &error, std::size_t) { done.set_value(error); });
+		});
+
+		auto error=done_future.get();
+
+		return std::make_pair(error, std::chrono::steady_clock::now()-start);
+	};
+
+	// under the burst it goes out straight away
+	netvid::packet_batch small;
+
+	for (int i=0; i<8; ++i)
+		small.add(std::array<boost::asio::const_buffer, 1>({ { boost::asio::buffer(packet) } }));
+
+	auto result=send(small);
+
+	BOOST_TEST(!result.first);
+	BOOST_TEST(small.done());
+	BOOST_TEST((result.second<std::chrono::milliseconds(50)));
+
+	// 200 KB at 1 MiB/s waits for the bucket to refill, the first burst and what's left of it go out early
+	netvid::packet_batch large;
+
+	for (int i=0; i<200; ++i)
+		large.add(std::array<boost::asio::const_buffer, 1>({ { boost::asio::buffer(packet) } }));
+
+	result=send(large);
+
+	BOOST_TEST(!result.first);
+	BOOST_TEST(large.done());
+	BOOST_TEST((result.second>std::chrono::milliseconds(120)));
+	BOOST_TEST((result.second<std::chrono::seconds(2)));
+
+	// a packet larger than the burst leaves the bucket in debt, the pacer goes while the rest waits for it
+	udp::socket aborted_destination(service.io_service, udp::endpoint(address_v4::loopback(), 0));
+	std::vector<std::uint8_t> large_packet(60000);
+	netvid::packet_batch aborted;
+	std::promise<boost::system::error_code> done;
+	auto done_future=done.get_future();
+
+	aborted.add(std::array<boost::asio::const_buffer, 1>({ { boost::asio::buffer(large_packet) } }));
+	aborted.add(std::array<boost::asio::const_buffer, 1>({ { boost::asio::buffer(packet) } }));
+
+	service.io_service.post([&]
+	{
+		pacer->remote_endpoint=aborted_destination.local_endpoint();
+		pacer->max_rate_bytes=100*1024;
+		pacer->begin_frame(0);
+		pacer->send_batch(aborted, [&] (const boost::system::error_code &error, std::size_t) { done.set_value(error); });
+	});
+
+	BOOST_TEST(aborted_destination.receive(boost::asio::buffer(large_packet))==large_packet.size());
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	service.io_service.post([&] { pacer.reset(); });
+
+	BOOST_TEST((done_future.wait_for(std::chrono::seconds(2))==std::future_status::ready));
+	BOOST_TEST((done_future.get()==boost::asio::error::operation_aborted));
+	BOOST_TEST(!aborted.done());
+
+	service.io_service.stop();
+	service.stop();
+}
+
+BOOST_AUTO_TEST_CASE(sender_submit_latest_wins)
+{
+	using namespace boost::asio::ip;
+
+	netvid::io_service_wrapper receiver_service;
+	netvid::socket_wrapper receiver_socket(receiver_service.io_service);
+
+	receiver_socket.bind(udp::endpoint(address_v4::loopback(), 0));
+
+	netvid::frame_receiver receiver(receiver_socket);
+
+	receiver.start();
+	receiver_service.run();
+
+	netvid::io_service_wrapper sender_service;
+	netvid::socket_wrapper sender_socket(sender_service.io_service);
+	netvid::sender<netvid::unlimited_sender> sender(sender_socket);
+
+	sender.set_remote_endpoint(receiver_socket.socket.local_endpoint());
+	sender_service.run();
+
+	// the io thread is held up while frames are submitted, each replaces the one queued before it
+	std::promise<void> release;
+	auto released=release.get_future().share();
+
+	sender_service.io_service.post([released] { released.wait(); });
+
+	std::vector<std::shared_ptr<frame_data_managed>> frames;
+	std::vector<std::future<bool>> sent;
+
+	for (std::uint32_t n=0; n<5; ++n)
+	{
+		auto frame=std::make_shared<frame_data_managed>();
+
+		frame->resize(64, 48, 32);
+		std::fill(frame->data, frame->end(), std::uint8_t(n+1));
+		frames.push_back(frame);
+		sent.push_back(sender.submit(frame));
+	}
+
+	release.set_value();
+
+	for (std::size_t n=0; n<sent.size(); ++n)
+	{
+		BOOST_TEST_INFO_VAR(n);
+		BOOST_TEST((sent[n].wait_for(std::chrono::seconds(2))==std::future_status::ready));
+		BOOST_TEST(sent[n].get()==(n+1==sent.size()));
+	}
+
+	BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+	BOOST_TEST(std::equal(frames.back()->data, frames.back()->end(), receiver.front_buffer.data));
+
+	auto stats=sender.get_queue_stats();
+
+	BOOST_TEST(stats.submitted==5u);
+	BOOST_TEST(stats.sent==1u);
+	BOOST_TEST(stats.dropped==4u);
+
+	// nothing is left hanging once the socket is closed, queued or passed to send()
+	std::promise<void> closed;
+
+	sender_service.io_service.post([&] { sender_socket.socket.close(); closed.set_value(); });
+	closed.get_future().wait();
+
+	auto late=sender.submit(frames.front());
+
+	BOOST_TEST((late.wait_for(std::chrono::seconds(2))==std::future_status::ready));
+	BOOST_TEST(!late.get());
+
+	std::promise<void> pr;
+	auto pr_future=pr.get_future();
+
+	sender_service.io_service.post([&] { sender.send(*frames.front(), pr); });
+
+	BOOST_TEST((pr_future.wait_for(std::chrono::seconds(2))==std::future_status::ready));
+
+	receiver_service.io_service.stop();
+	sender_service.io_service.stop();
+	receiver_service.stop();
+	sender_service.stop();
+}
+
+BOOST_AUTO_TEST_CASE(sender_zero_copy_keep_alive)
+{
+	using namespace boost::asio::ip;
+
+	netvid::io_service_wrapper receiver_service;
+	netvid::socket_wrapper receiver_socket(receiver_service.io_service);
+
+	receiver_socket.bind(udp::endpoint(address_v4::loopback(), 0));
+
+	netvid::frame_receiver receiver(receiver_socket);
+
+	receiver.start();
+	receiver_service.run();
+
+	netvid::io_service_wrapper sender_service;
+	netvid::socket_wrapper sender_socket(sender_service.io_service);
+	netvid::sender<netvid::unlimited_sender> sender(sender_socket);
+
+	sender.set_remote_endpoint(receiver_socket.socket.local_endpoint());
+	sender.zero_copy=true;
+	sender_service.run();
+
+	frame_data_managed expected;
+
+	expected.resize(160, 120, 32);
+
+	for (int y=0; y<120; ++y)
+	{
+		for (int x=0; x<160; ++x)
+			*expected.pixel<std::uint32_t>(x, y)=x*1000+y;
+	}
+
+	// the frame is scribbled over as it goes, chunks sent from it after that would show
+	std::atomic<bool> released{ false };
+	auto frame=std::shared_ptr<frame_data_managed>(new frame_data_managed, [&released] (frame_data_managed *f)
+	{
+		std::fill(f->data, f->end(), 0xee);
+		released=true;
+		delete f;
+	});
+
+	frame->resize(160, 120, 32);
+	std::copy(expected.data, expected.end(), frame->data);
+
+	std::promise<void> sent;
+	auto sent_future=sent.get_future();
+
+	// the caller lets go of the frame right after handing it over, before any chunk is sent
+	sender_service.io_service.post([&]
+	{
+		sender.send(std::shared_ptr<const frame_data>(std::move(frame)), sent);
+
+		BOOST_TEST(!released);
+	});
+
+	BOOST_TEST((sent_future.wait_for(std::chrono::seconds(2))==std::future_status::ready));
+	BOOST_TEST(released);
+
+	BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+
+	{
+		auto lock=receiver.lock_front_buffer();
+
+		BOOST_TEST(std::equal(expected.data, expected.end(), receiver.front_buffer.data));
+	}
+
+	receiver_service.io_service.stop();
+	sender_service.io_service.stop();
+	receiver_service.stop();
+	sender_service.stop();
+}
+
+BOOST_AUTO_TEST_CASE(frame_receiver_delta_frames)
+{
+	using namespace boost::asio::ip;
+
+	for (int mode=0; mode<4; ++mode)
+	{
+		int batch_size=mode%2 ? 16 : 1;
+		bool inline_assembly=mode>=2;
+
+		BOOST_TEST_INFO_VAR(batch_size);
+		BOOST_TEST_INFO_VAR(inline_assembly);
+
+		netvid::io_service_wrapper receiver_service;
+		netvid::socket_wrapper receiver_socket(receiver_service.io_service);
+
+		receiver_socket.bind(udp::endpoint(address_v4::loopback(), 0));
+
+		netvid::frame_receiver receiver(receiver_socket);
+		std::atomic<int> frames{ 0 };
+
+		// received in place with batches, into slabs that start too small, or assembled on the io thread
+		receiver.batch_size=batch_size;
+		receiver.ring_slots=8;
+		receiver.inline_assembly=inline_assembly;
+		receiver.on_frame=[&] { ++frames; };
+		receiver.start();
+		receiver_service.run();
+
+		netvid::io_service_wrapper sender_service;
+		netvid::socket_wrapper sender_socket(sender_service.io_service);
+		netvid::sender<netvid::unlimited_sender> sender(sender_socket);
+
+		sender.set_remote_endpoint(receiver_socket.socket.local_endpoint());
+		sender.delta=true;
+		sender_service.run();
+
+		frame_data_managed frame;
+
+		frame.resize(160, 120, 32);
+
+		boost::optional<std::uint32_t> front_frame_id;
+
+		// chunks left out of a delta frame are carried over from older frames, also across a change of layout
+		for (int n=0; n<8; ++n)
+		{
+			BOOST_TEST_INFO_VAR(n);
+
+			if (n==4)
+				sender.layout=chunk_layout::strips;
+
+			for (int y=n*10; y<n*10+15; ++y)
+			{
+				for (int x=n*5; x<n*5+40; ++x)
+					*frame.pixel<std::uint32_t>(x, y)=n*1000+x+y;
+			}
+
+			std::promise<void> sent;
+			auto sent_future=sent.get_future();
+
+			sender_service.io_service.post([&] { sender.send(frame, sent); });
+			sent_future.wait();
+
+			// both ways of taking frames from the io thread
+			if (n%2==0)
+			{
+				for (int tries=0; frames<=n && tries<20; ++tries)
+				{
+					if (receiver.wait_for_frame(std::chrono::milliseconds(100)))
+						receiver.process_packets();
+				}
+
+				BOOST_TEST(receiver.acquire_frame());
+			}
+			else
+				BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+
+			BOOST_TEST(!receiver.acquire_frame());
+
+			// inline on_frame follows the flip on the io thread
+			for (int tries=0; frames<=n && tries<100; ++tries)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+			BOOST_TEST(frames==n+1);
+
+			auto lock=receiver.lock_front_buffer();
+
+			BOOST_TEST(receiver.front_buffer.bytes()==frame.bytes());
+			BOOST_TEST(std::equal(frame.data, frame.end(), receiver.front_buffer.data));
+			BOOST_TEST((receiver.get_front_frame_id() && (!front_frame_id || *receiver.get_front_frame_id()>*front_frame_id)));
+
+			front_frame_id=receiver.get_front_frame_id();
+		}
+
+		// frames flipped meanwhile are skipped, the one acquired is whole
+		for (int n=8; n<12; ++n)
+		{
+			BOOST_TEST_INFO_VAR(n);
+
+			for (int y=n*8; y<n*8+12; ++y)
+			{
+				for (int x=n*6; x<n*6+30; ++x)
+					*frame.pixel<std::uint32_t>(x, y)=n*1000+x+y;
+			}
+
+			std::promise<void> sent;
+			auto sent_future=sent.get_future();
+
+			sender_service.io_service.post([&] { sender.send(frame, sent); });
+			sent_future.wait();
+
+			if (!inline_assembly)
+				receiver.wait_for_frame(std::chrono::seconds(2));
+
+			for (int tries=0; frames<=n && tries<200; ++tries)
+			{
+				if (!inline_assembly)
+					receiver.process_packets();
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			BOOST_TEST(frames==n+1);
+		}
+
+		BOOST_TEST(receiver.acquire_frame());
+		BOOST_TEST(!receiver.acquire_frame());
+		BOOST_TEST(std::equal(frame.data, frame.end(), receiver.front_buffer.data));
+
+		// a chunk that doesn't decode leaves the last frame's pixels in its frame, and isn't taken as current by the next ones
+		udp::socket raw_sender(sender_service.io_service, udp::endpoint(address_v4::loopback(), 0));
+		auto frame_id=*receiver.get_front_frame_id()+1;
+		frame_data_managed shown;
+
+		shown.resize(160, 120, 32);
+		std::copy(frame.data, frame.end(), shown.data);
+
+		// two chunks of 40x8 in the corner, small enough for the receive slots
+		auto send_chunk=[&] (std::uint32_t chunk_id, std::uint32_t frame_chunks, std::uint32_t flags, std::uint32_t value, bool corrupt)
+		{
+			auto pkt=make_chunk_packet(frame_id, chunk_id, frame_chunks, flags);
+			auto &rch=*reinterpret_cast<remote_chunk_header *>(pkt.data());
+
+			rch.y=chunk_id*8;
+			rch.width=40;
+			rch.height=8;
+			rch.pitch=40*4;
+			rch.bpp=32;
+
+			for (std::uint32_t y=rch.y; y<rch.y+8; ++y)
+			{
+				for (int x=0; x<40; ++x)
+					*frame.pixel<std::uint32_t>(x, y)=value+x*7+y*13;
+			}
+
+			if (corrupt)
+			{
+				std::vector<std::uint8_t> encoded(rch.pitch*rch.height*2);
+				auto size=netvid::rle_encode(frame.pixel<std::uint8_t>(0, rch.y), frame.pitch, rch.pitch, rch.height, netvid::codec_unit_size(32, rch.pitch), encoded.data(), encoded.size());
+
+				// cut short, half of it lands before the decoder notices
+				rch.pkt_id|=pkt_flag_compressed;
+				pkt.insert(pkt.end(), encoded.data(), encoded.data()+size/2);
+			}
+			else
+			{
+				for (std::uint32_t y=rch.y; y<rch.y+8; ++y)
+				{
+					pkt.insert(pkt.end(), frame.pixel<std::uint8_t>(0, y), frame.pixel<std::uint8_t>(40, y));
+					std::copy(frame.pixel<std::uint8_t>(0, y), frame.pixel<std::uint8_t>(40, y), shown.pixel<std::uint8_t>(0, y));
+				}
+			}
+
+			raw_sender.send_to(boost::asio::buffer(pkt), receiver_socket.socket.local_endpoint());
+		};
+
+		for (int n=0; n<4; ++n, ++frame_id)
+		{
+			BOOST_TEST_INFO_VAR(n);
+
+			if (n<2)
+			{
+				send_chunk(0, 2, 0, n*1000000, false);
+				send_chunk(1, 2, 0, n*1000000+500000, n==1);
+			}
+			else
+				send_chunk(0, 1, pkt_flag_delta, n*1000000, false);
+
+			BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+
+			auto lock=receiver.lock_front_buffer();
+
+			BOOST_TEST(std::equal(shown.data, shown.end(), receiver.front_buffer.data));
+		}
+
+		receiver_service.io_service.stop();
+		sender_service.io_service.stop();
+		receiver_service.stop();
+		sender_service.stop();
+
+		BOOST_TEST((receiver.ring_stats.grown>0)==!inline_assembly);
+		BOOST_TEST(receiver.ring_stats.dropped==0);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(frame_receiver_nack_retransmit)
+{
+	using namespace boost::asio::ip;
+
+	netvid::io_service_wrapper receiver_service;
+	netvid::socket_wrapper receiver_socket(receiver_service.io_service);
+
+	receiver_socket.bind(udp::endpoint(address_v4::loopback(), 0));
+
+	// nacks on with the default reorder window, which they raise
+	netvid::frame_receiver receiver(receiver_socket);
+
+	receiver.batch_size=1;
+	receiver.nack_deadline=std::chrono::milliseconds(500);
+	receiver.start();
+	receiver_service.run();
+
+	// between the two, drops the first frame's last chunk once and holds back the second frame after its first chunk
+	boost::asio::io_service relay_service;
+	udp::socket relay(relay_service, udp::endpoint(address_v4::loopback(), 0));
+	udp::socket control(relay_service, udp::endpoint(address_v4::loopback(), 0));
+	auto receiver_endpoint=receiver_socket.socket.local_endpoint();
+	std::atomic<int> nacks_relayed{ 0 };
+	std::atomic<int> retransmits_relayed{ 0 };
+
+	std::thread relay_thread([&]
+	{
+		std::vector<std::uint8_t> buffer(64*1024);
+		std::vector<std::vector<std::uint8_t>> held;
+		udp::endpoint sender_endpoint;
+		boost::optional<std::uint32_t> first_frame_id;
+		bool dropped=false;
+
+		for (;;)
+		{
+			udp::endpoint from;
+			auto size=relay.receive_from(boost::asio::buffer(buffer), from);
+
+			if (from==control.local_endpoint())
+			{
+				if (buffer[0]=='s')
+					break;
+
+				for (const auto &pkt : held)
+					relay.send_to(boost::asio::buffer(pkt), receiver_endpoint);
+
+				held.clear();
+
+				continue;
+			}
+
+			auto pkt_id=reinterpret_cast<const remote_header *>(buffer.data())->pkt_id;
+
+			if (from==receiver_endpoint)
+			{
+				if (pkt_type(pkt_id)==remote_nack_header().pkt_id)
+					++nacks_relayed;
+
+				relay.send_to(boost::asio::buffer(buffer.data(), size), sender_endpoint);
+
+				continue;
+			}
+
+			sender_endpoint=from;
+
+			if (pkt_type(pkt_id)==remote_chunk_header().pkt_id)
+			{
+				auto &rch=*reinterpret_cast<const remote_chunk_header *>(buffer.data());
+
+				if (!first_frame_id)
+					first_frame_id=rch.frame_id;
+
+				if (rch.frame_id==*first_frame_id && rch.chunk_id==rch.frame_chunks-1)
+				{
+					if (!dropped)
+					{
+						dropped=true;
+
+						continue;
+					}
+
+					++retransmits_relayed;
+				}
+
+				if (rch.frame_id==*first_frame_id+1 && rch.chunk_id>0)
+				{
+					held.emplace_back(buffer.data(), buffer.data()+size);
+
+					continue;
+				}
+			}
+
+			relay.send_to(boost::asio::buffer(buffer.data(), size), receiver_endpoint);
+		}
+	});
+
+	netvid::io_service_wrapper sender_service;
+	netvid::socket_wrapper sender_socket(sender_service.io_service);
+	netvid::sender<netvid::unlimited_sender> sender(sender_socket);
+
+	sender.set_remote_endpoint(relay.local_endpoint());
+	sender.retransmit_frames=2;
+	sender_service.run();
+
+	std::array<frame_data_managed, 2> frames;
+
+	for (int n=0; n<2; ++n)
+	{
+		frames[n].resize(160, 120, 32);
+
+		for (int y=0; y<120; ++y)
+		{
+			for (int x=0; x<160; ++x)
+				*frames[n].pixel<std::uint32_t>(x, y)=(n+1)*100000+x+y;
+		}
+
+		std::promise<void> sent;
+		auto sent_future=sent.get_future();
+
+		sender_service.io_service.post([&] { sender.send(frames[n], sent); });
+		sent_future.wait();
+	}
+
+	// the retransmit arrives after the second frame began, the first is still whole
+	BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+
+	{
+		auto lock=receiver.lock_front_buffer();
+
+		BOOST_TEST(std::equal(frames[0].data, frames[0].end(), receiver.front_buffer.data));
+	}
+
+	control.send_to(boost::asio::buffer("r", 1), relay.local_endpoint());
+
+	BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+
+	{
+		auto lock=receiver.lock_front_buffer();
+
+		BOOST_TEST(std::equal(frames[1].data, frames[1].end(), receiver.front_buffer.data));
+	}
+
+	control.send_to(boost::asio::buffer("s", 1), relay.local_endpoint());
+	relay_thread.join();
+
+	receiver_service.io_service.stop();
+	sender_service.io_service.stop();
+	receiver_service.stop();
+	sender_service.stop();
+
+	BOOST_TEST(nacks_relayed>=1);
+	BOOST_TEST(retransmits_relayed==1);
+	BOOST_TEST(receiver.nack_stats.chunks>=1u);
+	BOOST_TEST(sender.retransmit_stats.chunks>=1u);
+}
+
+BOOST_AUTO_TEST_CASE(batched_receiver_overflow)
+{
+	using namespace boost::asio::ip;
+
+	for (auto overflow : { netvid::overflow_policy::drop_newest, netvid::overflow_policy::drop_oldest })
+	{
+		BOOST_TEST_INFO_VAR(int(overflow));
+
+		netvid::io_service_wrapper receiver_service;
+		netvid::socket_wrapper receiver_socket(receiver_service.io_service);
+
+		receiver_socket.bind(udp::endpoint(address_v4::loopback(), 0));
+
+		netvid::batched_receiver receiver(receiver_socket);
+		std::vector<std::uint32_t> seen;
+
+		receiver.batch_size=4;
+		receiver.ring_slots=4;
+		receiver.overflow=overflow;
+		receiver.on_packet=[&] (const std::uint8_t *data_begin, const std::uint8_t *, const udp::endpoint &)
+		{
+			seen.push_back(*reinterpret_cast<const std::uint32_t *>(data_begin));
+		};
+		receiver.start();
+		receiver_service.run();
+
+		udp::socket sender(receiver_service.io_service, udp::endpoint(address_v4::loopback(), 0));
+		const std::uint32_t sent=64;
+
+		// nothing is processed meanwhile, one buffer goes to the consumer and the other overflows
+		for (std::uint32_t i=0; i<sent; ++i)
+			sender.send_to(boost::asio::buffer(&i, sizeof(i)), receiver_socket.socket.local_endpoint());
+
+		for (int tries=0; tries<20 && receiver.stats.packets<sent; ++tries)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		// the second buffer is asked for once the first is back
+		for (int tries=0; tries<5; ++tries)
+		{
+			receiver.process_packets();
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		receiver_service.io_service.stop();
+		receiver_service.stop();
+
+		BOOST_TEST(seen.size()+receiver.ring_stats.dropped==sent);
+		BOOST_TEST(seen.size()<=8);
+		BOOST_TEST(std::is_sorted(seen.begin(), seen.end()));
+
+		// the newest are kept or the oldest
+		if (overflow==netvid::overflow_policy::drop_oldest)
+			BOOST_TEST(seen.back()==sent-1);
+		else
+			BOOST_TEST(seen.back()<8);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(receiver_recvmmsg_batches)
+{
+	using namespace boost::asio::ip;
+
+	netvid::io_service_wrapper receiver_service;
+	netvid::socket_wrapper receiver_socket(receiver_service.io_service);
+
+	receiver_socket.bind(udp::endpoint(address_v4::loopback(), 0));
+
+	netvid::receiver receiver(receiver_socket);
+	std::vector<std::uint32_t> seen;
+	std::atomic<std::size_t> count{ 0 };
+
+	receiver.batch_size=8;
+	receiver.on_live_packet=[&] (const std::uint8_t *data_begin, const std::uint8_t *data_end, const udp::endpoint &)
+	{
+		if (data_end-data_begin==sizeof(std::uint32_t))
+			seen.push_back(*reinterpret_cast<const std::uint32_t *>(data_begin));
+
+		++count;
+	};
+	receiver.start();
+
+	// all queued before the first wakeup, drained 8 at a time
+	udp::socket sender(receiver_service.io_service, udp::endpoint(address_v4::loopback(), 0));
+	const std::uint32_t sent=20;
+
+	for (std::uint32_t i=0; i<sent; ++i)
+		sender.send_to(boost::asio::buffer(&i, sizeof(i)), receiver_socket.socket.local_endpoint());
+
+	receiver_service.run();
+
+	for (int tries=0; tries<200 && count<sent; ++tries)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	receiver_service.io_service.stop();
+	receiver_service.stop();
+
+	std::vector<std::uint32_t> expected(sent);
+
+	std::iota(expected.begin(), expected.end(), 0);
+
+	BOOST_TEST(seen==expected);
+	BOOST_TEST(receiver.stats.packets==sent);
+	BOOST_TEST(receiver.stats.batches==3u);
+	BOOST_TEST(receiver.stats.truncated==0u);
+}
+
+BOOST_AUTO_TEST_CASE(sharded_receiver_frames)
+{
+	using namespace boost::asio::ip;
+
+	for (bool reuse_port : { false, true })
+	{
+		BOOST_TEST_INFO_VAR(reuse_port);
+
+		netvid::sharded_receiver receiver(3, reuse_port);
+
+		receiver.bind(udp::endpoint(address_v4::loopback(), 0));
+		receiver.batch_size=8;
+		receiver.start();
+
+		netvid::io_service_wrapper sender_service;
+		netvid::socket_wrapper sender_socket(sender_service.io_service);
+		netvid::sender<netvid::unlimited_sender> sender(sender_socket);
+
+		sender.set_remote_endpoint(receiver.local_endpoint());
+		sender.delta=true;
+		sender_service.run();
+
+		frame_data_managed frame;
+
+		frame.resize(160, 120, 32);
+
+		for (int n=0; n<6; ++n)
+		{
+			BOOST_TEST_INFO_VAR(n);
+
+			for (int y=n*10; y<n*10+15; ++y)
+			{
+				for (int x=n*5; x<n*5+40; ++x)
+					*frame.pixel<std::uint32_t>(x, y)=n*1000+x+y;
+			}
+
+			std::promise<void> sent;
+			auto sent_future=sent.get_future();
+
+			sender_service.io_service.post([&] { sender.send(frame, sent); });
+			sent_future.wait();
+
+			BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+
+			auto lock=receiver.lock_front_buffer();
+
+			BOOST_TEST(receiver.front_buffer.bytes()==frame.bytes());
+			BOOST_TEST(std::equal(frame.data, frame.end(), receiver.front_buffer.data));
+		}
+
+		udp::socket raw_sender(sender_service.io_service, udp::endpoint(address_v4::loopback(), 0));
+
+		// chunk_ids past the frame's chunks are dropped, repeating one doesn't complete a frame
+		for (int i=0; i<2; ++i)
+		{
+			auto pkt=make_chunk_packet(6, 1 << 20, 2);
+
+			raw_sender.send_to(boost::asio::buffer(pkt), receiver.local_endpoint());
+		}
+
+		BOOST_TEST(!receiver.acquire_frame(std::chrono::milliseconds(200)));
+		BOOST_TEST(receiver.get_stats().dropped==2);
+
+		// frames cut short by the next one show the last frame where their chunks are missing, or didn't decode
+		int columns;
+		int rows;
+		int top;
+		int left;
+		int bottom;
+		int right;
+
+		std::tie(columns, rows)=get_frame_divisions(frame.width, frame.height, frame.bpp);
+		std::tie(top, left, bottom, right)=get_chunk(frame.width, frame.height, columns, rows, 0, 0);
+
+		for (std::uint32_t frame_id=7; frame_id<11; ++frame_id)
+		{
+			BOOST_TEST_INFO_VAR(frame_id);
+
+			bool corrupt=frame_id==9;
+			remote_chunk_header rch;
+
+			rch.frame_id=frame_id;
+			rch.frame_chunks=columns*rows;
+			rch.x=left;
+			rch.y=top;
+			rch.width=right-left;
+			rch.height=bottom-top;
+			rch.pitch=rch.width*4;
+			rch.bpp=32;
+
+			std::vector<std::uint8_t> pixels;
+
+			for (int y=top; y<bottom; ++y)
+			{
+				for (int x=left; x<right; ++x)
+				{
+					std::uint32_t pixel=frame_id*100000+x+y;
+					auto bytes=reinterpret_cast<const std::uint8_t *>(&pixel);
+
+					pixels.insert(pixels.end(), bytes, bytes+sizeof(pixel));
+				}
+			}
+
+			// cut short, half of it would decode before the decoder notices
+			if (corrupt)
+			{
+				std::vector<std::uint8_t> encoded(pixels.size()*2);
+				auto size=netvid::rle_encode(pixels.data(), rch.pitch, rch.pitch, rch.height, netvid::codec_unit_size(32, rch.pitch), encoded.data(), encoded.size());
+
+				rch.pkt_id|=pkt_flag_compressed;
+				pixels.assign(encoded.data(), encoded.data()+size/2);
+			}
+
+			std::vector<std::uint8_t> pkt(reinterpret_cast<const std::uint8_t *>(&rch), reinterpret_cast<const std::uint8_t *>(&rch)+sizeof(rch));
+
+			pkt.insert(pkt.end(), pixels.begin(), pixels.end());
+			raw_sender.send_to(boost::asio::buffer(pkt), receiver.local_endpoint());
+
+			BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+
+			auto lock=receiver.lock_front_buffer();
+
+			BOOST_TEST(std::equal(frame.data, frame.end(), receiver.front_buffer.data));
+
+			if (corrupt)
+				continue;
+
+			for (int y=top; y<bottom; ++y)
+			{
+				for (int x=left; x<right; ++x)
+					*frame.pixel<std::uint32_t>(x, y)=frame_id*100000+x+y;
+			}
+		}
+
+		receiver.stop();
+		sender_service.io_service.stop();
+		sender_service.stop();
+
+		BOOST_TEST(receiver.get_stats().frames==10);
+		BOOST_TEST(receiver.get_stats().dropped==3);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(sharded_receiver_interleaved_frames)
+{
+	using namespace boost::asio::ip;
+
+	// the shards share a socket, one takes the next frame's first chunk while the other still places the last frame's
+	netvid::sharded_receiver receiver(2);
+
+	receiver.bind(udp::endpoint(address_v4::loopback(), 0));
+	receiver.batch_size=1;
+
+	frame_data_managed frame;
+
+	frame.resize(160, 120, 32);
+
+	int columns;
+	int rows;
+
+	std::tie(columns, rows)=get_frame_divisions(frame.width, frame.height, frame.bpp);
+
+	auto make_chunk=[&] (std::uint32_t frame_id, int chunk_id)
+	{
+		int top;
+		int left;
+		int bottom;
+		int right;
+
+		std::tie(top, left, bottom, right)=get_chunk(frame.width, frame.height, columns, rows, chunk_id/columns, chunk_id%columns);
+
+		auto pkt=make_chunk_packet(frame_id, chunk_id, columns*rows);
+		auto &rch=*reinterpret_cast<remote_chunk_header *>(pkt.data());
+
+		rch.x=left;
+		rch.y=top;
+		rch.width=right-left;
+		rch.height=bottom-top;
+		rch.pitch=rch.width*4;
+		rch.bpp=32;
+
+		for (int y=top; y<bottom; ++y)
+		{
+			for (int x=left; x<right; ++x)
+			{
+				std::uint32_t pixel=frame_id*100000+x+y;
+				auto bytes=reinterpret_cast<const std::uint8_t *>(&pixel);
+
+				*frame.pixel<std::uint32_t>(x, y)=pixel;
+				pkt.insert(pkt.end(), bytes, bytes+sizeof(pixel));
+			}
+		}
+
+		return pkt;
+	};
+
+	netvid::io_service_wrapper sender_service;
+	udp::socket raw_sender(sender_service.io_service, udp::endpoint(address_v4::loopback(), 0));
+	std::promise<void> interleaved;
+	auto interleaved_future=interleaved.get_future();
+
+	receiver.on_chunk_placed=[&] (const remote_chunk_header &header)
+	{
+		if (header.frame_id!=2)
+			return;
+
+		// frame 3 begins on the other shard, it mustn't count this chunk as its own
+		raw_sender.send_to(boost::asio::buffer(make_chunk(3, 0)), receiver.local_endpoint());
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		interleaved.set_value();
+	};
+
+	receiver.start();
+
+	remote_mode_header rmh;
+
+	rmh.seq_id=1;
+	rmh.width=frame.width;
+	rmh.height=frame.height;
+	rmh.pitch=frame.pitch;
+	rmh.bpp=frame.bpp;
+	raw_sender.send_to(boost::asio::buffer(&rmh, sizeof(rmh)), receiver.local_endpoint());
+
+	for (int id=0; id<columns*rows; ++id)
+		raw_sender.send_to(boost::asio::buffer(make_chunk(1, id)), receiver.local_endpoint());
+
+	BOOST_TEST(receiver.acquire_frame(std::chrono::seconds(2)));
+
+	// frame 2 ends after its first chunk, frame 3 is sent whole, the rest of it once the chunk of frame 2 is done
+	raw_sender.send_to(boost::asio::buffer(make_chunk(2, 0)), receiver.local_endpoint());
+	BOOST_TEST((interleaved_future.wait_for(std::chrono::seconds(2))==std::future_status::ready));
+
+	for (int id=1; id<columns*rows; ++id)
+		raw_sender.send_to(boost::asio::buffer(make_chunk(3, id)), receiver.local_endpoint());
+
+	bool shown=false;
+
+	for (int tries=0; !shown && tries<20; ++tries)
+	{
+		if (!receiver.acquire_frame(std::chrono::milliseconds(100)))
+			continue;
+
+		auto lock=receiver.lock_front_buffer();
+
+		shown=std::equal(frame.data, frame.end(), receiver.front_buffer.data);
+	}
+
+	BOOST_TEST(shown);
+
+	receiver.stop();
+
+	BOOST_TEST(receiver.get_stats().frames==3);
+	BOOST_TEST(receiver.get_stats().dropped==0);
+}
+
+BOOST_AUTO_TEST_CASE(fec_recovery)
+{
+	const std::uint32_t group_size=4;
+	const std::uint32_t frame_chunks=10;
+
+	// chunks of varying length, so recovery has to get the length right too
+	auto make_chunk=[] (std::uint32_t frame_id, std::uint32_t chunk_id, std::uint32_t flags)
+	{
+		auto packet=make_chunk_packet(frame_id, chunk_id, frame_chunks, flags);
+
+		for (std::uint32_t i=0; i<chunk_id*3+1; ++i)
+			packet.push_back(std::uint8_t(frame_id*31+chunk_id*7+i));
+
+		return packet;
+	};
+
+	netvid::fec_decoder decoder;
+	std::vector<std::vector<std::uint8_t>> recovered;
+
+	decoder.group_size=group_size;
+	decoder.on_recovered=[&] (const std::uint8_t *data_begin, const std::uint8_t *data_end)
+	{
+		recovered.emplace_back(data_begin, data_end);
+	};
+
+	auto send_frame=[&] (std::uint32_t frame_id, const std::vector<std::uint32_t> &chunk_ids, const std::vector<std::uint32_t> &lost, std::uint32_t flags)
+	{
+		netvid::parity_encoder encoder;
+		std::vector<std::vector<std::uint8_t>> expected;
+
+		for (auto i=chunk_ids.begin(); i!=chunk_ids.end(); ++i)
+		{
+			auto chunk=make_chunk(frame_id, *i, flags);
+			auto first_chunk_id=*i-*i%group_size;
+
+			if (encoder.empty())
+				encoder.reset(frame_id, first_chunk_id);
+
+			encoder.add(*i, std::vector<boost::asio::const_buffer>({ boost::asio::buffer(chunk) }));
+
+			if (std::find(lost.begin(), lost.end(), *i)==lost.end())
+				decoder.process(chunk.data(), chunk.data()+chunk.size());
+			else
+				expected.push_back(chunk);
+
+			auto next=std::next(i);
+
+			if (next!=chunk_ids.end() && *next<first_chunk_id+group_size)
+				continue;
+
+			std::vector<std::uint8_t> parity;
+
+			for (const auto &b : encoder.packet())
+				parity.insert(parity.end(), boost::asio::buffer_cast<const std::uint8_t *>(b), boost::asio::buffer_cast<const std::uint8_t *>(b)+boost::asio::buffer_size(b));
+
+			decoder.process(parity.data(), parity.data()+parity.size());
+			encoder.reset(frame_id, 0);
+		}
+
+		return expected;
+	};
+
+	// one loss per group, including the last (short) group, is rebuilt
+	auto expected=send_frame(0, { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }, { 1, 7, 8 }, 0);
+
+	BOOST_TEST(recovered==expected);
+	BOOST_TEST(decoder.stats.recovered==3);
+
+	// a delta frame covers only the chunks sent in each group
+	recovered.clear();
+	expected=send_frame(1, { 0, 2, 5, 6, 7, 9 }, { 2, 6 }, pkt_flag_delta);
+
+	BOOST_TEST(recovered==expected);
+	BOOST_TEST(decoder.stats.recovered==5);
+
+	// two losses in a group are beyond xor parity
+	recovered.clear();
+	send_frame(2, { 0, 1, 2, 3 }, { 1, 2 }, 0);
+	send_frame(3, { 0 }, {}, 0);
+
+	BOOST_TEST(recovered.empty());
+	BOOST_TEST(decoder.stats.unrecoverable==1);
+}
+
+BOOST_AUTO_TEST_CASE(rle_round_trip)
+{
+	const std::size_t width=200;
+	const std::size_t height=12;
+	std::vector<std::uint8_t> noise(4*width*height);
+
+	for (std::size_t i=0; i<noise.size(); ++i)
+		noise[i]=std::uint8_t(i*2654435761u >> 13);
+
+	for (std::size_t unit=1; unit<=4; ++unit)
+	{
+		BOOST_TEST_CONTEXT("With unit " << unit)
+		{
+			std::size_t row_bytes=width*unit;
+			std::size_t pitch=row_bytes+8;
+			std::vector<std::uint8_t> src(pitch*height);
+
+			// flat areas, a long run, rows repeating the one above and noise
+			for (std::size_t y=0; y<height; ++y)
+			{
+				for (std::size_t x=0; x<row_bytes; ++x)
+				{
+					auto &b=src[y*pitch+x];
+
+					if (y%4==3)
+						b=src[(y-1)*pitch+x];
+					else if (y%4==2)
+						b=noise[y*row_bytes+x];
+					else
+						b=std::uint8_t(x/unit<150 ? y : x/unit/7);
+				}
+			}
+
+			std::vector<std::uint8_t> encoded(src.size()*2);
+			auto size=netvid::rle_encode(src.data(), pitch, row_bytes, height, unit, encoded.data(), encoded.size());
+
+			BOOST_TEST(size>0);
+			BOOST_TEST(size<row_bytes*height);
+
+			std::vector<std::uint8_t> decoded(src.size(), 0xcc);
+
+			BOOST_TEST(netvid::rle_decode(encoded.data(), size, decoded.data(), pitch, row_bytes, height, unit));
+
+			for (std::size_t y=0; y<height; ++y)
+				BOOST_TEST(std::equal(src.begin()+y*pitch, src.begin()+y*pitch+row_bytes, decoded.begin()+y*pitch));
+
+			// not enough room is a clean failure, so are truncated or trailing data
+			BOOST_TEST(netvid::rle_encode(src.data(), pitch, row_bytes, height, unit, encoded.data(), size-1)==0);
+			BOOST_TEST(!netvid::rle_decode(encoded.data(), size-1, decoded.data(), pitch, row_bytes, height, unit));
+			BOOST_TEST(!netvid::rle_decode(encoded.data(), size, decoded.data(), pitch, row_bytes, height-1, unit));
+		}
+	}
+
+	// a copy from above in the first row has nothing to copy
+	std::uint8_t copy_first_row[]={ 0x80 | 1 };
+	std::uint8_t out[2];
+
+	BOOST_TEST(!netvid::rle_decode(copy_first_row, sizeof(copy_first_row), out, sizeof(out), sizeof(out), 1, 1));
+}
+
+BOOST_AUTO_TEST_CASE(recording_index)
+{
+	std::stringstream v2;
+	std::stringstream legacy;
+	netvid::recording_writer writer(v2);
+
+	// 10 frames of 3 chunks, a late chunk of the previous frame after each frame's first
+	for (std::uint32_t frame=0; frame<10; ++frame)
+	{
+		for (std::uint32_t chunk=0; chunk<3; ++chunk)
+		{
+			auto pkt=make_chunk_packet(frame, chunk, 3);
+			std::chrono::nanoseconds time(frame*1000000000ll+chunk*1000);
+			std::int64_t legacy_time=time.count();
+			std::uint32_t size=pkt.size();
+
+			writer.write(time, pkt.data(), pkt.data()+pkt.size());
+			legacy.write(reinterpret_cast<const char *>(&legacy_time), sizeof(legacy_time));
+			legacy.write(reinterpret_cast<const char *>(&size), sizeof(size));
+			legacy.write(reinterpret_cast<const char *>(pkt.data()), pkt.size());
+
+			if (chunk==0 && frame>0)
+			{
+				auto late=make_chunk_packet(frame-1, 2, 3);
+
+				writer.write(time, late.data(), late.data()+late.size());
+			}
+		}
+	}
+
+	writer.finish();
+
+	auto frame_of=[] (const netvid::recorded_packet &packet)
+	{
+		return reinterpret_cast<const remote_chunk_header *>(packet.data)->frame_id;
+	};
+
+	auto v2_data=v2.str();
+	netvid::recording_reader reader(reinterpret_cast<const std::uint8_t *>(v2_data.data()), v2_data.size());
+	netvid::recorded_packet packet;
+	std::size_t packets=0;
+
+	BOOST_TEST(reader.version()==2u);
+	BOOST_TEST(reader.indexed());
+
+	for (; reader.read(packet); ++packets)
+		BOOST_TEST(packet.size==sizeof(remote_chunk_header));
+
+	BOOST_TEST(packets==39u);
+
+	// seeks land on the first chunk of the frame, with its time
+	BOOST_TEST(reader.seek_frame(7));
+	BOOST_TEST(reader.read(packet));
+	BOOST_TEST(frame_of(packet)==7u);
+	BOOST_TEST(packet.time.count()==7000000000ll);
+	BOOST_TEST(reader.read(packet));
+	BOOST_TEST(frame_of(packet)==6u);
+	BOOST_TEST(packet.time.count()==7000000000ll);
+	BOOST_TEST(reader.read(packet));
+	BOOST_TEST(packet.time.count()==7000001000ll);
+
+	BOOST_TEST(reader.seek_time(std::chrono::milliseconds(4500)));
+	BOOST_TEST(reader.read(packet));
+	BOOST_TEST(frame_of(packet)==4u);
+	BOOST_TEST(reader.seek_frame(100));
+	BOOST_TEST(reader.read(packet));
+	BOOST_TEST(frame_of(packet)==9u);
+
+	// old recordings read the same, in order only
+	auto legacy_data=legacy.str();
+	netvid::recording_reader legacy_reader(reinterpret_cast<const std::uint8_t *>(legacy_data.data()), legacy_data.size());
+
+	BOOST_TEST(legacy_reader.version()==1u);
+	BOOST_TEST(!legacy_reader.indexed());
+	BOOST_TEST(!legacy_reader.seek_frame(7));
+
+	for (packets=0; legacy_reader.read(packet); ++packets)
+		BOOST_TEST(packet.time.count()==frame_of(packet)*1000000000ll+reinterpret_cast<const remote_chunk_header *>(packet.data)->chunk_id*1000);
+
+	BOOST_TEST(packets==30u);
+
+	// a recording cut short reads up to where it ends
+	netvid::recording_reader cut_reader(reinterpret_cast<const std::uint8_t *>(v2_data.data()), v2_data.size()/2);
+
+	BOOST_TEST(!cut_reader.indexed());
+
+	for (packets=0; cut_reader.read(packet); ++packets)
+		;
+
+	BOOST_TEST(packets>0u);
+	BOOST_TEST(packets<39u);
+
+	// a sender restarting indexes its frames anew, frame_ids then run backwards and only time seeks
+	std::stringstream restarted;
+	netvid::recording_writer restarted_writer(restarted);
+
+	for (std::uint32_t n=0; n<20; ++n)
+	{
+		auto frame=n<10 ? 1000+n : n-10;
+		auto pkt=make_chunk_packet(frame, 0, 1);
+
+		restarted_writer.write(std::chrono::seconds(n), pkt.data(), pkt.data()+pkt.size());
+	}
+
+	restarted_writer.finish();
+
+	auto restarted_data=restarted.str();
+	netvid::recording_reader restarted_reader(reinterpret_cast<const std::uint8_t *>(restarted_data.data()), restarted_data.size());
+
+	BOOST_TEST(restarted_reader.indexed());
+	BOOST_TEST(!restarted_reader.seek_frame(5));
+	BOOST_TEST(!restarted_reader.seek_frame(1005));
+	BOOST_TEST(restarted_reader.read(packet));
+	BOOST_TEST(frame_of(packet)==1000u);
+
+	BOOST_TEST(restarted_reader.seek_time(std::chrono::milliseconds(15500)));
+	BOOST_TEST(restarted_reader.read(packet));
+	BOOST_TEST(frame_of(packet)==5u);
+	BOOST_TEST(packet.time.count()==15000000000ll);
+	BOOST_TEST(restarted_reader.seek_time(std::chrono::milliseconds(3000)));
+	BOOST_TEST(restarted_reader.read(packet));
+	BOOST_TEST(frame_of(packet)==1003u);
+}
+
+BOOST_AUTO_TEST_CASE(recording_blocks)
+{
+	std::stringstream plain;
+	std::stringstream compressed;
+	netvid::block_compression compression;
+
+	// a few records per block, decoded by more threads than there are blocks ahead
+	compression.preset=1;
+	compression.block_size=200;
+	compression.threads=3;
+
+	{
+		netvid::recording_writer plain_writer(plain);
+		netvid::recording_writer writer(compressed, compression);
+
+		for (std::uint32_t frame=0; frame<50; ++frame)
+		{
+			for (std::uint32_t chunk=0; chunk<4; ++chunk)
+			{
+				auto pkt=make_chunk_packet(frame, chunk, 4);
+				std::chrono::nanoseconds time(frame*1000000ll+chunk);
+
+				plain_writer.write(time, pkt.data(), pkt.data()+pkt.size());
+				writer.write(time, pkt.data(), pkt.data()+pkt.size());
+			}
+		}
+
+		plain_writer.finish();
+		writer.finish();
+	}
+
+	auto plain_data=plain.str();
+	auto compressed_data=compressed.str();
+
+	BOOST_TEST(compressed_data.size()<plain_data.size());
+
+	netvid::recording_reader plain_reader(reinterpret_cast<const std::uint8_t *>(plain_data.data()), plain_data.size());
+	netvid::recording_reader reader(reinterpret_cast<const std::uint8_t *>(compressed_data.data()), compressed_data.size(), 2);
+	netvid::recorded_packet plain_packet;
+	netvid::recorded_packet packet;
+	std::size_t packets=0;
+
+	BOOST_TEST(reader.compressed());
+	BOOST_TEST(reader.indexed());
+
+	for (; plain_reader.read(plain_packet); ++packets)
+	{
+		BOOST_TEST_REQUIRE(reader.read(packet));
+		BOOST_TEST(packet.time.count()==plain_packet.time.count());
+		BOOST_TEST(std::equal(packet.data, packet.end(), plain_packet.data, plain_packet.end()));
+		BOOST_TEST(reader.offset()==plain_reader.offset());
+	}
+
+	BOOST_TEST(packets==200u);
+	BOOST_TEST(!reader.read(packet));
+
+	// seeks decode the block the frame begins in, back and forth
+	for (std::uint32_t frame : { 37u, 3u, 49u, 0u })
+	{
+		BOOST_TEST(reader.seek_frame(frame));
+		BOOST_TEST_REQUIRE(reader.read(packet));
+		BOOST_TEST(reinterpret_cast<const remote_chunk_header *>(packet.data)->frame_id==frame);
+		BOOST_TEST(reinterpret_cast<const remote_chunk_header *>(packet.data)->chunk_id==0u);
+		BOOST_TEST(packet.time.count()==frame*1000000ll);
+	}
+
+	BOOST_TEST(reader.seek_time(std::chrono::microseconds(20500)));
+	BOOST_TEST_REQUIRE(reader.read(packet));
+	BOOST_TEST(reinterpret_cast<const remote_chunk_header *>(packet.data)->frame_id==20u);
+
+	// a recording cut short reads up to its last whole block
+	netvid::recording_reader cut_reader(reinterpret_cast<const std::uint8_t *>(compressed_data.data()), compressed_data.size()/2);
+
+	BOOST_TEST(!cut_reader.indexed());
+
+	for (packets=0; cut_reader.read(packet); ++packets)
+		;
+
+	BOOST_TEST(packets>0u);
+	BOOST_TEST(packets<200u);
+}
+
+BOOST_AUTO_TEST_CASE(write_behind_recording)
+{
+	auto filename="/tmp/netvid_test_"+std::to_string(getpid())+".nv";
+	std::uint64_t recorded=0;
+
+	for (bool direct : { false, true })
+	{
+		BOOST_TEST_INFO_VAR(direct);
+
+		{
+			netvid::aligned_file_buffer file_buffer(filename, direct, 8192);
+			std::ostream os(&file_buffer);
+			netvid::recording_writer writer(os);
+			netvid::write_behind_recorder recorder(writer, 64*1024);
+
+			// the queue wraps many times, whatever doesn't fit is counted
+			for (std::uint32_t frame=0; frame<2000; ++frame)
+			{
+				auto pkt=make_chunk_packet(frame, 0, 1);
+
+				pkt.resize(sizeof(remote_chunk_header)+frame%700, std::uint8_t(frame));
+				recorder.push(std::chrono::nanoseconds(frame), pkt.data(), pkt.data()+pkt.size());
+			}
+
+			std::vector<std::uint8_t> too_large(128*1024);
+
+			BOOST_TEST(!recorder.push(std::chrono::nanoseconds(0), too_large.data(), too_large.data()+too_large.size()));
+
+			recorder.stop();
+			writer.finish();
+
+			BOOST_TEST(recorder.stats.packets+recorder.stats.dropped==2001u);
+			BOOST_TEST(recorder.stats.queued_high_water<=64*1024u);
+			BOOST_TEST(!recorder.stats.write_failed);
+			BOOST_TEST(file_buffer.close());
+			recorded=recorder.stats.packets;
+		}
+
+		netvid::recording_reader reader(filename);
+		netvid::recorded_packet packet;
+		boost::optional<std::uint32_t> last_frame;
+		std::size_t packets=0;
+
+		BOOST_TEST(reader.indexed());
+
+		for (; reader.read(packet); ++packets)
+		{
+			auto frame=reinterpret_cast<const remote_chunk_header *>(packet.data)->frame_id;
+
+			BOOST_TEST(packet.time.count()==frame);
+			BOOST_TEST(packet.size==sizeof(remote_chunk_header)+frame%700);
+			BOOST_TEST((!last_frame || frame>*last_frame));
+			BOOST_TEST(std::all_of(packet.data+sizeof(remote_chunk_header), packet.end(), [frame] (std::uint8_t b) { return b==std::uint8_t(frame); }));
+
+			last_frame=frame;
+		}
+
+		BOOST_TEST(packets==recorded);
+	}
+
+	std::remove(filename.c_str());
+
+	// a full disk is reported, not cut short silently
+	{
+		netvid::aligned_file_buffer file_buffer("/dev/full", false, 8192);
+		std::ostream os(&file_buffer);
+		netvid::recording_writer writer(os);
+		netvid::write_behind_recorder recorder(writer, 64*1024);
+
+		for (std::uint32_t frame=0; frame<100; ++frame)
+		{
+			auto pkt=make_chunk_packet(frame, 0, 1);
+
+			pkt.resize(sizeof(remote_chunk_header)+500);
+			recorder.push(std::chrono::nanoseconds(frame), pkt.data(), pkt.data()+pkt.size());
+		}
+
+		recorder.stop();
+
+		BOOST_TEST(recorder.stats.write_failed);
+		BOOST_TEST(!writer.good());
+		BOOST_TEST(!file_buffer.close());
+		BOOST_TEST(file_buffer.error()==ENOSPC);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(receiver_kernel_timestamps)
+{
+	using namespace boost::asio::ip;
+
+	for (int batch_size : { 1, 4 })
+	{
+		BOOST_TEST_INFO_VAR(batch_size);
+
+		netvid::io_service_wrapper receiver_service;
+		netvid::socket_wrapper receiver_socket(receiver_service.io_service);
+
+		receiver_socket.bind(udp::endpoint(address_v4::loopback(), 0));
+
+		netvid::receiver receiver(receiver_socket);
+		std::vector<std::chrono::nanoseconds> times;
+
+		receiver.batch_size=batch_size;
+		receiver.kernel_timestamps=true;
+		receiver.on_live_received_packet=[&] (const netvid::received_packet &pkt)
+		{
+			times.push_back(pkt.kernel_time);
+		};
+		receiver.start();
+
+		BOOST_REQUIRE(receiver.kernel_timestamps);
+
+		auto before=std::chrono::system_clock::now().time_since_epoch();
+
+		receiver_service.run();
+
+		udp::socket sender(receiver_service.io_service, udp::endpoint(address_v4::loopback(), 0));
+		const std::uint32_t sent=16;
+
+		for (std::uint32_t i=0; i<sent; ++i)
+			sender.send_to(boost::asio::buffer(&i, sizeof(i)), receiver_socket.socket.local_endpoint());
+
+		for (int tries=0; tries<50 && receiver.stats.packets<sent; ++tries)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		receiver_service.io_service.stop();
+		receiver_service.stop();
+
+		auto after=std::chrono::system_clock::now().time_since_epoch();
+
+		BOOST_TEST(times.size()==sent);
+		BOOST_TEST(std::is_sorted(times.begin(), times.end()));
+
+		for (auto time : times)
+			BOOST_TEST((time>=before && time<=after));
+	}
+
+	// the clock source is kept in the header
+	for (bool kernel_timestamps : { false, true })
+	{
+		std::stringstream ss;
+		netvid::recording_writer writer(ss, {}, kernel_timestamps);
+
+		writer.finish();
+
+		auto str=ss.str();
+		netvid::recording_reader reader(reinterpret_cast<const std::uint8_t *>(str.data()), str.size());
+
+		BOOST_TEST(reader.kernel_timestamps()==kernel_timestamps);
+	}
+}
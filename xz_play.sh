@@ -1,3 +1,8 @@
 #!/usr/bin/env bash
 DIR="$( dirname "$0" )"
-xz -T 0 -d -c "${@: -1}" | "${DIR}/netvid_play" "${@:1:$#-1}" --file -
\ No newline at end of file
+# recordings from before the block compressed format are xz streams as a whole
+if [ "$( head -c 6 "${@: -1}" | od -An -tx1 | tr -d ' \n' )" = "fd377a585a00" ]; then
+	xz -T 0 -d -c "${@: -1}" | "${DIR}/netvid_play" "${@:1:$#-1}" --file -
+else
+	"${DIR}/netvid_play" "${@:1:$#-1}" --file "${@: -1}"
+fi
@@ -1,3 +1,3 @@
 #!/usr/bin/env bash
 DIR="$( dirname "$0" )"
-"${DIR}/netvid_record" --file - "${@:1:$#-1}" | setsid xz -T 0 >"${@: -1}"
\ No newline at end of file
+"${DIR}/netvid_record" --compress 6 --file "${@: -1}" "${@:1:$#-1}"
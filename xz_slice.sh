@@ -1,3 +1,8 @@
 #!/usr/bin/env bash
 DIR="$( dirname "$0" )"
-xz -T 0 -d -c "${@:$#-1:1}" | "${DIR}/netvid_slice" "${@:1:$#-2}" --input-file - --output-file - | xz -T 0 >"${@: -1}"
\ No newline at end of file
+# recordings from before the block compressed format are xz streams as a whole, they come out block compressed
+if [ "$( head -c 6 "${@:$#-1:1}" | od -An -tx1 | tr -d ' \n' )" = "fd377a585a00" ]; then
+	xz -T 0 -d -c "${@:$#-1:1}" | "${DIR}/netvid_slice" "${@:1:$#-2}" --compress 6 --input-file - --output-file "${@: -1}"
+else
+	"${DIR}/netvid_slice" "${@:1:$#-2}" --compress 6 --input-file "${@:$#-1:1}" --output-file "${@: -1}"
+fi